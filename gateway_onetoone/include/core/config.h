@@ -0,0 +1,26 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/**
+ * Reads an integer setting from the environment.
+ *
+ * All runtime knobs of the gateway are plain environment variables prefixed
+ * with `GATEWAY_`, so the binary keeps running with no arguments and the
+ * compiled-in defaults.
+ *
+ * @param name - Environment variable name, e.g. "GATEWAY_TCP_BACKLOG".
+ * @param def - Value returned when the variable is unset or malformed.
+ * @return The configured value or def.
+ */
+long config_get_int(const char *name, long def);
+
+/**
+ * Reads a string setting from the environment.
+ *
+ * @param name - Environment variable name.
+ * @param def - Value returned when the variable is unset or empty.
+ * @return The configured value or def. The pointer must not be freed.
+ */
+const char *config_get_str(const char *name, const char *def);
+
+#endif // CONFIG_H
@@ -5,8 +5,10 @@
 #include <stdint.h>
 #include <sys/epoll.h>
 #define BUF_SIZE 1024
+#define CONN_INBUF_SIZE 4096 // inbuf 容量，单独分配，不和热字段挤在一起
 
 typedef struct event_loop event_loop_t;
+typedef struct zc_seg zc_seg_t;
 
 typedef enum {
   CONN_STATE_OPEN, // 连接已打开，正常状态
@@ -21,13 +23,21 @@ typedef struct connection {
   event_loop_t *loop; // 指向事件循环的指针，便于在回调中修改监听事件
   conn_state_t state; // 连接状态
 
-  char inbuf[4096];
+  char *inbuf; // CONN_INBUF_SIZE 字节，listener 等内部连接为 NULL
   int in_len;
 
   char *outbuf;
   int out_len;
   int out_cap;
 
+  // MSG_ZEROCOPY：已交给内核的缓冲区在完成通知到达前不能改写或释放
+  int zerocopy;        // 已启用 SO_ZEROCOPY
+  zc_seg_t *zc_head;   // 等待完成通知的缓冲区，按发送顺序排列
+  zc_seg_t *zc_tail;
+  int zc_unsent;       // zc_tail 中尚未交给内核的字节数
+  uint32_t zc_next;    // 下一次 MSG_ZEROCOPY 发送的序号
+  uint32_t zc_done;    // 内核已确认完成的序号上界（不含）
+
   int read_closed;  // 标志：读取端是否已关闭
   int write_closed; // 标志：写入端是否已关闭
 
@@ -37,12 +47,16 @@ typedef struct connection {
   struct connection
       *peer; // 可选：指向相关联的连接，例如 MCU 连接可以指向对应的 UNIX 连接
 
-  struct connection *next; // 可选：链表指针，用于管理多个连接
+  struct connection *next; // 可选：链表指针，用于管理多个连接（如同一后端的会话）
+  struct connection *prev;
 
   void (*on_read)(struct connection *); // 读取事件回调函数，参数为当前连接指针
   void (*on_write)(struct connection *); // 写入事件回调函数，参数为当前连接指针
+  void (*on_error)(struct connection *); // 可选：EPOLLERR 回调，例如读取 socket 错误队列
+  void (*on_close)(struct connection *); // 可选：销毁前回调，用于从外部索引中摘除
 
   void *user_data; // 可选：指向用户数据的指针，便于在回调中存储上下文信息
+  long *out_counter; // 可选：随待发送字节数同步增减的外部计数，例如所属后端的排队字节
 } connection_t;
 
 connection_t *connection_create(event_loop_t *loop, int fd);
@@ -58,4 +72,18 @@ void connection_close(connection_t *conn);
 
 void connection_append_out(connection_t *conn, const char *data, int len);
 
+// 尚未交给内核的输出字节数（outbuf + 零拷贝缓冲区中未发送的部分）
+static inline int connection_out_pending(const connection_t *conn) {
+  return conn->out_len + conn->zc_unsent;
+}
+
+// 记录 n 字节已交给内核，同步 out_counter；调用方自己更新 out_len/zc_unsent
+static inline void connection_out_sent(connection_t *conn, int n) {
+  if (conn->out_counter)
+    *conn->out_counter -= n;
+}
+
+// 当前存活的连接数（不含 listener），用于连接数上限
+int connection_count(void);
+
 #endif // CONNECTION_H
@@ -2,9 +2,22 @@
 
 #include <core/connection.h>
 
+typedef struct event_timer event_timer_t;
+typedef void (*event_timer_cb_t)(void *arg);
+
 event_loop_t *event_loop_create();
 void event_loop_run(event_loop_t *loop);
 
 void event_loop_add(event_loop_t *loop, int fd, uint32_t events, void *ptr);
 void event_loop_mod(event_loop_t *loop, int fd, uint32_t events, void *ptr);
 void event_loop_del(event_loop_t *loop, int fd);
+
+/**
+ * Schedules cb(arg) to run once on the loop's thread after delay_ms.
+ *
+ * @return Handle for event_loop_cancel_timer(). It becomes invalid once the
+ *         callback has run.
+ */
+event_timer_t *event_loop_add_timer(event_loop_t *loop, uint64_t delay_ms,
+                                    event_timer_cb_t cb, void *arg);
+void event_loop_cancel_timer(event_loop_t *loop, event_timer_t *timer);
@@ -0,0 +1,62 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <core/connection.h>
+
+/*
+ * MSG_ZEROCOPY sends for large downlink transfers (firmware images, config
+ * blobs). Instead of copying outbuf into the socket buffer, the kernel pins
+ * its pages; the buffer is detached from the connection and kept alive until
+ * the completion notification arrives on the socket error queue.
+ *
+ * GATEWAY_ZEROCOPY_MIN sets the smallest write that uses it (default 16 KiB,
+ * 0 disables). Smaller writes are cheaper to copy than to pin.
+ */
+
+// 触发零拷贝发送的最小字节数，0 表示禁用
+int zerocopy_threshold(void);
+
+/**
+ * Turns on SO_ZEROCOPY for a TCP connection and installs the completion
+ * handler as its on_error callback. Does nothing if disabled or unsupported.
+ *
+ * @param conn - Connection whose socket should send without copying.
+ */
+void zerocopy_enable(connection_t *conn);
+
+/**
+ * Sends the next chunk of pending output, using MSG_ZEROCOPY for large
+ * buffers. Bytes still pinned by an earlier partial send go first.
+ *
+ * @param conn - Connection with connection_out_pending(conn) > 0.
+ * @return Number of bytes handed to the kernel, or -1 with errno set.
+ */
+int zerocopy_write(connection_t *conn);
+
+/**
+ * Reads completion notifications from the socket error queue and frees the
+ * buffers the kernel no longer references.
+ *
+ * @param conn - Connection signalled with EPOLLERR.
+ */
+void zerocopy_reap(connection_t *conn);
+
+/**
+ * Keeps a connection whose socket is shut down in both directions registered
+ * until every pinned buffer has been reaped. The kernel keeps reading those
+ * pages until their completion arrives, so the buffers cannot be freed (and
+ * the socket cannot be closed) before that. The fd is switched to
+ * edge-triggered with no IN/OUT interest so the hang-up does not spin the
+ * loop while each new completion still raises EPOLLERR.
+ *
+ * @param conn - Connection about to be closed.
+ * @return 1 if buffers are still pinned and the close has to wait for
+ *         zerocopy_reap() to empty them, 0 if it can be closed now.
+ */
+int zerocopy_linger(connection_t *conn);
+
+// 释放连接上所有零拷贝缓冲区。正常关闭前须由 zerocopy_linger() 等到完成通知
+// 回收完毕；只有连接出错、内核已丢弃发送队列时才可直接释放
+void zerocopy_release(connection_t *conn);
+
+#endif // ZEROCOPY_H
@@ -4,5 +4,6 @@
 
 void handle_read(connection_t *conn);
 void handle_write(connection_t *conn);
+void handle_error(connection_t *conn);
 
 #endif // MCU_PROTOCOL_H
@@ -0,0 +1,52 @@
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <core/connection.h>
+#include <stdint.h>
+
+// 新旧进程之间交接 fd 使用的 UNIX socket
+#define HOT_RESTART_PATH "/tmp/gateway_onetoone.restart.sock"
+
+typedef enum {
+  HR_MSG_TCP_LISTENER = 1, // MCU 侧 TCP listener
+  HR_MSG_END               // 交接结束，新进程回复 1 字节确认
+} hr_msg_type_t;
+
+/*
+ * Every record on the hand-off socket is this header. A record that carries
+ * an fd has it attached as SCM_RIGHTS.
+ *
+ * Only the listener is handed over: every MCU session is bound to its own
+ * backend connection, so the old process keeps serving the sessions it owns
+ * until they close.
+ */
+typedef struct {
+  uint32_t type;
+} hr_msg_hdr_t;
+
+/**
+ * Takes over the listener of a running gateway (new process side).
+ *
+ * Must run before transport_tcp_init().
+ *
+ * @return 1 if the listener was inherited, 0 if nothing was running.
+ */
+int hot_restart_inherit(void);
+
+/**
+ * Returns the inherited listener fd, or -1 so the caller creates a new one.
+ */
+int hot_restart_take_listener(void);
+
+/**
+ * Listens on HOT_RESTART_PATH for a successor (old process side).
+ *
+ * The hand-off runs on the event loop, so sessions are not paused while the
+ * successor acknowledges; without an acknowledgement within 5 s it is
+ * abandoned and this process keeps accepting. After the hand-off this
+ * process stops accepting and event_loop_run() returns once the remaining
+ * sessions have drained.
+ */
+void hot_restart_listen(event_loop_t *loop);
+
+#endif // HOT_RESTART_H
@@ -3,5 +3,7 @@
 #include <core/connection.h>
 
 void transport_tcp_init(event_loop_t *loop);
+// 返回 TCP listener 连接，未初始化时为 NULL
+connection_t *transport_tcp_listener(void);
 
 #endif // TCP_LISTENER_H
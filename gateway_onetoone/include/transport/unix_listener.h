@@ -1,6 +1,6 @@
 #ifndef UNIX_LISTENER_H
 #define UNIX_LISTENER_H
 
-int create_unix_client();
+int create_unix_client(const char *path);
 
 #endif // UNIX_LISTENER_H
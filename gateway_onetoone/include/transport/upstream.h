@@ -0,0 +1,34 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <core/connection.h>
+
+/*
+ * Backend selection for new MCU sessions.
+ *
+ * GATEWAY_UPSTREAMS lists the backend unix sockets ("/tmp/gw1.sock,
+ * /tmp/gw2.sock"; default /tmp/gateway.sock). GATEWAY_UPSTREAM_POLICY picks
+ * one per session:
+ *
+ *   least_bytes  fewest bytes queued towards the backend (default)
+ *   least_conns  fewest open sessions
+ *   hash         rendezvous hash of the MCU's IP address, so a device keeps
+ *                its backend across reconnects and only the sessions of a
+ *                removed backend move
+ *
+ * A backend whose connect() fails (refused, missing, or accept backlog full)
+ * is ejected for GATEWAY_UPSTREAM_EJECT_MS (default 5000) and the next choice
+ * is tried. The connect never blocks the event loop.
+ */
+
+void upstream_init(void);
+
+/**
+ * Connects a new session of the MCU on mcu_fd to a backend.
+ *
+ * @return Backend connection (not yet registered with the loop), or NULL if
+ *         no backend accepted the connection.
+ */
+connection_t *upstream_open(event_loop_t *loop, int mcu_fd);
+
+#endif // UPSTREAM_H
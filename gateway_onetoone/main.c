@@ -1,6 +1,8 @@
 // Enabling GNU extensions for additional socket and file control functions
 #define _GNU_SOURCE
+#include <core/config.h>
 #include <core/event_loop.h>
+#include <transport/hot_restart.h>
 #include <transport/tcp_listener.h>
 
 // Entry point of the program that sets up the event loop
@@ -11,13 +13,24 @@
  * the TCP listener and UNIX domain client connections. Creates the
  * event loop and handles incoming connections and data in real time.
  *
+ * With GATEWAY_HOT_RESTART=1 the listener is taken over from the running
+ * gateway, which then stops accepting and exits once its sessions drain.
+ *
  * @return Always returns 0.
  */
 int main() {
   event_loop_t *ev_loop = event_loop_create();
 
+  if (config_get_int("GATEWAY_HOT_RESTART", 0)) {
+    hot_restart_inherit();
+  }
+
   /* ========== 1. 创建 TCP listener connection ========== */
   transport_tcp_init(ev_loop);
 
+  hot_restart_listen(ev_loop);
+
+  event_loop_run(ev_loop);
+
   return 0; // Exit the program successfully
 }
@@ -1,17 +1,25 @@
 #include <core/connection.h>
 #include <core/event_loop.h>
+#include <core/zerocopy.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+static int conn_count = 0;
+
+int connection_count(void) {
+  return __atomic_load_n(&conn_count, __ATOMIC_RELAXED);
+}
+
 connection_t *connection_create(event_loop_t *loop, int fd) {
   connection_t *conn = calloc(1, sizeof(connection_t));
   conn->fd = fd;
   conn->loop = loop;
   conn->events = EPOLLIN; // 默认监听可读事件
 
+  conn->inbuf = malloc(CONN_INBUF_SIZE);
   conn->out_cap = 4096;                 // 初始输出缓冲区容量
   conn->outbuf = malloc(conn->out_cap); // 输出缓冲区，动态分配
 
@@ -19,6 +27,7 @@ connection_t *connection_create(event_loop_t *loop, int fd) {
   conn->low_watermark = 4096;  // 可选：设置低水位线，单位为字节
 
   conn->state = CONN_STATE_OPEN; // 初始状态为打开
+  __atomic_fetch_add(&conn_count, 1, __ATOMIC_RELAXED);
 
   return conn;
 }
@@ -26,6 +35,12 @@ connection_t *connection_create(event_loop_t *loop, int fd) {
 void connection_destroy(connection_t *conn) {
   if (!conn)
     return;
+  connection_out_sent(conn, connection_out_pending(conn)); // 未发出的部分随连接丢弃
+  if (conn->on_close)
+    conn->on_close(conn);
+  __atomic_fetch_sub(&conn_count, 1, __ATOMIC_RELAXED);
+  zerocopy_release(conn);
+  free(conn->inbuf);
   free(conn->outbuf);
   free(conn);
 }
@@ -92,16 +107,18 @@ void connection_append_out(connection_t *conn, const char *data, int len) {
     conn->outbuf = new_buf;
     conn->out_cap = new_cap;
   }
-  int was_empty = (conn->out_len == 0);
+  int was_empty = (connection_out_pending(conn) == 0);
   // 将数据追加到输出缓冲区
   memcpy(conn->outbuf + conn->out_len, data, len);
   conn->out_len += len;
+  if (conn->out_counter)
+    *conn->out_counter += len;
   // 启用写事件以便发送数据
   if (was_empty) {
     connection_enable_write(conn);
   }
 
-  if (conn->out_len >= conn->high_watermark) {
+  if (connection_out_pending(conn) >= conn->high_watermark) {
     printf("Unix buffer reached high watermark, pausing reads from peer\n");
     // 可选：实现流控逻辑，例如暂停读取更多数据
     if (conn->peer) {
@@ -1,50 +1,266 @@
+#include <core/clock.h>
 #include <core/event_loop.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 
+#define SLOTS_INITIAL 64
+
+/*
+ * Dispatch record of one registered fd, indexed by fd. Only what the loop
+ * needs to route an event lives here, two records per cache line. The epoll
+ * data carries (gen << 32 | fd); gen changes whenever the fd is removed, so
+ * an event queued for a connection that an earlier callback of the same batch
+ * closed (e.g. the peer of a failed session) is dropped instead of touching
+ * freed memory.
+ */
+typedef struct event_slot {
+  uint32_t gen;
+  uint32_t events;
+  connection_t *conn; // NULL 表示未注册
+  void (*on_read)(connection_t *);
+  void (*on_write)(connection_t *);
+} event_slot_t;
+
 struct event_loop {
   int epfd;
+  int nfds; // 已注册的 fd 数量，降为 0 时事件循环退出（热重启排空）
+  event_timer_t **timers; // 按到期时间排列的最小堆
+  int n_timers;
+  int cap_timers;
+  event_slot_t *slots; // 按 fd 索引
+  int n_slots;
   struct epoll_event events[64];
 };
 
+struct event_timer {
+  uint64_t deadline; // 单调时间，纳秒
+  event_timer_cb_t cb;
+  void *arg;
+  int index; // 在堆中的位置
+};
+
 event_loop_t *event_loop_create() {
   event_loop_t *loop = calloc(1, sizeof(event_loop_t));
   loop->epfd = epoll_create1(0);
   return loop;
 }
 
+/* ========== fd 索引的分发表 ========== */
+
+static event_slot_t *slot_get(event_loop_t *loop, int fd) {
+  if (fd < loop->n_slots)
+    return &loop->slots[fd];
+
+  int n = loop->n_slots ? loop->n_slots : SLOTS_INITIAL;
+  while (n <= fd)
+    n *= 2;
+  // aligned_alloc 没有对应的 realloc，手动搬迁
+  event_slot_t *slots = aligned_alloc(64, sizeof(event_slot_t) * n);
+  if (!slots)
+    return NULL;
+  if (loop->n_slots)
+    memcpy(slots, loop->slots, sizeof(event_slot_t) * loop->n_slots);
+  memset(slots + loop->n_slots, 0,
+         sizeof(event_slot_t) * (n - loop->n_slots));
+  free(loop->slots);
+  loop->slots = slots;
+  loop->n_slots = n;
+  return &slots[fd];
+}
+
+static void slot_fill(event_slot_t *slot, uint32_t events, connection_t *conn) {
+  slot->events = events;
+  slot->conn = conn;
+  slot->on_read = conn->on_read;
+  slot->on_write = conn->on_write;
+}
+
+static uint64_t slot_handle(int fd, const event_slot_t *slot) {
+  return (uint64_t)slot->gen << 32 | (uint32_t)fd;
+}
+
 void event_loop_add(event_loop_t *loop, int fd, uint32_t events, void *ptr) {
+  event_slot_t *slot = slot_get(loop, fd);
+  if (!slot)
+    return;
+  slot->gen++; // 同一 fd 号复用时，旧事件不会被分发给新连接
+  slot_fill(slot, events, ptr);
+
   struct epoll_event ev = {0};
   ev.events = events;
-  ev.data.ptr = ptr;
-  epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+  ev.data.u64 = slot_handle(fd, slot);
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+    loop->nfds++;
+  } else {
+    slot->conn = NULL;
+  }
 }
 
 void event_loop_mod(event_loop_t *loop, int fd, uint32_t events, void *ptr) {
+  if (fd < 0 || fd >= loop->n_slots || !loop->slots[fd].conn)
+    return;
+  event_slot_t *slot = &loop->slots[fd];
+  slot_fill(slot, events, ptr);
+
   struct epoll_event ev = {0};
   ev.events = events;
-  ev.data.ptr = ptr;
+  ev.data.u64 = slot_handle(fd, slot);
   epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+/* ========== 定时器（最小堆） ========== */
+
+static void timer_swap(event_loop_t *loop, int i, int j) {
+  event_timer_t *t = loop->timers[i];
+  loop->timers[i] = loop->timers[j];
+  loop->timers[j] = t;
+  loop->timers[i]->index = i;
+  loop->timers[j]->index = j;
+}
+
+static void timer_up(event_loop_t *loop, int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (loop->timers[parent]->deadline <= loop->timers[i]->deadline)
+      break;
+    timer_swap(loop, i, parent);
+    i = parent;
+  }
+}
+
+static void timer_down(event_loop_t *loop, int i) {
+  while (1) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < loop->n_timers &&
+        loop->timers[l]->deadline < loop->timers[min]->deadline)
+      min = l;
+    if (r < loop->n_timers &&
+        loop->timers[r]->deadline < loop->timers[min]->deadline)
+      min = r;
+    if (min == i)
+      return;
+    timer_swap(loop, i, min);
+    i = min;
+  }
+}
+
+static void timer_remove(event_loop_t *loop, int i) {
+  int last = --loop->n_timers;
+  if (i != last) {
+    timer_swap(loop, i, last);
+    timer_down(loop, i);
+    timer_up(loop, i);
+  }
+}
+
+event_timer_t *event_loop_add_timer(event_loop_t *loop, uint64_t delay_ms,
+                                    event_timer_cb_t cb, void *arg) {
+  if (loop->n_timers == loop->cap_timers) {
+    int cap = loop->cap_timers ? loop->cap_timers * 2 : 16;
+    event_timer_t **timers = realloc(loop->timers, sizeof(*timers) * cap);
+    if (!timers)
+      return NULL;
+    loop->timers = timers;
+    loop->cap_timers = cap;
+  }
+
+  event_timer_t *t = malloc(sizeof(event_timer_t));
+  t->deadline = clock_now_ns() + delay_ms * 1000000ull;
+  t->cb = cb;
+  t->arg = arg;
+  t->index = loop->n_timers++;
+  loop->timers[t->index] = t;
+  timer_up(loop, t->index);
+  return t;
+}
+
+void event_loop_cancel_timer(event_loop_t *loop, event_timer_t *timer) {
+  if (!timer)
+    return;
+  timer_remove(loop, timer->index);
+  free(timer);
+}
+
+// epoll_wait 的超时：最近一个定时器到期前的毫秒数，没有定时器时为 -1
+static int timer_timeout_ms(event_loop_t *loop) {
+  if (loop->n_timers == 0)
+    return -1;
+  uint64_t now = clock_now_ns();
+  uint64_t deadline = loop->timers[0]->deadline;
+  if (deadline <= now)
+    return 0;
+  return (int)((deadline - now + 999999) / 1000000);
+}
+
+static void run_timers(event_loop_t *loop) {
+  if (loop->n_timers == 0)
+    return;
+  uint64_t now = clock_now_ns();
+  while (loop->n_timers > 0 && loop->timers[0]->deadline <= now) {
+    event_timer_t *t = loop->timers[0];
+    timer_remove(loop, 0);
+    t->cb(t->arg); // 回调中可以再添加定时器
+    free(t);
+  }
+}
+
 void event_loop_del(event_loop_t *loop, int fd) {
-  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if (fd >= 0 && fd < loop->n_slots && loop->slots[fd].conn) {
+    loop->slots[fd].gen++; // 本批次中尚未分发的事件随之失效
+    loop->slots[fd].conn = NULL;
+  }
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL) == 0)
+    loop->nfds--;
+}
+
+/**
+ * Returns the live dispatch record behind an epoll handle, or NULL if the
+ * connection was closed (or its fd reused) since the event was queued.
+ */
+static event_slot_t *slot_lookup(event_loop_t *loop, uint64_t handle) {
+  int fd = (int)(uint32_t)handle;
+  if (fd >= loop->n_slots)
+    return NULL;
+  event_slot_t *slot = &loop->slots[fd];
+  if (slot->gen != (uint32_t)(handle >> 32) || !slot->conn)
+    return NULL;
+  return slot;
 }
 
+/**
+ * Runs the event loop until no file descriptor is registered any more.
+ *
+ * In normal operation the listeners keep the loop alive forever. After a hot
+ * restart hand-off the old process removes its listeners, so the loop returns
+ * once the remaining connections have drained.
+ *
+ * A callback may close any connection, including ones with events later in
+ * the same batch; those events are skipped.
+ *
+ * @param loop - Event loop to run.
+ */
 void event_loop_run(event_loop_t *loop) {
-  while (1) {
-    int n = epoll_wait(loop->epfd, loop->events, 64, -1);
+  while (loop->nfds > 0) {
+    int n = epoll_wait(loop->epfd, loop->events, 64, timer_timeout_ms(loop));
     for (int i = 0; i < n; i++) {
-      connection_t *conn = loop->events[i].data.ptr;
+      uint64_t handle = loop->events[i].data.u64;
       uint32_t events = loop->events[i].events;
+      event_slot_t *slot = slot_lookup(loop, handle);
 
-      if (events & EPOLLIN) {
-        conn->on_read(conn);
+      if (slot && (events & EPOLLERR) && slot->conn->on_error) {
+        slot->conn->on_error(slot->conn); // 少见路径，不放进分发表
+        slot = slot_lookup(loop, handle); // on_error 可能关闭了连接
+      }
+      if (slot && (events & EPOLLIN)) {
+        slot->on_read(slot->conn);
+        slot = slot_lookup(loop, handle); // 回调可能关闭了连接或扩容了分发表
       }
-      if (events & EPOLLOUT) {
-        conn->on_write(conn);
+      if (slot && (events & EPOLLOUT)) {
+        slot->on_write(slot->conn);
       }
     }
+    run_timers(loop);
   }
 }
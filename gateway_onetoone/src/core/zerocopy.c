@@ -0,0 +1,173 @@
+#include <core/config.h>
+#include <core/event_loop.h>
+#include <core/zerocopy.h>
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define ZEROCOPY_MIN_DEFAULT 16384
+
+// 从 outbuf 摘下来交给内核的一块缓冲区
+struct zc_seg {
+  char *data;
+  int len;
+  int off;           // 已交给内核的字节数
+  int pinned;        // 至少有一次以 MSG_ZEROCOPY 发送
+  uint32_t last_seq; // 最后一次零拷贝发送的序号
+  struct zc_seg *next;
+};
+
+static int threshold = -1;
+
+int zerocopy_threshold(void) {
+  if (threshold < 0) {
+    threshold = config_get_int("GATEWAY_ZEROCOPY_MIN", ZEROCOPY_MIN_DEFAULT);
+    if (threshold < 0)
+      threshold = 0;
+  }
+  return threshold;
+}
+
+void zerocopy_enable(connection_t *conn) {
+  int min = zerocopy_threshold();
+  if (min == 0)
+    return;
+  int one = 1;
+  if (setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    return; // 内核不支持时保持普通 write
+  conn->zerocopy = 1;
+  conn->on_error = zerocopy_reap;
+  // 高水位至少能攒够几次零拷贝发送，否则读端早早暂停，outbuf 永远达不到门限
+  if (conn->high_watermark < 4 * min) {
+    conn->high_watermark = 4 * min;
+    conn->low_watermark = 2 * min;
+  }
+}
+
+// 把整个 outbuf 摘下来挂到等待队列尾部，连接换一块新的 outbuf
+static void detach_outbuf(connection_t *conn) {
+  zc_seg_t *seg = calloc(1, sizeof(zc_seg_t));
+  seg->data = conn->outbuf;
+  seg->len = conn->out_len;
+  if (conn->zc_tail)
+    conn->zc_tail->next = seg;
+  else
+    conn->zc_head = seg;
+  conn->zc_tail = seg;
+  conn->zc_unsent = seg->len;
+
+  conn->out_cap = 4096;
+  conn->outbuf = malloc(conn->out_cap);
+  conn->out_len = 0;
+}
+
+// 已全部发出且内核不再引用的缓冲区可以释放
+static int seg_done(const connection_t *conn, const zc_seg_t *seg) {
+  if (seg->off < seg->len)
+    return 0;
+  return !seg->pinned || (int32_t)(conn->zc_done - seg->last_seq) > 0;
+}
+
+static void free_done(connection_t *conn) {
+  while (conn->zc_head && seg_done(conn, conn->zc_head)) {
+    zc_seg_t *seg = conn->zc_head;
+    conn->zc_head = seg->next;
+    if (!conn->zc_head)
+      conn->zc_tail = NULL;
+    free(seg->data);
+    free(seg);
+  }
+}
+
+int zerocopy_write(connection_t *conn) {
+  if (conn->zc_unsent == 0)
+    detach_outbuf(conn);
+
+  zc_seg_t *seg = conn->zc_tail;
+  int flags = conn->zerocopy ? MSG_ZEROCOPY : 0;
+  int n = send(conn->fd, seg->data + seg->off, seg->len - seg->off,
+               flags | MSG_NOSIGNAL);
+  if (n < 0 && errno == ENOBUFS && flags) {
+    // optmem 用尽，无法再固定页面，这一次退回普通拷贝
+    flags = 0;
+    n = send(conn->fd, seg->data + seg->off, seg->len - seg->off, MSG_NOSIGNAL);
+  }
+  if (n <= 0)
+    return n;
+
+  if (flags) {
+    seg->pinned = 1;
+    seg->last_seq = conn->zc_next++;
+  }
+  seg->off += n;
+  conn->zc_unsent -= n;
+  free_done(conn);
+  return n;
+}
+
+void zerocopy_reap(connection_t *conn) {
+  static int warned = 0; // 回环等场景下每条连接都会回退，只提示一次
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+  while (1) {
+    struct msghdr msg = {0};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+        continue;
+      struct sock_extended_err serr;
+      memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+      if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // [ee_info, ee_data] 范围内的发送已完成，TCP 上按序到达
+      conn->zc_done = serr.ee_data + 1;
+      if ((serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && conn->zerocopy) {
+        // 内核最终还是拷贝了（例如回环或网卡不支持 SG），不如直接 write
+        if (!warned) {
+          printf("zerocopy fell back to copy, disabling it per connection\n");
+          warned = 1;
+        }
+        conn->zerocopy = 0;
+      }
+    }
+  }
+  free_done(conn);
+}
+
+int zerocopy_linger(connection_t *conn) {
+  if (!conn->zc_head)
+    return 0;
+  if (conn->events != EPOLLET) {
+    conn->events = EPOLLET; // EPOLLERR/EPOLLHUP 总会上报，无需显式订阅
+    event_loop_mod(conn->loop, conn->fd, conn->events, conn);
+  }
+  return 1;
+}
+
+void zerocopy_release(connection_t *conn) {
+  while (conn->zc_head) {
+    zc_seg_t *seg = conn->zc_head;
+    conn->zc_head = seg->next;
+    free(seg->data);
+    free(seg);
+  }
+  conn->zc_tail = NULL;
+  conn->zc_unsent = 0;
+}
@@ -1,13 +1,50 @@
+#include <core/zerocopy.h>
 #include <errno.h>
 #include <protocol/mcu_protocol.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+// 零拷贝页面在完成通知到达前仍被内核读取：保留 fd，由 handle_error 回收后关闭
+static void close_when_reaped(connection_t *conn) {
+  conn->peer = NULL;
+  if (zerocopy_linger(conn))
+    return;
+  connection_close(conn);
+}
+
+/**
+ * Releases a session once both directions have been shut down.
+ *
+ * Without this a finished session stays registered in epoll forever, and a
+ * draining process (hot restart) would never exit.
+ */
+static void maybe_close_pair(connection_t *conn) {
+  connection_t *peer = conn->peer;
+  if (!peer || !conn->read_closed || !conn->write_closed ||
+      !peer->read_closed || !peer->write_closed)
+    return;
+  close_when_reaped(conn);
+  close_when_reaped(peer);
+}
+
+/**
+ * Handles EPOLLERR on a zerocopy connection: reaps completion notifications
+ * and finishes a close that was waiting for them.
+ *
+ * @param conn - Connection with zerocopy enabled (see core/zerocopy.h).
+ */
+void handle_error(connection_t *conn) {
+  zerocopy_reap(conn);
+  // 会话结束后 peer 已被清空，只剩等待完成通知的这一端
+  if (!conn->peer && !conn->zc_head)
+    connection_close(conn);
+}
+
 void handle_read(connection_t *conn) {
   while (1) {
 
-    int n = read(conn->fd, conn->inbuf, sizeof(conn->inbuf));
+    int n = read(conn->fd, conn->inbuf, CONN_INBUF_SIZE);
 
     if (n > 0) {
 
@@ -17,9 +54,11 @@ void handle_read(connection_t *conn) {
     } else if (n == 0) {
       printf("Connection fd=%d closed by peer\n", conn->fd);
       conn->state = CONN_STATE_READ_EOF;
+      conn->read_closed = 1;
       connection_disable_read(conn);
-      if (conn->peer && conn->peer->out_len == 0) {
+      if (conn->peer && connection_out_pending(conn->peer) == 0) {
         connection_shutdown_write(conn->peer);
+        maybe_close_pair(conn);
       }
       return;
     } else {
@@ -50,21 +89,29 @@ void handle_read(connection_t *conn) {
  * This function is triggered when the socket is ready for writing.
  * It writes as much data as possible from the internal buffer to the
  * UNIX socket. If the buffer becomes empty, epoll write monitoring is
- * disabled to optimize performance.
+ * disabled to optimize performance. Large buffers on zerocopy-enabled
+ * connections are sent with MSG_ZEROCOPY (see core/zerocopy.h).
  *
  * @param conn - Connection object associated with the UNIX socket.
  */
 void handle_write(connection_t *conn) {
-  while (conn->out_len > 0) {
+  while (connection_out_pending(conn) > 0) {
 
-    int n = write(conn->fd, conn->outbuf, conn->out_len);
+    int n;
+    if (conn->zc_unsent > 0 ||
+        (conn->zerocopy && conn->out_len >= zerocopy_threshold())) {
+      n = zerocopy_write(conn); // 缓冲区由 zerocopy 模块接管，无需 memmove
+    } else {
+      n = write(conn->fd, conn->outbuf, conn->out_len);
+      if (n > 0) {
+        memmove(conn->outbuf, conn->outbuf + n, conn->out_len - n);
+        conn->out_len -= n;
+      }
+    }
 
     if (n > 0) {
-
-      memmove(conn->outbuf, conn->outbuf + n, conn->out_len - n);
-
-      conn->out_len -= n;
-
+      connection_out_sent(conn, n);
+      continue;
     } else if (errno == EAGAIN) {
       printf("Unix socket not ready for writing, will retry later\n%s\n",
              strerror(errno));
@@ -87,7 +134,14 @@ void handle_write(connection_t *conn) {
   }*/
   connection_disable_write(conn);
 
-  if (conn->out_len <= conn->low_watermark) {
+  // 对端已读到 EOF，缓冲区发完后再关闭写端
+  if (conn->peer && conn->peer->read_closed) {
+    connection_shutdown_write(conn);
+    maybe_close_pair(conn);
+    return;
+  }
+
+  if (connection_out_pending(conn) <= conn->low_watermark) {
     if (conn->peer) {
       printf("Unix buffer below low watermark, resuming reads from peer "
              "connection fd=%d\n",
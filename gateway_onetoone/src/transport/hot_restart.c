@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <transport/hot_restart.h>
+#include <transport/tcp_listener.h>
+
+// 交接等待对端的最长时间：新进程阻塞收发的超时，旧进程等待确认的定时器
+#define HOT_RESTART_TIMEOUT_SEC 5
+
+static int inherited_listener = -1;
+static connection_t *restart_listener = NULL;
+static connection_t *handoff = NULL; // 已发出 listener、等待新进程确认的连接
+static event_timer_t *handoff_timer = NULL;
+
+/**
+ * Sends one hand-off record, attaching fd (if >= 0) to it.
+ *
+ * @return 0 on success, -1 if the successor went away.
+ */
+static int hr_send(int sock, uint32_t type, int fd) {
+  hr_msg_hdr_t hdr = {type};
+  struct iovec iov = {&hdr, sizeof(hdr)};
+  char cbuf[CMSG_SPACE(sizeof(int))] = {0};
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd >= 0) {
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  return sendmsg(sock, &msg, 0) == sizeof(hdr) ? 0 : -1;
+}
+
+/**
+ * Receives one hand-off record.
+ *
+ * @return 0 on success, -1 on a protocol or I/O error.
+ */
+static int hr_recv(int sock, uint32_t *type, int *fd) {
+  hr_msg_hdr_t hdr;
+  struct iovec iov = {&hdr, sizeof(hdr)};
+  char cbuf[CMSG_SPACE(sizeof(int))];
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(hdr))
+    return -1;
+
+  *type = hdr.type;
+  *fd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+  return 0;
+}
+
+int hot_restart_inherit(void) {
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, HOT_RESTART_PATH);
+
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return 0; // 没有正在运行的旧进程，正常冷启动
+  }
+
+  struct timeval tv = {HOT_RESTART_TIMEOUT_SEC, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  while (1) {
+    uint32_t type;
+    int fd;
+    if (hr_recv(sock, &type, &fd) < 0) {
+      // 旧进程仍持有端口，无法再冷启动
+      fprintf(stderr, "hot restart: hand-off interrupted\n");
+      exit(EXIT_FAILURE);
+    }
+    if (type == HR_MSG_END)
+      break;
+    if (type == HR_MSG_TCP_LISTENER)
+      inherited_listener = fd;
+    else if (fd >= 0)
+      close(fd);
+  }
+
+  char ack = 1;
+  if (write(sock, &ack, 1) != 1) {
+    fprintf(stderr, "hot restart: failed to acknowledge hand-off\n");
+    exit(EXIT_FAILURE);
+  }
+  close(sock);
+
+  printf("hot restart: inherited listener\n");
+  return 1;
+}
+
+int hot_restart_take_listener(void) {
+  int fd = inherited_listener;
+  inherited_listener = -1;
+  return fd;
+}
+
+/**
+ * Ends a pending hand-off. On success this process stops accepting and keeps
+ * serving its sessions until they close; otherwise it carries on as before
+ * and waits for the next successor.
+ */
+static void handoff_finish(int ok) {
+  event_loop_del(handoff->loop, handoff->fd);
+  close(handoff->fd);
+  free(handoff);
+  handoff = NULL;
+
+  if (!ok) {
+    // 新进程未确认，继续由本进程服务
+    printf("hot restart: hand-off aborted\n");
+    connection_enable_read(restart_listener);
+    return;
+  }
+
+  // 不再 accept，已有会话继续服务直到关闭，之后事件循环自然退出
+  connection_t *tcp = transport_tcp_listener();
+  if (tcp) {
+    event_loop_del(tcp->loop, tcp->fd);
+    close(tcp->fd);
+    tcp->fd = -1;
+  }
+  event_loop_del(restart_listener->loop, restart_listener->fd);
+  close(restart_listener->fd);
+  free(restart_listener);
+  restart_listener = NULL;
+
+  printf("hot restart: hand-off complete, draining sessions\n");
+}
+
+static void handoff_timeout(void *arg) {
+  handoff_timer = NULL;
+  handoff_finish(0);
+}
+
+static void handle_handoff_ack(connection_t *conn) {
+  char ack = 0;
+  ssize_t n = read(conn->fd, &ack, 1);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  event_loop_cancel_timer(conn->loop, handoff_timer);
+  handoff_timer = NULL;
+  handoff_finish(n == 1 && ack == 1);
+}
+
+/**
+ * Starts a hand-off to a successor without blocking the event loop: the
+ * records are sent right away and the acknowledgement is awaited like any
+ * other event, so sessions keep being served meanwhile.
+ */
+static void handle_restart_accept(connection_t *listener) {
+  int sock = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (sock < 0)
+    return;
+
+  printf("hot restart: handing listener to new process\n");
+
+  // 两条记录远小于 socket 缓冲区，非阻塞发送失败只可能是新进程已退出
+  connection_t *tcp = transport_tcp_listener();
+  if ((tcp && hr_send(sock, HR_MSG_TCP_LISTENER, tcp->fd) < 0) ||
+      hr_send(sock, HR_MSG_END, -1) < 0) {
+    printf("hot restart: hand-off aborted\n");
+    close(sock);
+    return;
+  }
+
+  handoff = calloc(1, sizeof(connection_t));
+  handoff->fd = sock;
+  handoff->loop = listener->loop;
+  handoff->on_read = handle_handoff_ack;
+  handoff->events = EPOLLIN;
+  event_loop_add(handoff->loop, sock, handoff->events, handoff);
+  handoff_timer = event_loop_add_timer(
+      handoff->loop, HOT_RESTART_TIMEOUT_SEC * 1000, handoff_timeout, NULL);
+  connection_disable_read(listener); // 同一时间只进行一次交接
+}
+
+void hot_restart_listen(event_loop_t *loop) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, HOT_RESTART_PATH);
+
+  unlink(HOT_RESTART_PATH);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("hot restart bind failed"); // 热重启不可用，但不影响正常服务
+    close(fd);
+    return;
+  }
+  listen(fd, 1);
+  set_nonblocking(fd);
+
+  restart_listener = calloc(1, sizeof(connection_t));
+  restart_listener->fd = fd;
+  restart_listener->loop = loop;
+  restart_listener->on_read = handle_restart_accept;
+  restart_listener->events = EPOLLIN;
+  event_loop_add(loop, fd, restart_listener->events, restart_listener);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 // Defines error codes for detecting and handling error conditions
 #include <errno.h>
@@ -11,18 +12,47 @@
 #include <string.h>
 // Epoll library for scalable I/O event notification
 #include <sys/epoll.h>
+// getrlimit(RLIMIT_NOFILE) for the default connection cap
+#include <sys/resource.h>
 // Socket programming functions (e.g., socket, bind, listen, connect)
 #include <sys/socket.h>
 // Definitions for UNIX domain sockets
 #include <sys/un.h>
 // POSIX API for system calls (e.g., close, read, write)
 #include "util.h" // Include the header file for utility functions (e.g., set_nonblocking)
+#include <core/clock.h>
+#include <core/config.h>
 #include <core/event_loop.h> // Include the header file for the event loop implementation
+#include <core/zerocopy.h>
 #include <protocol/mcu_protocol.h> // Include the header file for MCU protocol handling (e.g., handle_read, handle_write)
+#include <transport/hot_restart.h>
+#include <transport/tcp_listener.h>
+#include <transport/unix_listener.h>
+#include <transport/upstream.h>
 #include <unistd.h>
 
 #define TCP_PORT 9000
-#define UNIX_SOCKET_PATH "/tmp/gateway.sock"
+
+#define TCP_BACKLOG_DEFAULT 1024
+#define ACCEPT_BUDGET_DEFAULT 64 // 每次唤醒最多 accept 的连接数
+#define ACCEPT_RETRY_MS 100      // 达到上限后重新检查的间隔
+#define FD_RESERVE 32            // 为 listener、日志等保留的 fd
+
+/*
+ * Admission control for the MCU listener. When a limit is hit the listener
+ * stops polling for EPOLLIN and a timer re-enables it, so pending clients
+ * wait in the kernel backlog instead of competing with established
+ * connections for the event loop.
+ */
+static struct {
+  int budget;       // GATEWAY_ACCEPT_BUDGET
+  long max_conns;   // GATEWAY_MAX_CONNS，最大MCU 会话（TCP + UNIX 两个连接）数
+  long rate;        // GATEWAY_ACCEPT_RATE，每秒新建连接数，0 表示不限
+  long burst;       // GATEWAY_ACCEPT_BURST，令牌桶容量
+  double tokens;
+  uint64_t last_ns;
+  int overloaded;   // 已打印过暂停日志，成功 accept 后清除
+} admission;
 
 /**
  * Creates and sets up a non-blocking TCP server socket.
@@ -57,45 +87,102 @@ int create_tcp_server() {
     close(fd);             // Close the socket file descriptor on failure
     exit(EXIT_FAILURE);    // Exit the program with failure status
   } // Bind the socket to the specified address and port
-  listen(fd,
-         128); // Start listening for incoming connections with a backlog of 128
+  // 断电重连时大量 MCU 同时建连，backlog 过小会导致 SYN 被丢弃后重传
+  listen(fd, config_get_int("GATEWAY_TCP_BACKLOG", TCP_BACKLOG_DEFAULT));
 
   set_nonblocking(fd);
   return fd;
 }
 
-/**
- * Creates and connects to a UNIX domain socket.
- * This function initializes the socket, sets its address, and connects to the
- * specified UNIX domain server. If the process fails (e.g., address
- * unavailable, permission issues), it logs an error and terminates.
- */
 /**
  * Creates and connects to a non-blocking UNIX domain socket.
  *
  * This function sets up a socket to allow communication over the UNIX-domain.
- * It attempts to connect to a server specified by a file path.
+ * It attempts to connect to a server specified by a file path. The socket is
+ * non-blocking before connect(), so a backend whose accept backlog is full
+ * fails with EAGAIN instead of stalling the event loop; like ECONNREFUSED or
+ * a missing socket file this counts as a failed connect.
  *
- * @return The file descriptor of the UNIX domain socket upon success.
+ * @param path - Socket path of the backend.
+ * @return The file descriptor of the UNIX domain socket, or -1 if the
+ *         backend cannot be reached.
  */
-int create_unix_client() {
-  int fd = socket(AF_UNIX, SOCK_STREAM, 0); // Create a UNIX domain socket
+int create_unix_client(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
   struct sockaddr_un addr = {0}; // Initialize the socket address structure
   addr.sun_family = AF_UNIX;     // Address family set to UNIX domain sockets
-  strcpy(addr.sun_path,
-         UNIX_SOCKET_PATH); // Copy the socket path to the address structure
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
 
+  // UNIX 域 connect 要么立即完成，要么失败，不会返回 EINPROGRESS
   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
     perror("connect to unix socket failed"); // Print error message if
                                              // connection fails
-    close(fd);          // Close the socket file descriptor on failure
-    exit(EXIT_FAILURE); // Exit the program with failure status
+    close(fd); // 由调用方摘除该后端并改选其他后端
+    return -1;
   } // Attempt to connect to the specified UNIX socket
-  set_nonblocking(fd);
   return fd;
 }
 
+static void admission_init(void) {
+  struct rlimit rl;
+  long fd_limit = 65536;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    fd_limit = (long)rl.rlim_cur;
+
+  admission.budget =
+      config_get_int("GATEWAY_ACCEPT_BUDGET", ACCEPT_BUDGET_DEFAULT);
+  if (admission.budget <= 0)
+    admission.budget = ACCEPT_BUDGET_DEFAULT;
+  admission.max_conns = config_get_int("GATEWAY_MAX_CONNS", (fd_limit - FD_RESERVE) / 2);
+  admission.rate = config_get_int("GATEWAY_ACCEPT_RATE", 0);
+  admission.burst = config_get_int("GATEWAY_ACCEPT_BURST",
+                                   admission.rate > 0 ? admission.rate : 1);
+  if (admission.burst < 1)
+    admission.burst = 1;
+  admission.tokens = admission.burst;
+  admission.last_ns = clock_now_ns();
+}
+
+static void resume_accept(void *arg) {
+  connection_t *listener = arg;
+  if (listener->fd < 0)
+    return; // listener 已通过热重启交给新进程
+  connection_enable_read(listener);
+}
+
+static void pause_accept(connection_t *listener, uint64_t delay_ms,
+                         const char *reason) {
+  if (!admission.overloaded) {
+    printf("accept paused: %s (%d connections)\n", reason, connection_count());
+    admission.overloaded = 1;
+  }
+  connection_disable_read(listener);
+  event_loop_add_timer(listener->loop, delay_ms, resume_accept, listener);
+}
+
+/**
+ * Takes one token from the accept rate limiter.
+ *
+ * @param wait_ms - Set to the time until the next token when none is left.
+ * @return 1 if a connection may be accepted now, 0 otherwise.
+ */
+static int take_token(uint64_t *wait_ms) {
+  if (admission.rate <= 0)
+    return 1;
+  uint64_t now = clock_now_ns();
+  admission.tokens += (double)(now - admission.last_ns) * admission.rate / 1e9;
+  admission.last_ns = now;
+  if (admission.tokens > admission.burst)
+    admission.tokens = admission.burst;
+  if (admission.tokens >= 1) {
+    admission.tokens -= 1;
+    return 1;
+  }
+  *wait_ms = (uint64_t)((1 - admission.tokens) * 1000 / admission.rate) + 1;
+  return 0;
+}
+
 /**
  * Accepts new incoming connections to the listener.
  *
@@ -106,26 +193,52 @@ int create_unix_client() {
  * @param listener - Listener object.
  */
 void handle_accept(connection_t *listener) {
-  printf("accept triggered\n");
-  while (1) {
-    int client_fd = accept(listener->fd, NULL, NULL);
+  // 预算用完时剩余连接留在 backlog，水平触发的 epoll 下一轮会再次通知
+  for (int n = 0; n < admission.budget; n++) {
+    if (connection_count() / 2 >= admission.max_conns) {
+      pause_accept(listener, ACCEPT_RETRY_MS, "connection limit reached");
+      return;
+    }
+    uint64_t wait_ms = 0;
+    if (!take_token(&wait_ms)) {
+      pause_accept(listener, wait_ms, "accept rate limit");
+      return;
+    }
+
+    int client_fd =
+        accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_fd < 0) {
+      if (admission.rate > 0)
+        admission.tokens += 1; // 没有取到连接，退还令牌
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
       if (errno == EAGAIN || errno == EWOULDBLOCK)
         break;
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        pause_accept(listener, ACCEPT_RETRY_MS, strerror(errno));
+        return;
+      }
       perror("accept");
       break;
     }
-    set_nonblocking(client_fd);
+    admission.overloaded = 0;
+
+    connection_t *unix_conn = upstream_open(listener->loop, client_fd);
+    if (!unix_conn) {
+      printf("no backend available, dropping MCU fd=%d\n", client_fd);
+      close(client_fd);
+      continue;
+    }
 
     connection_t *tcp_conn = connection_create(listener->loop, client_fd);
     tcp_conn->on_read =
         handle_read; // Set the read callback for MCU connections
     tcp_conn->on_write = handle_write;
+    zerocopy_enable(tcp_conn); // 固件、配置等大块下行数据不再拷贝进内核
+    if (tcp_conn->zerocopy)
+      tcp_conn->on_error = handle_error; // 回收完成通知后再结束会话
 
-    int unix_fd = create_unix_client();
-    set_nonblocking(unix_fd);
-
-    connection_t *unix_conn = connection_create(listener->loop, unix_fd);
     unix_conn->on_read = handle_read;
     unix_conn->on_write = handle_write;
 
@@ -138,9 +251,18 @@ void handle_accept(connection_t *listener) {
   }
 }
 
+static connection_t *tcp_listener = NULL;
+
+connection_t *transport_tcp_listener(void) { return tcp_listener; }
+
 void transport_tcp_init(event_loop_t *loop) {
+  admission_init();
+  upstream_init();
   connection_t *tcp_conn = calloc(1, sizeof(connection_t));
-  tcp_conn->fd = create_tcp_server();
+  // 热重启时直接复用旧进程的 listener，保留其 accept backlog
+  tcp_conn->fd = hot_restart_take_listener();
+  if (tcp_conn->fd < 0)
+    tcp_conn->fd = create_tcp_server();
   tcp_conn->loop = loop;
   tcp_conn->on_read =
       handle_accept;         // Set the accept callback for the TCP listener
@@ -150,5 +272,5 @@ void transport_tcp_init(event_loop_t *loop) {
   tcp_conn->out_len = 0;
   tcp_conn->events = EPOLLIN; // Listen for incoming connections (read events)
   event_loop_add(loop, tcp_conn->fd, tcp_conn->events, tcp_conn);
-  event_loop_run(loop); // Start the event loop to process events and callbacks
+  tcp_listener = tcp_conn;
 }
@@ -0,0 +1,185 @@
+#include <arpa/inet.h>
+#include <core/clock.h>
+#include <core/config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <transport/unix_listener.h>
+#include <transport/upstream.h>
+
+#define UPSTREAM_MAX 32
+#define UPSTREAM_PATH_DEFAULT "/tmp/gateway.sock"
+#define UPSTREAM_EJECT_MS_DEFAULT 5000
+
+typedef enum { POLICY_LEAST_BYTES, POLICY_LEAST_CONNS, POLICY_HASH } policy_t;
+
+typedef struct {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  uint64_t path_hash;
+  connection_t *sessions; // 到该后端的连接，经 next/prev 串起
+  int n_sessions;
+  long queued; // 发往该后端、尚未交给内核的字节数，由各会话的 out_counter 维护
+  uint64_t ejected_until; // 单调时间，0 表示健康
+} upstream_t;
+
+static upstream_t upstreams[UPSTREAM_MAX];
+static int n_upstreams = 0;
+static policy_t policy = POLICY_LEAST_BYTES;
+static uint64_t eject_ns = 0;
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t hash_str(const char *s) {
+  uint64_t h = 1469598103934665603ull; // FNV-1a
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 1099511628211ull;
+  return h;
+}
+
+void upstream_init(void) {
+  const char *list = config_get_str("GATEWAY_UPSTREAMS", UPSTREAM_PATH_DEFAULT);
+  n_upstreams = 0;
+  while (*list && n_upstreams < UPSTREAM_MAX) {
+    int len = strcspn(list, ",");
+    upstream_t *u = &upstreams[n_upstreams];
+    if (len > 0 && len < (int)sizeof(u->path)) {
+      memcpy(u->path, list, len);
+      u->path[len] = 0;
+      u->path_hash = mix64(hash_str(u->path));
+      n_upstreams++;
+    } else if (len > 0) {
+      fprintf(stderr, "upstream: path too long '%.*s'\n", len, list);
+    }
+    list += list[len] ? len + 1 : len;
+  }
+  if (n_upstreams == 0) {
+    strcpy(upstreams[0].path, UPSTREAM_PATH_DEFAULT);
+    upstreams[0].path_hash = mix64(hash_str(UPSTREAM_PATH_DEFAULT));
+    n_upstreams = 1;
+  }
+
+  const char *p = config_get_str("GATEWAY_UPSTREAM_POLICY", "least_bytes");
+  if (strcmp(p, "least_conns") == 0)
+    policy = POLICY_LEAST_CONNS;
+  else if (strcmp(p, "hash") == 0)
+    policy = POLICY_HASH;
+  else
+    policy = POLICY_LEAST_BYTES;
+  eject_ns = config_get_int("GATEWAY_UPSTREAM_EJECT_MS",
+                            UPSTREAM_EJECT_MS_DEFAULT) * 1000000ull;
+}
+
+// 会话关闭时从后端的会话链表摘除
+static void detach(connection_t *conn) {
+  upstream_t *u = conn->user_data;
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    u->sessions = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  u->n_sessions--;
+}
+
+static void attach(upstream_t *u, connection_t *conn) {
+  conn->user_data = u;
+  conn->on_close = detach;
+  conn->out_counter = &u->queued;
+  conn->next = u->sessions;
+  if (u->sessions)
+    u->sessions->prev = conn;
+  u->sessions = conn;
+  u->n_sessions++;
+}
+
+// MCU 的 IP 地址（不含端口），重连后仍落到同一个后端
+static uint64_t peer_key(int fd) {
+  struct sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  if (getpeername(fd, (struct sockaddr *)&ss, &len) < 0)
+    return 0;
+  if (ss.ss_family == AF_INET)
+    return ((struct sockaddr_in *)&ss)->sin_addr.s_addr;
+  if (ss.ss_family == AF_INET6) {
+    uint64_t k[2];
+    memcpy(k, &((struct sockaddr_in6 *)&ss)->sin6_addr, sizeof(k));
+    return k[0] ^ mix64(k[1]);
+  }
+  return 0;
+}
+
+/**
+ * Chooses a backend that has not been tried for this session yet.
+ * Ejected backends are only considered when every other one was tried.
+ */
+static upstream_t *pick(uint64_t key, uint32_t tried) {
+  uint64_t now = clock_now_ns();
+  upstream_t *best = NULL;
+  for (int pass = 0; pass < 2 && !best; pass++) {
+    uint64_t best_score = 0;
+    long best_bytes = 0;
+    for (int i = 0; i < n_upstreams; i++) {
+      upstream_t *u = &upstreams[i];
+      if ((tried & (1u << i)) || (pass == 0 && u->ejected_until > now))
+        continue;
+      switch (policy) {
+      case POLICY_HASH: {
+        uint64_t score = mix64(key ^ u->path_hash);
+        if (!best || score > best_score) {
+          best = u;
+          best_score = score;
+        }
+        break;
+      }
+      case POLICY_LEAST_CONNS:
+        if (!best || u->n_sessions < best->n_sessions)
+          best = u;
+        break;
+      case POLICY_LEAST_BYTES: {
+        long bytes = u->queued;
+        if (!best || bytes < best_bytes ||
+            (bytes == best_bytes && u->n_sessions < best->n_sessions)) {
+          best = u;
+          best_bytes = bytes;
+        }
+        break;
+      }
+      }
+    }
+  }
+  return best;
+}
+
+connection_t *upstream_open(event_loop_t *loop, int mcu_fd) {
+  uint64_t key = policy == POLICY_HASH ? mix64(peer_key(mcu_fd)) : 0;
+  uint32_t tried = 0;
+  upstream_t *u;
+  while ((u = pick(key, tried)) != NULL) {
+    tried |= 1u << (u - upstreams);
+    int fd = create_unix_client(u->path);
+    if (fd < 0) {
+      if (u->ejected_until == 0)
+        printf("upstream %s ejected for %llu ms\n", u->path,
+               (unsigned long long)(eject_ns / 1000000));
+      u->ejected_until = clock_now_ns() + eject_ns;
+      continue;
+    }
+    if (u->ejected_until) {
+      printf("upstream %s back in service\n", u->path);
+      u->ejected_until = 0;
+    }
+    connection_t *conn = connection_create(loop, fd);
+    attach(u, conn);
+    return conn;
+  }
+  return NULL;
+}
@@ -0,0 +1,110 @@
+// fd-indexed dispatch table (core/event_loop.c): events reach the callbacks
+// of the connection registered on their fd, the table grows for large fds,
+// and an event queued for a connection that an earlier callback of the same
+// batch closed is dropped, even when its fd number was reused meanwhile.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static event_loop_t *loop;
+static connection_t *conns[2];
+static int peers[2];
+static int reads[2];
+static connection_t *reused;
+static int reused_peer;
+static int reused_reads;
+
+static connection_t *register_pair(int *peer_fd, void (*on_read)(connection_t *)) {
+  int sv[2];
+  socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+  connection_t *conn = connection_create(loop, sv[0]);
+  conn->on_read = on_read;
+  event_loop_add(loop, conn->fd, conn->events, conn);
+  *peer_fd = sv[1];
+  return conn;
+}
+
+static void on_reused_read(connection_t *conn) { reused_reads++; }
+
+// 先被分发的一方关闭另一方，并让新连接复用它的 fd 号
+static void on_pair_read(connection_t *conn) {
+  int me = conn == conns[0] ? 0 : 1;
+  reads[me]++;
+  char buf[16];
+  while (read(conn->fd, buf, sizeof(buf)) > 0)
+    ;
+
+  connection_t *other = conns[!me];
+  if (!other)
+    return;
+  int fd = other->fd;
+  connection_close(other);
+  conns[!me] = NULL;
+
+  int sv[2];
+  socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+  CHECK(sv[0] == fd); // 最小可用 fd 即刚关闭的那个
+  reused = connection_create(loop, sv[0]);
+  reused->on_read = on_reused_read;
+  event_loop_add(loop, reused->fd, reused->events, reused);
+  reused_peer = sv[1]; // 对端不写，新连接不会可读
+}
+
+static void stop(void *arg) {
+  for (int i = 0; i < 2; i++)
+    if (conns[i])
+      connection_close(conns[i]);
+  connection_close(reused);
+}
+
+static void test_stale_event(void) {
+  conns[0] = register_pair(&peers[0], on_pair_read);
+  conns[1] = register_pair(&peers[1], on_pair_read);
+  CHECK(write(peers[0], "a", 1) == 1);
+  CHECK(write(peers[1], "b", 1) == 1);
+
+  // 两个可读事件在同一批次中；第一次回调后，另一个的句柄已失效
+  event_loop_add_timer(loop, 20, stop, NULL);
+  event_loop_run(loop);
+
+  CHECK(reads[0] + reads[1] == 1);
+  CHECK(reused_reads == 0); // 旧连接的事件没有分发给复用 fd 号的新连接
+  close(peers[0]);
+  close(peers[1]);
+  close(reused_peer);
+}
+
+static int high_reads;
+
+static void on_high_read(connection_t *conn) {
+  high_reads++;
+  connection_close(conn);
+}
+
+static void test_large_fd(void) {
+  int sv[2];
+  socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+  int fd = fcntl(sv[0], F_DUPFD, 1000); // 超出初始分发表，触发扩容
+  close(sv[0]);
+  CHECK(fd >= 1000);
+
+  connection_t *conn = connection_create(loop, fd);
+  conn->on_read = on_high_read;
+  event_loop_add(loop, fd, conn->events, conn);
+  CHECK(write(sv[1], "x", 1) == 1);
+  event_loop_run(loop); // on_high_read 关闭后循环中没有 fd，返回
+  CHECK(high_reads == 1);
+  close(sv[1]);
+}
+
+int main(void) {
+  loop = event_loop_create();
+  test_stale_event();
+  test_large_fd();
+  CHECK(connection_count() == 0);
+  return test_report("event_loop_test");
+}
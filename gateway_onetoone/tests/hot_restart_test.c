@@ -0,0 +1,72 @@
+// Hot restart hand-off (transport/hot_restart.h): the old process keeps
+// running its event loop while a successor is slow to acknowledge, goes on
+// accepting if the successor disappears, and drains after a completed
+// hand-off.
+#include "test.h"
+#include <core/clock.h>
+#include <core/event_loop.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <transport/hot_restart.h>
+#include <unistd.h>
+
+static event_loop_t *loop;
+static uint64_t start_ns;
+static int stalled_fd = -1;
+static int tick_ms = -1;
+static pthread_t successor_thread;
+static int inherited = -1;
+
+static int connect_restart_socket(void) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, HOT_RESTART_PATH);
+  CHECK(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  return fd;
+}
+
+// 新进程一侧在启动阶段阻塞收发，放到线程里
+static void *successor(void *arg) {
+  inherited = hot_restart_inherit();
+  return NULL;
+}
+
+static void start_successor(void *arg) {
+  pthread_create(&successor_thread, NULL, successor, NULL);
+}
+
+// 旧进程没有卡在等待确认上：定时器按时触发
+static void tick(void *arg) {
+  tick_ms = (int)((clock_now_ns() - start_ns) / 1000000);
+
+  // 收到 END 记录，不确认就断开，交接应被放弃
+  hr_msg_hdr_t hdr = {0};
+  CHECK(read(stalled_fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+  CHECK(hdr.type == HR_MSG_END);
+  close(stalled_fd);
+
+  event_loop_add_timer(loop, 50, start_successor, NULL);
+}
+
+int main(void) {
+  loop = event_loop_create();
+  hot_restart_listen(loop); // 没有 TCP listener，只交接 END
+
+  stalled_fd = connect_restart_socket();
+  start_ns = clock_now_ns();
+  event_loop_add_timer(loop, 100, tick, NULL);
+
+  // 交接完成后不再有注册的 fd，循环返回
+  event_loop_run(loop);
+  pthread_join(successor_thread, NULL);
+
+  CHECK(tick_ms >= 0 && tick_ms < 1000);
+  CHECK(inherited == 1);
+  CHECK(hot_restart_take_listener() == -1);
+  unlink(HOT_RESTART_PATH);
+  return test_report("hot_restart_test");
+}
@@ -0,0 +1,35 @@
+#ifndef TEST_H
+#define TEST_H
+
+/*
+ * Minimal check helpers for the unit tests under tests/.
+ *
+ * Every test file is its own executable, so it can set the GATEWAY_*
+ * variables it needs before the code under test reads them once. A failed
+ * CHECK prints its location and the test keeps going; test_report() turns
+ * the tally into the exit status ctest looks at.
+ */
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+// 返回进程退出码：0 表示全部通过
+static inline int test_report(const char *name) {
+  if (test_failures) {
+    fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+    return 1;
+  }
+  printf("%s: all checks passed\n", name);
+  return 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,147 @@
+// Backend selection (transport/upstream.h): least_bytes follows the bytes
+// queued towards each backend as sessions buffer, send and close, and a
+// backend that cannot take the connection is skipped without blocking.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <errno.h>
+#include <protocol/mcu_protocol.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <transport/upstream.h>
+#include <unistd.h>
+
+#define N_BACKENDS 2
+
+static event_loop_t *loop;
+static int listeners[N_BACKENDS];
+static char paths[N_BACKENDS][64];
+static int accepted[16]; // 后端一侧的连接，保持打开以便会话能写出
+static int n_accepted;
+
+static int listen_unix(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  CHECK(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  CHECK(listen(fd, 16) == 0);
+  return fd;
+}
+
+// 返回新会话连到的后端下标，-1 表示没有后端收到连接
+static int open_session(connection_t **conn) {
+  *conn = upstream_open(loop, -1);
+  if (!*conn)
+    return -1;
+  (*conn)->events |= EPOLLOUT; // 未注册到 epoll，不触发 epoll_ctl
+  int which = -1;
+  for (int i = 0; i < N_BACKENDS; i++) {
+    int fd = accept(listeners[i], NULL, NULL);
+    if (fd >= 0) {
+      accepted[n_accepted++] = fd;
+      CHECK(which < 0);
+      which = i;
+    }
+  }
+  return which;
+}
+
+static void test_least_bytes(void) {
+  char data[3000];
+  memset(data, 'x', sizeof(data));
+  connection_t *s[4];
+
+  CHECK(open_session(&s[0]) == 0); // 都为空时选第一个
+  connection_append_out(s[0], data, 3000);
+  CHECK(open_session(&s[1]) == 1);
+  CHECK(open_session(&s[2]) == 1); // 后端 1 排队 0 字节，虽然会话更多
+  connection_append_out(s[1], data, 2000);
+  CHECK(open_session(&s[3]) == 1); // 2000 < 3000
+
+  // 写出后不再计入：后端 0 只剩 0 字节
+  handle_write(s[0]);
+  CHECK(connection_out_pending(s[0]) == 0);
+  connection_t *next;
+  CHECK(open_session(&next) == 0);
+  connection_destroy(next);
+
+  // 关闭带未发数据的会话，计数随之扣除
+  connection_destroy(s[1]);
+  connection_append_out(s[0], data, 1000);
+  CHECK(open_session(&next) == 1); // 0 < 1000
+  connection_destroy(next);
+
+  connection_destroy(s[0]);
+  connection_destroy(s[2]);
+  connection_destroy(s[3]);
+}
+
+// 后端 1 的 accept 队列已满，另一个路径不存在：connect 立即失败，会话落到后端 0
+static void test_unreachable(void) {
+  int fillers[64];
+  int n_fillers = 0;
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, paths[1], sizeof(addr.sun_path) - 1);
+  while (n_fillers < 64) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      CHECK(errno == EAGAIN);
+      close(fd);
+      break;
+    }
+    fillers[n_fillers++] = fd;
+  }
+  CHECK(n_fillers < 64);
+
+  char list[256];
+  snprintf(list, sizeof(list), "%s,/tmp/upstream_test_%d_missing.sock,%s",
+           paths[1], (int)getpid(), paths[0]);
+  setenv("GATEWAY_UPSTREAMS", list, 1);
+  upstream_init();
+
+  // 后端 1 的队列里是上面的填充连接，只看后端 0
+  for (int i = 0; i < 2; i++) { // 第二次时其余两个已被摘除
+    connection_t *conn = upstream_open(loop, -1);
+    CHECK(conn != NULL);
+    int fd = accept(listeners[0], NULL, NULL);
+    CHECK(fd >= 0);
+    close(fd);
+    if (conn)
+      connection_destroy(conn);
+  }
+
+  for (int i = 0; i < n_fillers; i++)
+    close(fillers[i]);
+}
+
+int main(void) {
+  char list[256] = "";
+  for (int i = 0; i < N_BACKENDS; i++) {
+    snprintf(paths[i], sizeof(paths[i]), "/tmp/upstream_test_%d_%d.sock",
+             (int)getpid(), i);
+    listeners[i] = listen_unix(paths[i]);
+    if (i)
+      strcat(list, ",");
+    strcat(list, paths[i]);
+  }
+  setenv("GATEWAY_UPSTREAMS", list, 1);
+  setenv("GATEWAY_UPSTREAM_POLICY", "least_bytes", 1);
+  loop = event_loop_create();
+  upstream_init();
+
+  test_least_bytes();
+  test_unreachable();
+
+  for (int i = 0; i < n_accepted; i++)
+    close(accepted[i]);
+  for (int i = 0; i < N_BACKENDS; i++) {
+    close(listeners[i]);
+    unlink(paths[i]);
+  }
+  return test_report("upstream_test");
+}
@@ -0,0 +1,121 @@
+// Zerocopy downlink (core/zerocopy.h): a transfer above GATEWAY_ZEROCOPY_MIN
+// goes backend -> gateway -> MCU over real sockets, arrives intact, and the
+// session is only closed once every pinned buffer has been reaped.
+#include "test.h"
+#include <arpa/inet.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <core/zerocopy.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <protocol/mcu_protocol.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TRANSFER_LEN (1 << 20)
+
+static char *payload;
+static char *received;
+static long received_len;
+static int closed_with_pinned = -1;
+
+static void set_nonblock(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// 后端：写完整个负载后关闭写端，再等网关关闭会话
+static void *backend(void *arg) {
+  int fd = *(int *)arg;
+  for (long off = 0; off < TRANSFER_LEN;) {
+    ssize_t n = write(fd, payload + off, TRANSFER_LEN - off);
+    if (n <= 0)
+      break;
+    off += n;
+  }
+  shutdown(fd, SHUT_WR);
+  char buf[256];
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  return NULL;
+}
+
+// MCU：稍后才开始读，网关交给内核的页面在此之前一直被引用，然后读到 EOF 为止
+static void *mcu(void *arg) {
+  int fd = *(int *)arg;
+  shutdown(fd, SHUT_WR); // 不发上行数据
+  usleep(200 * 1000);
+  ssize_t n;
+  while (received_len < TRANSFER_LEN &&
+         (n = read(fd, received + received_len, TRANSFER_LEN - received_len)) >
+             0)
+    received_len += n;
+  char extra;
+  CHECK(read(fd, &extra, 1) == 0); // 之后只剩 EOF
+  close(fd);
+  return NULL;
+}
+
+static void record_close(connection_t *conn) {
+  closed_with_pinned = conn->zc_head != NULL;
+}
+
+int main(void) {
+  setenv("GATEWAY_ZEROCOPY_MIN", "4096", 1);
+  payload = malloc(TRANSFER_LEN);
+  received = malloc(TRANSFER_LEN);
+  for (long i = 0; i < TRANSFER_LEN; i++)
+    payload[i] = (char)(i * 31 + (i >> 12));
+
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  CHECK(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  CHECK(listen(lfd, 1) == 0);
+  getsockname(lfd, (struct sockaddr *)&addr, &alen);
+  int mcu_fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK(connect(mcu_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  int tcp_fd = accept(lfd, NULL, NULL);
+  close(lfd);
+  int pair[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+  set_nonblock(tcp_fd);
+  set_nonblock(pair[1]);
+
+  // 与 handle_accept 相同的会话搭建
+  event_loop_t *loop = event_loop_create();
+  connection_t *tcp_conn = connection_create(loop, tcp_fd);
+  tcp_conn->on_read = handle_read;
+  tcp_conn->on_write = handle_write;
+  zerocopy_enable(tcp_conn);
+  CHECK(tcp_conn->zerocopy);
+  tcp_conn->on_error = handle_error;
+  tcp_conn->on_close = record_close;
+  connection_t *unix_conn = connection_create(loop, pair[1]);
+  unix_conn->on_read = handle_read;
+  unix_conn->on_write = handle_write;
+  tcp_conn->peer = unix_conn;
+  unix_conn->peer = tcp_conn;
+  event_loop_add(loop, tcp_conn->fd, tcp_conn->events, tcp_conn);
+  event_loop_add(loop, unix_conn->fd, unix_conn->events, unix_conn);
+
+  pthread_t backend_thread, mcu_thread;
+  pthread_create(&backend_thread, NULL, backend, &pair[0]);
+  pthread_create(&mcu_thread, NULL, mcu, &mcu_fd);
+
+  // 两端都关闭后循环中不再有 fd，run 返回
+  event_loop_run(loop);
+  pthread_join(backend_thread, NULL);
+  pthread_join(mcu_thread, NULL);
+
+  CHECK(received_len == TRANSFER_LEN);
+  CHECK(memcmp(received, payload, TRANSFER_LEN) == 0);
+  CHECK(closed_with_pinned == 0);
+  CHECK(connection_count() == 0);
+  return test_report("zerocopy_test");
+}
@@ -0,0 +1,185 @@
+// Microbenchmark / scale test for the event bus (bus_lib).
+//
+// Drives event_subscribe(), event_publish() and event_unsubscribe_all()
+// against in-memory connections that never touch a socket, sweeping topic
+// count, fan-out width and subscribe/unsubscribe churn. Every scenario runs
+// in a forked child so it starts from an empty bus.
+//
+// Usage: bus_bench [quick]
+#include <bus/event_bus.h>
+#include <core/clock.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAYLOAD_LEN 64
+#define BATCH 1024 // 每批操作后（不计时）清空所有输出缓冲区
+
+/* ========== 分配计数（链接时 --wrap） ========== */
+
+static uint64_t allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocs++;
+  return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size) {
+  allocs++;
+  return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *p, size_t size) {
+  allocs++;
+  return __real_realloc(p, size);
+}
+
+/* ========== 场景 ========== */
+
+typedef struct {
+  const char *name;
+  int topics;
+  int fanout;         // 每个主题的订阅端数量
+  int subs_per_conn;  // 每个连接订阅的主题数
+  double churn;       // 每次操作为"退订全部 + 重新订阅"的概率
+  long ops;
+} scenario_t;
+
+static connection_t **conns;
+static int n_conns;
+static char (*names)[16];
+
+static uint64_t rng = 88172645463325252ull;
+static uint64_t next_rand(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static void subscribe_conn(const scenario_t *sc, int i) {
+  for (int j = 0; j < sc->subs_per_conn; j++)
+    event_subscribe(names[(i * sc->subs_per_conn + j) % sc->topics],
+                    conns[i], NULL);
+}
+
+// 模拟订阅端把数据全部写走
+static void drain_all(void) {
+  for (int i = 0; i < n_conns; i++) {
+    connection_fill_out(conns[i], INT_MAX);
+    if (conns[i]->out_len > 0) {
+      connection_out_sent(conns[i], conns[i]->out_len);
+      conns[i]->out_len = 0;
+    }
+  }
+}
+
+static void setup(const scenario_t *sc, event_loop_t *loop) {
+  names = malloc(sizeof(*names) * sc->topics);
+  for (int t = 0; t < sc->topics; t++)
+    snprintf(names[t], sizeof(names[t]), "t%d", t);
+
+  // 连接数使每个主题恰好有 fanout 个订阅端
+  n_conns = (int)((long)sc->topics * sc->fanout / sc->subs_per_conn);
+  conns = malloc(sizeof(connection_t *) * n_conns);
+  for (int i = 0; i < n_conns; i++) {
+    conns[i] = connection_create(loop, -1);
+    conns[i]->events |= EPOLLOUT; // 不触发 epoll_ctl
+    conns[i]->high_watermark = 1 << 30;
+  }
+
+  event_bus_init();
+}
+
+static void report(const char *phase, const scenario_t *sc, long ops,
+                   uint64_t ns, uint64_t n_allocs) {
+  printf("%-12s %-10s %7d %7d %6.1f%% %9ld %10.1f %10.2f\n", sc->name, phase,
+         sc->topics, sc->fanout, sc->churn * 100, ops, (double)ns / ops,
+         (double)n_allocs / ops);
+  fflush(stdout);
+}
+
+static void run_scenario(const scenario_t *sc) {
+  event_loop_t *loop = event_loop_create();
+  setup(sc, loop);
+
+  char payload[PAYLOAD_LEN];
+  memset(payload, 'x', sizeof(payload));
+
+  // 1. 建立全部订阅
+  uint64_t a0 = allocs, t0 = clock_now_ns();
+  for (int i = 0; i < n_conns; i++)
+    subscribe_conn(sc, i);
+  report("subscribe", sc, (long)n_conns * sc->subs_per_conn,
+         clock_now_ns() - t0, allocs - a0);
+
+  // 2. 发布（可混合 churn）
+  uint64_t ns = 0, n_allocs = 0;
+  uint64_t churn_threshold = (uint64_t)(sc->churn * (double)UINT64_MAX);
+  for (long done = 0; done < sc->ops; done += BATCH) {
+    a0 = allocs;
+    t0 = clock_now_ns();
+    for (int k = 0; k < BATCH; k++) {
+      if (sc->churn > 0 && next_rand() < churn_threshold) {
+        int i = next_rand() % n_conns;
+        event_unsubscribe_all(conns[i]);
+        subscribe_conn(sc, i);
+      } else {
+        event_publish(names[next_rand() % sc->topics], payload,
+                      sizeof(payload));
+      }
+    }
+    ns += clock_now_ns() - t0;
+    n_allocs += allocs - a0;
+    drain_all();
+  }
+  report(sc->churn > 0 ? "mixed" : "publish", sc, sc->ops, ns, n_allocs);
+
+  // 3. 逐个退订
+  int n_unsub = n_conns < 2000 ? n_conns : 2000;
+  a0 = allocs;
+  t0 = clock_now_ns();
+  for (int i = 0; i < n_unsub; i++)
+    event_unsubscribe_all(conns[i]);
+  report("unsub_all", sc, n_unsub, clock_now_ns() - t0, allocs - a0);
+}
+
+int main(int argc, char **argv) {
+  int quick = argc > 1 && strcmp(argv[1], "quick") == 0;
+  long ops = quick ? 2048 : 200000;
+
+  scenario_t scenarios[] = {
+      {"small", 10, 1, 1, 0, ops},
+      {"wide", 10, 256, 1, 0, ops},
+      {"topics-1k", 1000, 16, 4, 0, ops},
+      {"topics-10k", 10000, 10, 10, 0, ops},  // 10 万个订阅
+      {"churn-1%", 10000, 10, 10, 0.01, ops},
+      {"churn-10%", 10000, 10, 10, 0.10, quick ? 1024 : 20000},
+  };
+
+  printf("%-12s %-10s %7s %7s %7s %9s %10s %10s\n", "scenario", "phase",
+         "topics", "fanout", "churn", "ops", "ns/op", "allocs/op");
+  fflush(stdout); // 避免子进程继承未输出的缓冲区
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      run_scenario(&scenarios[i]);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "scenario %s failed\n", scenarios[i].name);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+
+/*
+ * Delta-encoded delivery, opted into per subscription:
+ *
+ *   SUB sensor DELTA [filter]
+ *
+ * Every message becomes one line. The first reading of a device, and every
+ * GATEWAY_DELTA_KEYFRAME-th (default 32) after it, is sent whole:
+ *
+ *   K id=3 temp=20.5 hum=40 volt=3.3
+ *
+ * The readings in between only carry the fields whose value changed since
+ * the previous reading of the same device, starting with its id field:
+ *
+ *   D id=3 temp=20.6
+ *
+ * The subscriber replaces those fields in its copy of the last frame of that
+ * device. A keyframe is also sent whenever the set or order of fields
+ * changes, the delta would not be shorter, or the subscriber lost messages
+ * to backpressure; readings without an id are always keyframes. A new
+ * connection, including one handed over by a hot restart, starts from
+ * keyframes.
+ *
+ * Readings are ASCII `key=value` fields (see bus/filter.h); delta mode
+ * expects one reading per message, i.e. GATEWAY_MCU_DELIM framing.
+ */
+
+#define DELTA_MAX_FIELDS 32    // 字段更多的报文总是整帧发送
+#define DELTA_MAX_DEVICES 4096 // 每个订阅端跟踪的设备数上限
+
+typedef struct delta_state delta_state_t;
+
+delta_state_t *delta_create(void);
+void delta_free(delta_state_t *d);
+
+/**
+ * Encodes one reading against the previous reading of its device.
+ *
+ * @param shed - Messages the subscriber has lost so far (out_shed); a
+ *               change forces keyframes for every device.
+ * @param out_len - Length of the encoded line, including the newline.
+ * @return Encoded line, owned by d and valid until the next call.
+ */
+const char *delta_encode(delta_state_t *d, uint64_t shed, const char *data,
+                         int len, int *out_len);
+
+#endif // DELTA_H
@@ -2,10 +2,101 @@
 #define EVENT_BUS_H
 
 #include <core/connection.h>
+#include <stdint.h>
+
+typedef void (*event_forward_t)(const char *topic, const char *data, int len,
+                                uint64_t ingest_ns);
+
+// 批量发布中的一条消息
+typedef struct event_msg {
+  const char *data;
+  int len;
+  uint64_t ingest_ns;
+} event_msg_t;
 
 void event_bus_init();
-void event_subscribe(const char *topic, connection_t *conn);
+
+/**
+ * Makes event_publish() on the calling thread hand messages to fn instead of
+ * delivering them to local subscribers. Used by pipeline ingest threads.
+ */
+void event_bus_set_forwarder(event_forward_t fn);
+/**
+ * Subscribes conn to topic.
+ *
+ * Messages of the topic are queued in the priority class given by
+ * GATEWAY_TOPIC_PRIORITY ("alarm=critical,sensor.1m=bulk"; see
+ * connection_append_msg()).
+ *
+ * @param filter - Content filter expression (see bus/filter.h), or NULL /
+ *                 "" to receive every message of the topic.
+ * @return 0 on success, -1 if the filter expression is invalid.
+ */
+int event_subscribe(const char *topic, connection_t *conn, const char *filter);
+
+/**
+ * Subscribes conn to topic as a member of a consumer group (see
+ * bus/group.h); with group NULL this is event_subscribe().
+ *
+ * @return 0 on success, -1 if the filter is invalid or differs from the one
+ *         the group was created with.
+ */
+int event_subscribe_group(const char *topic, connection_t *conn,
+                          const char *group, const char *filter);
+
+/**
+ * Subscribes conn like event_subscribe_group(); with delta set, messages are
+ * delta-encoded against the previous reading of each device (see
+ * bus/delta.h), otherwise they are sent in the given format_t (see
+ * bus/format.h). Delta mode cannot be combined with a group or a format.
+ *
+ * @return 0 on success, -1 on an invalid filter or combination.
+ */
+int event_subscribe_mode(const char *topic, connection_t *conn,
+                         const char *group, int delta, int format,
+                         const char *filter);
+
+/**
+ * Parses the arguments of a SUB command,
+ * "topic [GROUP name] [DELTA | FORMAT raw|json|csv] [filter]", and
+ * subscribes conn. args is modified in place.
+ *
+ * @return 0 on success, -1 on a malformed command.
+ */
+int event_subscribe_args(connection_t *conn, char *args);
 void event_unsubscribe_all(connection_t *conn);
 void event_publish(const char *topic, const char *data, int len);
 
+/**
+ * Publishes a message that was read from an MCU at ingest_ns (see
+ * core/clock.h). The delay until each subscriber's socket accepts the last
+ * byte is recorded in the topic's latency histogram.
+ */
+void event_publish_at(const char *topic, const char *data, int len,
+                      uint64_t ingest_ns);
+
+/**
+ * Publishes n messages of one topic in order, as by event_publish_at().
+ * Content filters of the topic are evaluated for the whole batch at once
+ * (filter_table_eval_batch()) before anything is delivered.
+ */
+void event_publish_batch(const char *topic, const event_msg_t *msgs, int n);
+
+/**
+ * Publishes a raw message of len bytes waiting in the ingest pipe of the
+ * calling thread (see core/splice.h). Plain subscribers get it by tee();
+ * if anyone needs the bytes they are read into buf (at least len bytes)
+ * and delivered as by event_publish_at(). The pipe is empty afterwards.
+ */
+void event_publish_spliced(const char *topic, int len, uint64_t ingest_ns,
+                           char *buf);
+
+/**
+ * Writes the subscriptions of conn into buf as NUL-terminated entries in
+ * SUB syntax, "topic [GROUP name] [DELTA | FORMAT f] [filter]".
+ *
+ * @return Number of bytes written. Topics that do not fit are skipped.
+ */
+int event_subscriptions(connection_t *conn, char *buf, int cap);
+
 #endif
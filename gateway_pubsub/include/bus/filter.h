@@ -0,0 +1,106 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+/*
+ * Content filters attached to a subscription, e.g.
+ *
+ *   SUB sensor temp>30 hum<=80 id=3,5,7
+ *
+ * Every clause is `field op number` with op one of > >= < <= =, and all
+ * clauses must hold. `id=a,b,c` restricts the device id to a set. Readings
+ * are ASCII `key=value` fields separated by spaces, commas or semicolons.
+ */
+
+#define FILTER_MAX_CLAUSES 4
+#define FILTER_MAX_IDS 16
+#define FILTER_FIELD_LEN 16
+#define FILTER_EXPR_LEN 128
+#define FILTER_ID_FIELD "id" // 设备 ID 字段名
+#define FILTER_BATCH_MAX 64  // filter_table_eval_batch() 一次评估的报文数上限
+
+typedef struct {
+  char field[FILTER_FIELD_LEN];
+  float lo, hi; // 比较运算统一编译成闭区间 [lo, hi]
+} filter_range_t;
+
+typedef struct {
+  int n_ranges;
+  filter_range_t ranges[FILTER_MAX_CLAUSES];
+  int n_ids;
+  int32_t ids[FILTER_MAX_IDS];
+  char expr[FILTER_EXPR_LEN]; // 原始表达式，热重启时原样交接
+} filter_t;
+
+/*
+ * Column-wise view of all filters on one topic. Subscriber i owns bit i of
+ * the match mask, so a single message is checked against every subscriber
+ * with a few vector compares per field.
+ */
+typedef struct filter_table filter_table_t;
+
+/**
+ * Compiles a filter expression.
+ *
+ * @param expr - Clauses separated by spaces.
+ * @param f - Output filter.
+ * @return 0 on success, -1 if the expression is malformed.
+ */
+int filter_compile(const char *expr, filter_t *f);
+
+/**
+ * Builds the evaluation table for n subscribers.
+ *
+ * @param filters - filters[i] is subscriber i's filter, or NULL for none.
+ */
+filter_table_t *filter_table_build(filter_t *const *filters, int n);
+void filter_table_free(filter_table_t *t);
+
+/**
+ * Evaluates one message against every subscriber of the table.
+ *
+ * @return Match mask owned by the table, valid until the next call. Bit i
+ *         is set when subscriber i wants the message.
+ */
+const uint64_t *filter_table_eval(filter_table_t *t, const char *data,
+                                  int len);
+
+/**
+ * Evaluates a batch of messages, e.g. all frames of one MCU read, against
+ * every subscriber of the table. Each message is parsed once; when the
+ * batch outnumbers the subscribers, each subscriber's ranges are compared
+ * with the field values of all messages in one vector pass, otherwise
+ * messages are compared as by filter_table_eval().
+ *
+ * @param n - Number of messages, 1 to FILTER_BATCH_MAX.
+ * @return n match masks of filter_table_words() words each, owned by the
+ *         table and valid until the next call. Message m's mask starts at
+ *         word m * filter_table_words(t).
+ */
+const uint64_t *filter_table_eval_batch(filter_table_t *t,
+                                        const char *const *data,
+                                        const int *len, int n);
+
+// 每个匹配掩码的 uint64_t 个数
+int filter_table_words(const filter_table_t *t);
+
+/**
+ * Finds `name=value` in a reading and parses value as a number.
+ *
+ * @return 1 if the field was found, 0 otherwise.
+ */
+int filter_field_value(const char *data, int len, const char *name,
+                       double *value);
+
+/**
+ * Iterates over the numeric `key=value` fields of a reading.
+ *
+ * @param p - Cursor, initialised to the start of the data.
+ * @param end - End of the data.
+ * @return 1 if a field was found, 0 at the end of the data.
+ */
+int filter_next_number(const char **p, const char *end, const char **key,
+                       int *klen, double *value);
+
+#endif // FILTER_H
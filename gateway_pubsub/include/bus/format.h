@@ -0,0 +1,37 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+/*
+ * Output formats a subscriber can ask for:
+ *
+ *   SUB sensor FORMAT json [filter]
+ *
+ *   raw   the reading as received (default)
+ *   json  {"id":3,"temp":20.5,"fw":"v1.2"} -- numbers unquoted
+ *   csv   3,20.5,v1.2 -- values in the order of the reading
+ *
+ * json and csv emit one line per message from the `key=value` fields of
+ * the reading (see bus/filter.h). The bus encodes each message at most
+ * once per format that some subscriber of the topic uses.
+ */
+
+typedef enum { FORMAT_RAW, FORMAT_JSON, FORMAT_CSV, FORMAT_COUNT } format_t;
+
+/**
+ * @return The format named by the first len bytes of name, or -1.
+ */
+int format_parse(const char *name, int len);
+const char *format_name(int format);
+
+// 编码结果的最大长度
+int format_max_len(int format, int len);
+
+/**
+ * Encodes one reading.
+ *
+ * @param out - At least format_max_len(format, len) bytes.
+ * @return Length of the encoded message.
+ */
+int format_encode(int format, const char *data, int len, char *out);
+
+#endif // FORMAT_H
@@ -0,0 +1,68 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <core/connection.h>
+#include <stdint.h>
+
+/*
+ * Consumer groups: `SUB <topic> GROUP <name>` subscribes a connection as a
+ * member of a group, and every message of the topic goes to exactly one
+ * member. GATEWAY_GROUP_POLICY picks the member:
+ *
+ *   rr     round robin (default)
+ *   least  member with the fewest queued output bytes
+ *   hash   sticky per device id (rendezvous hash), round robin for readings
+ *          without an id
+ *
+ * In pipeline mode members of one group may live on different fan-out
+ * threads. Every thread sees every message, so the threads that currently
+ * have members agree on a single owner per message from the message itself
+ * (device id or ingest time) and only the owner delivers it. While a
+ * membership change is propagating a message may be delivered twice or not
+ * at all.
+ */
+
+#define GROUP_NAME_LEN 32
+
+typedef struct group group_t;
+
+/**
+ * Creates an empty group of topic on the calling thread.
+ */
+group_t *group_create(const char *topic, const char *name);
+void group_free(group_t *g);
+
+const char *group_name(const group_t *g);
+
+// 是否为组成员
+int group_has(const group_t *g, const connection_t *conn);
+
+/**
+ * Adds conn to the group. Joining twice has no effect.
+ */
+void group_join(group_t *g, connection_t *conn);
+
+/**
+ * Removes conn from the group.
+ *
+ * @return Number of members left.
+ */
+int group_leave(group_t *g, connection_t *conn);
+
+/**
+ * Chooses the member that receives a message. Members that are not
+ * CONN_STATE_OPEN (e.g. closing as slow subscribers) are passed over.
+ *
+ * @return The member, or NULL if another fan-out thread delivers it or no
+ *         member is open.
+ */
+connection_t *group_pick(group_t *g, const char *data, int len,
+                         uint64_t ingest_ns);
+
+/**
+ * Tells the group code which fan-out thread (0..63) the caller is. Threads
+ * that never call it act as the only owner of their groups.
+ */
+void group_set_shard(int index);
+
+#endif // GROUP_H
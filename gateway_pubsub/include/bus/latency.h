@@ -0,0 +1,35 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <core/event_loop.h>
+#include <core/histogram.h>
+
+/**
+ * Creates an ingest-to-delivery histogram for topic on the calling thread.
+ *
+ * Every thread that owns subscribers gets its own histogram (single
+ * writer); reports merge all histograms of the same topic.
+ */
+histogram_t *latency_histogram(const char *topic);
+
+/**
+ * Formats one line per topic with count and p50/p90/p99/p99.9/max in
+ * microseconds.
+ *
+ * @return Number of bytes written to buf (always NUL-terminated).
+ */
+int latency_report(char *buf, int cap);
+
+/**
+ * Prints the report, followed by event_loop_report() and budget_report(),
+ * to stdout whenever the process receives SIGUSR1.
+ *
+ * Blocks SIGUSR1 for the calling thread, so it must run before any worker
+ * thread is started.
+ */
+void latency_signal_init(event_loop_t *loop);
+
+// 注销并关闭 signalfd，热重启交接后让事件循环能够退出
+void latency_signal_release(void);
+
+#endif // LATENCY_H
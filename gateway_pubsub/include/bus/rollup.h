@@ -0,0 +1,44 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <core/event_loop.h>
+
+/*
+ * Windowed aggregates of MCU readings, published on derived topics.
+ *
+ * Every numeric field of a "sensor" reading is folded into per-device
+ * min/max/mean/count columns. When a window closes, each device that
+ * reported in it gets one line on "sensor.<window>":
+ *
+ *   id=3 temp.min=20.5 temp.max=21 temp.mean=20.7 temp.n=10
+ *
+ * so subscribers can use the usual filters, e.g. `SUB sensor.1s id=3`.
+ * GATEWAY_ROLLUP_WINDOWS lists the windows ("1s,1m" by default, units ms, s
+ * and m); "none" disables rollups. State is per thread, like the
+ * bus itself; each thread aggregates at most ROLLUP_MAX_DEVICES devices and
+ * counts the readings of any further ones as untracked.
+ */
+
+#define ROLLUP_SOURCE_TOPIC "sensor"
+#define ROLLUP_MAX_WINDOWS 4
+#define ROLLUP_MAX_FIELDS 8 // 每台设备聚合的数值字段数上限
+#define ROLLUP_MAX_DEVICES 16384 // 每个线程聚合的设备数上限
+
+/**
+ * Starts the window timers on the loop of the calling ingest thread.
+ */
+void rollup_init(event_loop_t *loop);
+
+/**
+ * Folds one reading into the open windows of its device.
+ */
+void rollup_record(const char *data, int len);
+
+/**
+ * Formats the rollup counters as one line; nothing when disabled.
+ *
+ * @return Number of bytes written to buf.
+ */
+int rollup_report(char *buf, int cap);
+
+#endif // ROLLUP_H
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <core/connection.h>
+
+/*
+ * Batched delivery for remote subscribers (transport/remote_listener.h).
+ *
+ * Messages for a batched connection are packed into frames instead of
+ * being written one by one:
+ *
+ *   u32 wire_len | u32 raw_len | payload      (big endian)
+ *
+ * The raw payload is a sequence of messages, each prefixed with its length
+ * as an unsigned LEB128 varint. If wire_len < raw_len the payload is an LZ4
+ * block (core/lz.h) that inflates to raw_len bytes.
+ *
+ * A frame is sent once it holds GATEWAY_SUB_BATCH_BYTES (default 16384) of
+ * messages, GATEWAY_SUB_LINGER_MS (default 5) after its first message, or
+ * right away when a critical message joins it. GATEWAY_SUB_COMPRESS=0
+ * turns compression off. A frame is queued in the class of its most
+ * important message and is shed or kept as a whole; its latency sample is
+ * taken from its oldest message. The connection's high watermark is raised
+ * to hold at least two full frames.
+ */
+
+// 为订阅端启用合帧发送
+void batch_attach(connection_t *conn);
+
+/**
+ * Adds a message to the frame being built for conn; called by
+ * connection_append_msg() for batched connections.
+ */
+void batch_add(connection_t *conn, int prio, const char *data, int len,
+               uint64_t ingest_ns, histogram_t *hist);
+
+// 立即发出未满的帧，热重启交接前调用
+void batch_flush(connection_t *conn);
+
+// 连接销毁时释放合帧状态
+void batch_release(connection_t *conn);
+
+/**
+ * Formats the frame and compression counters as one line; nothing when no
+ * connection was ever batched.
+ *
+ * @return Number of bytes written to buf.
+ */
+int batch_report(char *buf, int cap);
+
+#endif // BATCH_H
@@ -0,0 +1,50 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+/*
+ * Process-wide budget for queued subscriber output.
+ *
+ * Every byte in an outbuf, a priority queue, a batch frame being built
+ * (core/batch.h) or a subscriber's splice pipe (core/splice.h) is accounted
+ * here, across all threads. GATEWAY_OUT_BUDGET sets the limit in bytes (32 MiB by default);
+ * shedding escalates as it fills:
+ *
+ *   >= 50%  BUDGET_SHED   bulk messages are dropped instead of queued
+ *   >= 75%  BUDGET_PAUSE  reading from the heaviest MCUs is paused
+ *   >= 90%  BUDGET_EVICT  the subscribers with the largest backlog are closed
+ */
+
+typedef enum {
+  BUDGET_OK,
+  BUDGET_SHED,
+  BUDGET_PAUSE,
+  BUDGET_EVICT
+} budget_level_t;
+
+// 统计计数，用于报告
+typedef enum {
+  BUDGET_STAT_SHED,    // 丢弃的消息
+  BUDGET_STAT_PAUSED,  // 暂停读取的 MCU 次数
+  BUDGET_STAT_EVICTED, // 被断开的订阅端
+  BUDGET_STATS
+} budget_stat_t;
+
+/**
+ * Adds delta (may be negative) to the queued byte count.
+ */
+void budget_account(long delta);
+
+long budget_used(void);
+long budget_limit(void);
+budget_level_t budget_level(void);
+
+void budget_count(budget_stat_t stat);
+
+/**
+ * Formats a one-line summary of usage and shedding counters.
+ *
+ * @return Number of bytes written to buf (always NUL-terminated).
+ */
+int budget_report(char *buf, int cap);
+
+#endif // BUDGET_H
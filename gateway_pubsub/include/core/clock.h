@@ -0,0 +1,22 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// 单调时钟（纳秒），走 vDSO，不陷入内核
+static inline uint64_t clock_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 时间戳计数器，比 clock_gettime 更便宜，只用于测量短的时间间隔
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t clock_ticks(void) { return __rdtsc(); }
+#else
+static inline uint64_t clock_ticks(void) { return clock_now_ns(); }
+#endif
+
+#endif // CLOCK_H
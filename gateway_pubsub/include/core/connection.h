@@ -7,6 +7,50 @@
 #define BUF_SIZE 1024
 
 typedef struct event_loop event_loop_t;
+typedef struct histogram histogram_t;
+
+// 一条消息在 outbuf 中的位置，最后一个字节交给内核时记录其排队延迟
+typedef struct delivery_mark {
+  uint64_t end;       // 消息最后一个字节之后的累计输出偏移
+  uint64_t ingest_ns; // 从 MCU 读入时的单调时间
+  histogram_t *hist;  // 所属主题的延迟直方图
+} delivery_mark_t;
+
+/*
+ * Priority classes of outgoing messages. Messages are committed to outbuf in
+ * bounded chunks, so a critical message waits behind at most
+ * OUT_WIRE_CHUNK bytes of other traffic; the rest queue per class.
+ */
+typedef enum {
+  OUT_PRIO_CRITICAL = 0, // 告警等，优先发送，最后丢弃
+  OUT_PRIO_NORMAL,
+  OUT_PRIO_BULK, // 背压时最先丢弃
+  OUT_PRIO_CLASSES
+} out_prio_t;
+
+#define OUT_WIRE_CHUNK 4096 // outbuf 中已排定顺序的数据上限
+#define OUT_BUF_INITIAL 4096 // outbuf 初始容量，排空后缩回该大小
+#define CONN_INBUF_SIZE 4096 // inbuf 容量，单独分配，不和热字段挤在一起
+
+// 排队中的一条消息
+typedef struct out_msg {
+  int len;
+  uint64_t ingest_ns;
+  histogram_t *hist; // NULL 表示不统计延迟
+} out_msg_t;
+
+// 一个优先级的待发送队列，只保存完整的消息
+typedef struct out_queue {
+  char *buf; // 有效数据为 [head, head + len)
+  int head;
+  int len;
+  int cap;
+  out_msg_t *msgs; // 环形队列，容量为 2 的幂
+  int msgs_head;
+  int msgs_len;
+  int msgs_cap;
+  int deficit; // 加权轮询的剩余额度（字节）
+} out_queue_t;
 
 typedef enum {
   CONN_STATE_OPEN, // 连接已打开，正常状态
@@ -22,23 +66,53 @@ typedef struct connection {
   event_loop_t *loop; // 指向事件循环的指针，便于在回调中修改监听事件
   conn_state_t state; // 连接状态
 
-  char inbuf[4096];
+  char *inbuf; // CONN_INBUF_SIZE 字节，listener 等内部连接为 NULL
   int in_len;
+  uint64_t in_bytes;      // 累计从 MCU 读入的字节数
+  uint64_t in_bytes_mark; // 流控上次检查时的 in_bytes
+  int flow_paused;        // 因全局输出预算被暂停读取
+  int rate_paused;        // 超过该 MCU 的读入速率，定时器到期后恢复
+  struct mcu_rate *rate;  // 令牌桶（protocol/rate_limit.h），NULL 表示不限
+  int hangup; // 本次读回调伴随 EPOLLHUP / EPOLLERR，暂停读取时也要处理
+  int in_discard; // 分帧模式下帧超长，丢弃到下一个分隔符为止
+  int in_lines;   // 订阅端发过 '\n'，此后命令只按行切分
+  int device_known;  // 已从上行报文学到设备 ID，可接收下行命令
+  int32_t device_id;
+  int downlink_busy; // 下行积压达到上限，排空后通知 protocol/downlink.h
 
   char *outbuf;
   int out_len;
   int out_cap;
 
+  uint64_t out_appended; // 累计写入 outbuf 的字节数
+  uint64_t out_sent;     // 累计交给内核的字节数
+  delivery_mark_t *marks; // 环形队列，容量为 2 的幂
+  int marks_head;
+  int marks_len;
+  int marks_cap;
+
+  out_queue_t prio_q[OUT_PRIO_CLASSES]; // 尚未进入 outbuf 的消息
+  int pending_len;   // 各优先级队列的字节数之和
+  int prio_cur;      // 加权轮询当前服务的优先级
+  uint64_t out_shed; // 因背压丢弃的消息数
+
+  int pipe_rd; // tee 过来的原始数据（core/splice.h），-1 表示未创建
+  int pipe_wr;
+  int pipe_len; // 管道中尚未写入 socket 的字节数，先于 outbuf 发出
+  struct batch *batch; // 合帧发送（core/batch.h），NULL 表示逐条发送
+
   int read_closed;  // 标志：读取端是否已关闭
   int write_closed; // 标志：写入端是否已关闭
 
   int high_watermark; // 可选：用于实现流控的高水位线
   // int low_watermark;  // 在pub/sub 无意义
 
-  struct connection *next; // 可选：链表指针，用于管理多个连接
+  struct connection *next; // 全局连接链表指针，用于遍历所有连接（热重启）
+  struct connection *prev;
 
   void (*on_read)(struct connection *); // 读取事件回调函数，参数为当前连接指针
   void (*on_write)(struct connection *); // 写入事件回调函数，参数为当前连接指针
+  void (*on_close)(struct connection *); // 销毁前调用，可为 NULL
 
   void *user_data; // 可选：指向用户数据的指针，便于在回调中存储上下文信息
 } connection_t;
@@ -56,4 +130,84 @@ void connection_close(connection_t *conn);
 
 void connection_append_out(connection_t *conn, const char *data, int len);
 
+/**
+ * Appends a downlink command to the outbuf of an MCU connection. The
+ * slow-subscriber watermark does not apply: the backlog is limited to cap
+ * bytes, and a command that does not fit is refused while the connection
+ * stays open.
+ *
+ * @return 0 on success, -1 if the command was refused.
+ */
+int connection_append_cmd(connection_t *conn, const char *data, int len,
+                          int cap);
+
+/**
+ * Writes output inherited over hot restart to outbuf. The backlog is not
+ * held against the slow-subscriber watermark: the connection's high
+ * watermark is raised by len so that only new output can trip it.
+ */
+void connection_adopt_out(connection_t *conn, const char *data, int len);
+
+// 当前存活的连接数（所有线程，不含 listener），用于连接数上限
+int connection_count(void);
+
+/**
+ * Remembers that the message just appended with connection_append_out() was
+ * read from an MCU at ingest_ns, so its ingest-to-delivery latency is
+ * recorded in hist once its last byte has been written.
+ */
+void connection_mark_delivery(connection_t *conn, uint64_t ingest_ns,
+                              histogram_t *hist);
+
+/**
+ * Queues one message in its priority class.
+ *
+ * Goes straight to outbuf while nothing is queued and outbuf holds less than
+ * OUT_WIRE_CHUNK bytes. Above the high watermark bulk messages are shed
+ * first; critical messages may use up to twice the watermark before the
+ * subscriber is closed.
+ *
+ * Batched connections (core/batch.h) collect the message into a frame
+ * instead, which is queued the same way.
+ *
+ * @param prio - Priority class (out_prio_t).
+ * @param ingest_ns - MCU read time, for the latency histogram.
+ * @param hist - Latency histogram of the topic, or NULL.
+ */
+void connection_append_msg(connection_t *conn, int prio, const char *data,
+                           int len, uint64_t ingest_ns, histogram_t *hist);
+
+// 同 connection_append_msg()，但不经过合帧，用于发出整帧
+void connection_queue_msg(connection_t *conn, int prio, const char *data,
+                          int len, uint64_t ingest_ns, histogram_t *hist);
+
+/**
+ * Moves queued messages into outbuf until it holds at least limit bytes.
+ *
+ * Classes are drained in strict priority order, or by deficit round robin
+ * when GATEWAY_OUT_WEIGHTS ("8,2,1") is set.
+ */
+void connection_fill_out(connection_t *conn, int limit);
+
+/**
+ * Releases output buffers that grew during a burst once they are empty, so
+ * memory use follows the budget (core/budget.h) back down.
+ */
+void connection_trim(connection_t *conn);
+
+/**
+ * Accounts n bytes written to the socket and records the latency of every
+ * message that is now completely handed to the kernel.
+ */
+void connection_out_sent(connection_t *conn, int n);
+
+/**
+ * Returns the head of the list of all connections made by connection_create()
+ * on the calling thread.
+ *
+ * Listeners are not part of the list. Follow `next` to iterate; save the next
+ * pointer first if the loop body may close the current connection.
+ */
+connection_t *connection_list(void);
+
 #endif // CONNECTION_H
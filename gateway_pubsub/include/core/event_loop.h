@@ -1,10 +1,78 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
 #include <stdint.h>
 
 #include <core/connection.h>
 
+typedef void (*event_loop_tick_t)(event_loop_t *loop, void *arg);
+typedef void (*event_cb_t)(connection_t *conn);
+
+typedef struct event_timer event_timer_t;
+typedef void (*event_timer_cb_t)(void *arg);
+
+// 事件循环各阶段耗费的时间（纳秒）
+typedef struct event_loop_stats {
+  uint64_t spin_ns;   // 忙轮询 epoll_wait(..., 0)
+  uint64_t block_ns;  // 阻塞在 epoll_wait 中
+  uint64_t work_ns;   // 执行回调、定时器和 tick
+  uint64_t spin_hits; // 忙轮询期间取到事件的次数
+  uint64_t wakeups;   // 阻塞等待的次数
+} event_loop_stats_t;
+
+/**
+ * Creates an event loop.
+ *
+ * With GATEWAY_BUSY_POLL_US > 0 the loop polls with a zero timeout for that
+ * long before it blocks, trading CPU for wake-up latency.
+ *
+ * Every dispatched callback is timed with the TSC into a histogram per
+ * callback function and direction. An iteration whose callbacks, timers and
+ * tick together take longer than GATEWAY_LOOP_STALL_MS (default 20, 0 turns
+ * logging off) is logged with its slowest callbacks and their fds.
+ */
 event_loop_t *event_loop_create();
 void event_loop_run(event_loop_t *loop);
 
+// 忙轮询时长（微秒），0 表示未启用
+uint64_t event_loop_busy_poll_us(event_loop_t *loop);
+
+void event_loop_stats(event_loop_t *loop, event_loop_stats_t *out);
+
+/**
+ * Names a callback in stall logs and reports, e.g. "mcu_read"; unnamed
+ * callbacks are shown by address.
+ */
+void event_loop_name_callback(event_cb_t fn, const char *name);
+
+/**
+ * Formats one line per event loop of the process with the time spent
+ * spinning, blocked and working, followed by its iteration time and
+ * per-callback time percentiles.
+ *
+ * @return Number of bytes written to buf (always NUL-terminated).
+ */
+int event_loop_report(char *buf, int cap);
+
+/**
+ * Installs a callback that runs after every batch of dispatched events,
+ * e.g. to flush work accumulated by the callbacks of that batch.
+ */
+void event_loop_set_tick(event_loop_t *loop, event_loop_tick_t tick,
+                         void *arg);
+
 void event_loop_add(event_loop_t *loop, int fd, uint32_t events, void *ptr);
 void event_loop_mod(event_loop_t *loop, int fd, uint32_t events, void *ptr);
 void event_loop_del(event_loop_t *loop, int fd);
+
+/**
+ * Schedules cb(arg) to run once on the loop's thread after delay_ms.
+ *
+ * @return Handle for event_loop_cancel_timer(). It becomes invalid once the
+ *         callback has run.
+ */
+event_timer_t *event_loop_add_timer(event_loop_t *loop, uint64_t delay_ms,
+                                    event_timer_cb_t cb, void *arg);
+void event_loop_cancel_timer(event_loop_t *loop, event_timer_t *timer);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,43 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear (HDR-style) histogram of uint64 values.
+ *
+ * Every power-of-two range is split into HIST_SUB_COUNT linear buckets, so
+ * the relative error of a reported percentile stays below 1/HIST_SUB_COUNT
+ * across the whole uint64 range with a fixed, small footprint. Recording is
+ * a couple of shifts and one increment.
+ *
+ * A histogram has a single writer. Other threads may read it concurrently
+ * (e.g. to print a report); counters are updated with relaxed atomics.
+ */
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t counts[HIST_BUCKETS];
+} histogram_t;
+
+void hist_reset(histogram_t *h);
+void hist_record(histogram_t *h, uint64_t value);
+
+/**
+ * Adds the counts of src to dst (dst must not be written concurrently).
+ */
+void hist_merge(histogram_t *dst, const histogram_t *src);
+
+/**
+ * Returns the value at percentile p (0..100), rounded up to the upper edge
+ * of its bucket, or 0 for an empty histogram.
+ */
+uint64_t hist_percentile(const histogram_t *h, double p);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,19 @@
+#ifndef LZ_H
+#define LZ_H
+
+/*
+ * Small greedy LZ77 compressor emitting the LZ4 block format, so consumers
+ * can decode with any LZ4 library (e.g. LZ4_decompress_safe() with the
+ * original size). Matches are found through a 4K-entry hash of 4-byte
+ * sequences within a 64 KB window; no dictionary, no frame header.
+ */
+
+/**
+ * Compresses n bytes of src into dst.
+ *
+ * @param cap - Size of dst; compression gives up once it would exceed it.
+ * @return Compressed length, or -1 if it does not fit in cap bytes.
+ */
+int lz_compress(const char *src, int n, char *dst, int cap);
+
+#endif // LZ_H
@@ -0,0 +1,70 @@
+#ifndef SPLICE_H
+#define SPLICE_H
+
+#include <core/connection.h>
+
+/*
+ * Kernel-side fan-out of raw MCU data, enabled with GATEWAY_SPLICE=1.
+ *
+ * Each read from an MCU socket is spliced into a pipe of the reading thread
+ * instead of inbuf. Every plain subscriber (no filter, group or DELTA) with
+ * nothing queued gets a tee() of it into its own pipe, which is spliced into
+ * its socket once writable, so the payload never enters user space. Only when
+ * some subscriber needs the bytes -- a subscription that inspects them, a
+ * backlog in the buffered queues, or a full pipe -- are they read out once
+ * and delivered through connection_append_msg() as usual.
+ *
+ * Bytes in a connection's pipe always go out before its outbuf. Dedup,
+ * downlink routing and rollups see only the first 256 bytes of a reading,
+ * peeked into inbuf before the splice and cut back to the last complete
+ * field; a reading that may answer a downlink request is copied out and
+ * handled in full. Spliced bytes take no latency samples. Only used
+ * without GATEWAY_MCU_DELIM framing and in single-threaded mode.
+ */
+
+int splice_enabled(void);
+void splice_disable(void);
+
+/**
+ * Moves up to len bytes from fd into the ingest pipe of the calling thread.
+ * The pipe must be emptied with splice_copy() or splice_discard() before the
+ * next call.
+ *
+ * @return Like read(): bytes moved, 0 on EOF, -1 with errno set.
+ */
+int splice_ingest(int fd, int len);
+
+/**
+ * Duplicates the len bytes waiting in the ingest pipe into conn's pipe.
+ *
+ * @return Bytes duplicated; less than len when conn's pipe is full.
+ */
+int splice_tee(connection_t *conn, int len);
+
+// 把 ingest 管道中的 len 字节读入 buf 或丢弃，之后管道为空
+int splice_copy(char *buf, int len);
+void splice_discard(int len);
+
+/**
+ * Writes as much of conn's pipe to its socket as it accepts.
+ *
+ * @return 0 on success (check conn->pipe_len), -1 on a socket error.
+ */
+int splice_flush(connection_t *conn);
+
+/**
+ * Moves the bytes still in conn's pipe to the front of outbuf, e.g. before
+ * the connection is handed to another process.
+ */
+void splice_unsplice(connection_t *conn);
+
+void splice_release(connection_t *conn);
+
+/**
+ * Formats the splice counters as one line; nothing when disabled.
+ *
+ * @return Number of bytes written to buf.
+ */
+int splice_report(char *buf, int cap);
+
+#endif // SPLICE_H
@@ -0,0 +1,52 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer / single-consumer ring of pointers.
+ *
+ * The producer stages items with spsc_push() and makes the whole batch
+ * visible with one spsc_commit(), so the consumer's cache line is touched
+ * once per batch instead of once per item.
+ */
+typedef struct spsc_queue {
+  _Alignas(64) _Atomic uint32_t head; // 消费者读位置
+  _Alignas(64) _Atomic uint32_t tail; // 已发布给消费者的写位置
+  uint32_t staged;                    // 生产者已写入、尚未发布的写位置
+  uint32_t mask;
+  void **slots;
+} spsc_queue_t;
+
+/**
+ * Creates a queue.
+ *
+ * @param capacity - Number of slots, rounded up to a power of two.
+ */
+spsc_queue_t *spsc_create(uint32_t capacity);
+void spsc_destroy(spsc_queue_t *q);
+
+/**
+ * Stages one item (producer side).
+ *
+ * @return 0 on success, -1 if the queue is full.
+ */
+int spsc_push(spsc_queue_t *q, void *item);
+
+/**
+ * Publishes all staged items (producer side).
+ *
+ * @return 1 if the consumer had drained the queue before this batch and
+ *         may be asleep, so the caller should wake it up; 0 otherwise.
+ */
+int spsc_commit(spsc_queue_t *q);
+
+/**
+ * Takes the oldest published item (consumer side).
+ *
+ * @return 1 if an item was stored in *item, 0 if the queue is empty.
+ */
+int spsc_pop(spsc_queue_t *q, void **item);
+
+#endif // SPSC_QUEUE_H
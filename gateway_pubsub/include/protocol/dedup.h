@@ -0,0 +1,40 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+/*
+ * Duplicate suppression for MCUs that resend frames after reconnecting.
+ *
+ * With GATEWAY_DEDUP_WINDOW > 0 (rounded up to a multiple of 64, at most
+ * 1024) every reading carrying both `id=` and a sequence field
+ * (GATEWAY_DEDUP_FIELD, default "seq") is checked against the last window
+ * sequence numbers of its device, anti-replay style: the highest one seen
+ * and a bitmap of those below it. Repeats are dropped before they reach the
+ * bus, rollups or downlink. A sequence number more than the window below
+ * the highest one is taken as the device restarting its count (e.g. after
+ * an MCU reset): the frame is kept and the device's window starts over
+ * from it.
+ *
+ * The device table is shared by all ingest threads, since a reconnecting
+ * MCU may land on another one. Spliced data (core/splice.h) is checked on
+ * its peeked header.
+ */
+
+#define DEDUP_WINDOW_MAX 1024
+#define DEDUP_MAX_DEVICES 65536 // 超出后新设备不再去重
+
+/**
+ * Records a reading's (id, seq) pair.
+ *
+ * @return 1 if the frame is a duplicate and must be dropped (it has been
+ *         counted); 0 otherwise.
+ */
+int dedup_drop(const char *data, int len);
+
+/**
+ * Formats the dedup counters as one line; nothing when disabled.
+ *
+ * @return Number of bytes written to buf.
+ */
+int dedup_report(char *buf, int cap);
+
+#endif // DEDUP_H
@@ -0,0 +1,95 @@
+#ifndef DOWNLINK_H
+#define DOWNLINK_H
+
+#include <core/connection.h>
+#include <stdint.h>
+
+/*
+ * Downlink commands from backends to single devices.
+ *
+ *   SEND <device-id> <frame>
+ *
+ * The frame is written to the MCU connection that last reported
+ * `id=<device-id>`; the index of device ids is learned from uplink frames.
+ * The MCU delimiter (GATEWAY_MCU_DELIM) is appended when the frame lacks it.
+ *
+ * A frame with a `req=<n>` field is a request: the next uplink frame of that
+ * device carrying the same req field is returned to the sender only, as
+ * `REPLY <device-id> <frame>`, instead of being published. Requests expire
+ * after GATEWAY_DOWNLINK_TIMEOUT_MS (default 5000) with
+ * `ERR <device-id> req=<n> timeout`; unknown devices get
+ * `ERR <device-id> no route`.
+ *
+ * Commands wait in the MCU connection's outbuf, which is not subject to the
+ * slow-subscriber watermark. Instead, once GATEWAY_DOWNLINK_MAX_BYTES
+ * (default 65536) are waiting for a device, further commands are refused
+ * with `ERR <device-id> busy` until that backlog has been written out. In
+ * pipeline mode the same reply is sent when the queue to the owning ingest
+ * thread is full; a command that reaches the ingest thread after the cap
+ * was hit is dropped there and a request in it times out.
+ *
+ * While any request is outstanding, uplink frames with a req field are
+ * treated as replies and dropped if nobody waits for them.
+ */
+
+#define DOWNLINK_REQ_FIELD "req"
+
+// 跨线程转发：把命令交给拥有该 MCU 的 ingest 线程，队列满时返回 -1
+typedef int (*downlink_forward_t)(int shard, int32_t device,
+                                  const char *frame, int len);
+// 跨线程转发：把应答交给所有 fan-out 线程，由发起请求的线程认领
+typedef void (*downlink_reply_forward_t)(int32_t device, const char *frame,
+                                         int len);
+
+/**
+ * Sets the index of the calling thread among the threads owning MCU
+ * connections (pipeline ingest threads). Defaults to 0.
+ */
+void downlink_set_shard(int shard);
+
+/**
+ * Installs the cross-thread hooks of the calling thread. In single-threaded
+ * mode both stay NULL and everything is handled locally.
+ */
+void downlink_set_forwarders(downlink_forward_t cmd,
+                             downlink_reply_forward_t reply);
+
+/**
+ * Handles the arguments of a SEND command, "<device-id> <frame>".
+ * args is modified in place.
+ *
+ * @param conn - Backend connection that sent the command.
+ */
+void downlink_command(connection_t *conn, char *args);
+
+/**
+ * Writes a command frame to the device's MCU connection. Must run on the
+ * thread that owns it; frames for devices that went away are dropped.
+ *
+ * @return -1 if the device's downlink backlog is full, 0 otherwise.
+ */
+int downlink_deliver(int32_t device, const char *frame, int len);
+
+// MCU 连接的 outbuf 写空后调用：清除 busy 状态，重新接受下行命令
+void downlink_drained(connection_t *mcu);
+
+/**
+ * Inspects one uplink frame: records the device id of mcu and routes the
+ * frame if it answers an outstanding request.
+ *
+ * @return 1 if the frame was taken as a reply and must not be published.
+ */
+int downlink_uplink(connection_t *mcu, const char *frame, int len);
+
+// 是否有等待应答的请求；没有时上行报文不会被当作应答
+int downlink_outstanding(void);
+
+/**
+ * Hands a reply to the request waiting for it on the calling thread, if any.
+ */
+void downlink_reply(int32_t device, const char *frame, int len);
+
+// 连接关闭前调用：移除其设备路由和等待中的请求
+void downlink_forget(connection_t *conn);
+
+#endif // DOWNLINK_H
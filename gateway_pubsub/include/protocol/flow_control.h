@@ -0,0 +1,17 @@
+#ifndef FLOW_CONTROL_H
+#define FLOW_CONTROL_H
+
+#include <core/event_loop.h>
+
+/**
+ * Starts the periodic enforcement of the output budget (core/budget.h) for
+ * the connections owned by the calling thread.
+ *
+ * At BUDGET_PAUSE the MCUs that read more than the average since the last
+ * check stop being read until usage drops again; at BUDGET_EVICT the
+ * subscribers with the largest backlog are closed until usage is below
+ * that level.
+ */
+void flow_control_init(event_loop_t *loop);
+
+#endif // FLOW_CONTROL_H
@@ -0,0 +1,32 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+/*
+ * Delimiter framing for MCU byte streams.
+ *
+ * Some firmware terminates every ASCII frame with '\n', other firmware
+ * separates frames with a sync byte such as 0x7E. Both come down to a
+ * single-byte boundary search, so one codec covers them.
+ */
+
+// 每个完整帧的回调，frame 不含分隔符
+typedef void (*frame_cb_t)(const char *frame, int len, void *arg);
+
+/**
+ * Splits buf into delimiter-terminated frames in a single pass.
+ *
+ * Every non-empty frame is passed to cb in order. The boundary search uses
+ * an AVX2 or SSE2 kernel when the CPU supports it.
+ *
+ * @param buf - Bytes read from the MCU.
+ * @param len - Number of bytes in buf.
+ * @param delim - Delimiter or sync byte.
+ * @param cb - Called once per frame.
+ * @param arg - Passed through to cb.
+ * @return Bytes consumed, i.e. the offset after the last delimiter. The
+ *         remaining bytes are the start of an incomplete frame.
+ */
+int frame_split(const char *buf, int len, unsigned char delim, frame_cb_t cb,
+                void *arg);
+
+#endif // FRAME_CODEC_H
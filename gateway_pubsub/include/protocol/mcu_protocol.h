@@ -3,6 +3,9 @@
 #include <core/connection.h>
 
 void handle_mcu_read(connection_t *conn);
+
+// GATEWAY_MCU_DELIM 配置的帧分隔符，-1 表示不分帧
+int mcu_frame_delim(void);
 void handle_write(connection_t *conn);
 
 #endif // MCU_PROTOCOL_H
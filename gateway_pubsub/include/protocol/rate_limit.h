@@ -0,0 +1,40 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <core/connection.h>
+
+/*
+ * Per-MCU ingest rate limits.
+ *
+ * Every MCU connection draws the bytes it reads from a token bucket.
+ * GATEWAY_MCU_RATE is the default rate in bytes/s (0, the default, means
+ * unlimited). GATEWAY_MCU_RATE_CLASSES gives ranges of device ids their own
+ * rate once the id is known from a reading, e.g. "1-99=65536,500=0". The
+ * bucket holds GATEWAY_MCU_BURST_MS (default 100) worth of traffic, and at
+ * least one full read.
+ *
+ * An MCU that runs out of tokens is not read until a timer finds a quarter
+ * of its bucket refilled. Nothing is dropped: the data waits in the kernel
+ * and TCP slows the device down. This pause is independent of the budget
+ * pause (flow_paused); reading resumes only when neither applies.
+ */
+
+#define RATE_MAX_CLASSES 16
+
+/**
+ * Accounts n bytes just read from mcu and stops reading it when its bucket
+ * is empty.
+ *
+ * @return 1 if the caller must stop reading, 0 otherwise.
+ */
+int rate_limit_charge(connection_t *mcu, int n);
+
+/**
+ * Formats the rate limit counters as one line; nothing when no limit is
+ * configured.
+ *
+ * @return Number of bytes written to buf.
+ */
+int rate_limit_report(char *buf, int cap);
+
+#endif // RATE_LIMIT_H
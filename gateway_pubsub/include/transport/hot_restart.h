@@ -0,0 +1,71 @@
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <core/connection.h>
+#include <stdint.h>
+
+/*
+ * A gateway started with GATEWAY_HOT_RESTART=1 takes over the listeners, MCU
+ * connections and subscribers of the running one instead of creating them,
+ * and the old process exits once the hand-off is acknowledged. Not available
+ * in pipeline mode (transport/pipeline.h).
+ */
+
+// 新旧进程之间交接 fd 使用的 UNIX socket
+#define HOT_RESTART_PATH "/tmp/gateway.restart.sock"
+
+typedef enum {
+  HR_MSG_TCP_LISTENER = 1, // MCU 侧 TCP listener
+  HR_MSG_UNIX_LISTENER,    // 订阅端 UNIX listener
+  HR_MSG_MCU,              // 已连接的 MCU，payload 为未处理的 inbuf
+  HR_MSG_SUBSCRIBER,       // 订阅端，payload 为订阅列表 + 未发送的 outbuf
+  HR_MSG_END,              // 交接结束，新进程回复 1 字节确认
+  HR_MSG_REMOTE_LISTENER,  // 远程订阅端 TCP listener
+  HR_MSG_REMOTE_SUBSCRIBER // 远程订阅端，payload 同 HR_MSG_SUBSCRIBER
+} hr_msg_type_t;
+
+/*
+ * Every record on the hand-off socket is this header followed by
+ * `topics_len + data_len` payload bytes. A record that carries an fd has it
+ * attached as SCM_RIGHTS to the header.
+ */
+typedef struct {
+  uint32_t type;
+  uint32_t topics_len; // NUL 分隔的订阅条目字节数（仅 HR_MSG_SUBSCRIBER）
+  uint32_t data_len;   // 缓冲区中尚未处理的数据字节数
+} hr_msg_hdr_t;
+
+/**
+ * Takes over the sockets of a running gateway (new process side).
+ *
+ * Connects to HOT_RESTART_PATH, receives the listeners, MCU connections and
+ * subscribers of the old process and acknowledges the hand-off. Must run
+ * before the transports are initialised.
+ *
+ * @return 1 if the sockets were inherited, 0 if nothing was running.
+ */
+int hot_restart_inherit(void);
+
+/**
+ * Returns an inherited listener fd, or -1 so the caller creates a new one.
+ *
+ * @param type - HR_MSG_TCP_LISTENER, HR_MSG_UNIX_LISTENER or
+ *               HR_MSG_REMOTE_LISTENER.
+ */
+int hot_restart_take_listener(int type);
+
+/**
+ * Registers the inherited MCU and subscriber connections in loop and
+ * restores their subscriptions and pending output.
+ */
+void hot_restart_adopt(event_loop_t *loop);
+
+/**
+ * Listens on HOT_RESTART_PATH for a successor (old process side).
+ *
+ * When a new process connects, every socket is handed over and this process
+ * drops its copies, so event_loop_run() returns.
+ */
+void hot_restart_listen(event_loop_t *loop);
+
+#endif // HOT_RESTART_H
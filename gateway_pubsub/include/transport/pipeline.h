@@ -0,0 +1,48 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <core/event_loop.h>
+
+/*
+ * Optional staged pipeline.
+ *
+ *   main thread     accepts on both listeners and hands each new fd over
+ *   ingest threads  own MCU connections, read and frame their data and push
+ *                   batches of messages into one SPSC queue per fan-out
+ *   fan-out threads own subscriber connections, deliver queued messages
+ *                   through their own event bus and do all writes
+ *
+ * Downlink commands (protocol/downlink.h) travel the other way through one
+ * small SPSC queue per (fan-out, ingest) pair; the ingest thread owning the
+ * MCU writes them, and replies return with the uplink traffic.
+ *
+ * Enabled when both GATEWAY_INGEST_THREADS and GATEWAY_FANOUT_THREADS are
+ * > 0; GATEWAY_SPLICE (core/splice.h) is ignored in this mode.
+ * GATEWAY_INGEST_CPUS / GATEWAY_FANOUT_CPUS ("2,3") pin the threads. Hot
+ * restart is not available: the connections are spread over the threads
+ * and cannot be handed over as a whole.
+ */
+
+/**
+ * Starts the worker threads if the pipeline is configured.
+ *
+ * @return 1 if the pipeline is running, 0 for the single-threaded mode.
+ */
+int pipeline_start(void);
+
+// pipeline 是否已启用
+int pipeline_enabled(void);
+
+/**
+ * Hands an accepted MCU socket to an ingest thread.
+ */
+void pipeline_dispatch_mcu(int fd);
+
+/**
+ * Hands an accepted subscriber socket to a fan-out thread.
+ *
+ * @param remote - 1 for a remote subscriber (transport/remote_listener.h).
+ */
+void pipeline_dispatch_subscriber(int fd, int remote);
+
+#endif // PIPELINE_H
@@ -0,0 +1,25 @@
+#ifndef REMOTE_LISTENER_H
+#define REMOTE_LISTENER_H
+
+#include <core/connection.h>
+
+/*
+ * TCP listener for off-box subscribers, enabled with GATEWAY_SUB_PORT and
+ * bound to GATEWAY_REMOTE_ADDR (default 127.0.0.1).
+ *
+ * Remote subscribers may only SUB, with the same syntax as local ones;
+ * SEND and STATS stay on the local socket since the port is not
+ * authenticated. Everything sent to them is packed into frames and
+ * optionally compressed (core/batch.h).
+ */
+
+void transport_remote_init(event_loop_t *loop);
+// 返回远程订阅 listener，未启用或已移交时为 NULL
+connection_t *transport_remote_listener(void);
+void handle_remote_accept(connection_t *listener);
+void handle_remote_read(connection_t *conn);
+
+// 配置远程订阅端连接：只接受 SUB，输出合帧
+void remote_subscriber_setup(connection_t *conn);
+
+#endif // REMOTE_LISTENER_H
@@ -3,5 +3,8 @@
 #include <core/connection.h>
 
 void transport_tcp_init(event_loop_t *loop);
+// 返回 TCP listener 连接，未初始化或已移交时为 NULL
+connection_t *transport_tcp_listener(void);
+void handle_accept(connection_t *listener);
 
 #endif // TCP_LISTENER_H
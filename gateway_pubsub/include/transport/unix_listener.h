@@ -4,5 +4,26 @@
 #include <core/connection.h>
 
 void transport_unix_init(event_loop_t *loop);
+// 返回 UNIX listener 连接，未初始化或已移交时为 NULL
+connection_t *transport_unix_listener(void);
+// 订阅端命令 SUB / SEND / STATS，每条一行，以 '\n' 结尾（旧客户端可不带）
+void handle_unix_read(connection_t *conn);
+
+/**
+ * Reads from a subscriber and runs every complete command line.
+ *
+ * Commands are buffered in conn->inbuf until their '\n' arrives, so several
+ * commands may share one read and a command may span reads. A line that
+ * does not fit in CONN_INBUF_SIZE is answered with `ERR line too long` and
+ * skipped up to its end. Closes the subscriber on EOF or error.
+ *
+ * Until a subscriber has sent its first '\n', a read that ends without one
+ * and starts with nothing buffered is taken as one complete command, as
+ * older clients write each command unterminated.
+ *
+ * @param handle - Runs one command line, without its line ending.
+ */
+void subscriber_read_commands(connection_t *conn,
+                              void (*handle)(connection_t *, char *));
 
 #endif // UNIX_LISTENER_H
@@ -1,6 +1,14 @@
 // Enabling GNU extensions for additional socket and file control functions
 #define _GNU_SOURCE
+#include <bus/latency.h>
+#include <bus/rollup.h>
+#include <core/config.h>
 #include <core/event_loop.h>
+#include <protocol/flow_control.h>
+#include <stdio.h>
+#include <transport/hot_restart.h>
+#include <transport/pipeline.h>
+#include <transport/remote_listener.h>
 #include <transport/tcp_listener.h>
 #include <transport/unix_listener.h>
 
@@ -12,15 +20,49 @@
  * the TCP listener and UNIX domain client connections. Creates the
  * event loop and handles incoming connections and data in real time.
  *
+ * Startup order:
+ *   1. SIGUSR1 is blocked before any worker thread exists (bus/latency.h).
+ *   2. The pipeline threads start if configured (transport/pipeline.h).
+ *   3. Sockets of a running gateway are inherited (transport/hot_restart.h),
+ *      so the listeners below reuse them instead of binding again.
+ *   4. The listeners are set up.
+ *   5. Without the pipeline, this thread also runs the rollups and the
+ *      output budget checks, adopts the inherited connections and waits for
+ *      a successor; ingest threads start their own rollups.
+ *
+ * The GATEWAY_* variables are documented in the header of the module that
+ * reads them.
+ *
  * @return Always returns 0.
  */
 int main() {
   event_loop_t *ev_loop = event_loop_create();
 
+  // 需在创建工作线程之前屏蔽 SIGUSR1
+  latency_signal_init(ev_loop);
+
+  // 连接分散在各工作线程中，无法整体交接，因此 pipeline 模式不支持热重启
+  int pipelined = pipeline_start();
+  int hot_restart = config_get_int("GATEWAY_HOT_RESTART", 0);
+
+  if (hot_restart && pipelined) {
+    fprintf(stderr, "hot restart is not supported in pipeline mode\n");
+  } else if (hot_restart) {
+    hot_restart_inherit();
+  }
+
   /* ========== 1. 创建 TCP listener connection ========== */
   transport_tcp_init(ev_loop);
 
   transport_unix_init(ev_loop);
+  transport_remote_init(ev_loop);
+
+  if (!pipelined) {
+    rollup_init(ev_loop); // pipeline 模式下由各 ingest 线程启动
+    flow_control_init(ev_loop);
+    hot_restart_adopt(ev_loop);
+    hot_restart_listen(ev_loop);
+  }
 
   event_loop_run(ev_loop);
 
@@ -0,0 +1,235 @@
+#include <bus/delta.h>
+#include <core/config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DELTA_KEYFRAME_DEFAULT 32
+
+typedef struct {
+  int32_t id;
+  int used;
+  uint32_t epoch; // 与 delta_state_t.epoch 不同时说明中间丢过消息
+  int since_key;  // 上次关键帧之后发出的增量帧数
+  char *frame;    // 该设备上一条报文的原文
+  int len;
+} device_t;
+
+struct delta_state {
+  device_t *devices; // 开放寻址，容量为 2 的幂；设备只增不删
+  int cap;
+  int used;
+  uint64_t shed;
+  uint32_t epoch;
+  char *out;
+  int out_cap;
+};
+
+// 报文中的一个字段，key 为 `=` 之前的部分
+typedef struct {
+  const char *p;
+  int len;
+  int klen;
+} field_t;
+
+static int keyframe_every = -1;
+
+static int keyframe_interval(void) {
+  if (keyframe_every < 0)
+    keyframe_every =
+        config_get_int("GATEWAY_DELTA_KEYFRAME", DELTA_KEYFRAME_DEFAULT);
+  return keyframe_every;
+}
+
+delta_state_t *delta_create(void) { return calloc(1, sizeof(delta_state_t)); }
+
+void delta_free(delta_state_t *d) {
+  if (!d)
+    return;
+  for (int i = 0; i < d->cap; i++)
+    free(d->devices[i].frame);
+  free(d->devices);
+  free(d->out);
+  free(d);
+}
+
+static int is_sep(char c) {
+  return c == ' ' || c == ',' || c == ';' || c == '\t' || c == '\r' ||
+         c == '\n';
+}
+
+/**
+ * Splits a reading into fields.
+ *
+ * @return Number of fields, or -1 if there are more than DELTA_MAX_FIELDS.
+ */
+static int split_fields(const char *data, int len, field_t *f) {
+  const char *p = data, *end = data + len;
+  int n = 0;
+  while (1) {
+    while (p < end && is_sep(*p))
+      p++;
+    if (p == end)
+      return n;
+    if (n == DELTA_MAX_FIELDS)
+      return -1;
+    const char *s = p;
+    while (p < end && !is_sep(*p))
+      p++;
+    const char *eq = memchr(s, '=', p - s);
+    f[n].p = s;
+    f[n].len = p - s;
+    f[n].klen = eq ? eq - s : p - s;
+    n++;
+  }
+}
+
+// 返回 id 字段的下标，没有或不是整数时返回 -1
+static int find_id(const field_t *f, int n, int32_t *id) {
+  for (int i = 0; i < n; i++) {
+    if (f[i].klen != 2 || memcmp(f[i].p, "id", 2) != 0 || f[i].len < 4)
+      continue;
+    char buf[16];
+    int vlen = f[i].len - 3;
+    if (vlen >= (int)sizeof(buf))
+      return -1;
+    memcpy(buf, f[i].p + 3, vlen);
+    buf[vlen] = 0;
+    char *end;
+    long v = strtol(buf, &end, 10);
+    if (*end)
+      return -1;
+    *id = (int32_t)v;
+    return i;
+  }
+  return -1;
+}
+
+static uint32_t hash_id(int32_t id) {
+  uint32_t x = (uint32_t)id;
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+static device_t *device_slot(device_t *devices, int cap, int32_t id) {
+  int mask = cap - 1;
+  int h = hash_id(id) & mask;
+  while (devices[h].used && devices[h].id != id)
+    h = (h + 1) & mask;
+  return &devices[h];
+}
+
+// 查找或新建设备记录；跟踪的设备已满时返回 NULL，该设备只发关键帧
+static device_t *device_get(delta_state_t *d, int32_t id) {
+  if (d->cap) {
+    device_t *dev = device_slot(d->devices, d->cap, id);
+    if (dev->used)
+      return dev;
+  }
+  if (d->used == DELTA_MAX_DEVICES)
+    return NULL;
+
+  if ((d->used + 1) * 2 > d->cap) { // 负载因子保持在 1/2 以下
+    int cap = d->cap ? d->cap * 2 : 16;
+    device_t *devices = calloc(cap, sizeof(device_t));
+    for (int i = 0; i < d->cap; i++) {
+      if (d->devices[i].used)
+        *device_slot(devices, cap, d->devices[i].id) = d->devices[i];
+    }
+    free(d->devices);
+    d->devices = devices;
+    d->cap = cap;
+  }
+  device_t *dev = device_slot(d->devices, d->cap, id);
+  dev->used = 1;
+  dev->id = id;
+  d->used++;
+  return dev;
+}
+
+static void remember(device_t *dev, const char *data, int len) {
+  if (len > dev->len || !dev->frame)
+    dev->frame = realloc(dev->frame, len);
+  memcpy(dev->frame, data, len);
+  dev->len = len;
+}
+
+/**
+ * Writes "D <id field> <changed fields>\n" to out.
+ *
+ * @return Length written, or -1 if the fields of the previous frame differ
+ *         in number, names or order.
+ */
+static int encode_fields(const device_t *dev, const field_t *cur, int n,
+                         int idf, char *out) {
+  field_t prev[DELTA_MAX_FIELDS];
+  if (split_fields(dev->frame, dev->len, prev) != n)
+    return -1;
+
+  int len = 0;
+  out[len++] = 'D';
+  out[len++] = ' ';
+  memcpy(out + len, cur[idf].p, cur[idf].len);
+  len += cur[idf].len;
+  for (int i = 0; i < n; i++) {
+    if (prev[i].klen != cur[i].klen ||
+        memcmp(prev[i].p, cur[i].p, cur[i].klen) != 0)
+      return -1;
+    if (i == idf || (prev[i].len == cur[i].len &&
+                     memcmp(prev[i].p, cur[i].p, cur[i].len) == 0))
+      continue;
+    out[len++] = ' ';
+    memcpy(out + len, cur[i].p, cur[i].len);
+    len += cur[i].len;
+  }
+  out[len++] = '\n';
+  return len;
+}
+
+const char *delta_encode(delta_state_t *d, uint64_t shed, const char *data,
+                         int len, int *out_len) {
+  while (len > 0 && (data[len - 1] == '\n' || data[len - 1] == '\r'))
+    len--;
+  if (shed != d->shed) {
+    // 订阅端丢过消息，它手里的上一帧不可信，所有设备重新发关键帧
+    d->shed = shed;
+    d->epoch++;
+  }
+  // 增量帧中每个字段前只多一个空格，不会超过两倍原文
+  if (d->out_cap < 2 * len + 8) {
+    d->out_cap = 2 * len + 8;
+    d->out = realloc(d->out, d->out_cap);
+  }
+
+  field_t cur[DELTA_MAX_FIELDS];
+  int n = split_fields(data, len, cur);
+  int32_t id;
+  int idf = n > 0 ? find_id(cur, n, &id) : -1;
+  device_t *dev = idf >= 0 ? device_get(d, id) : NULL;
+
+  if (dev && dev->frame && dev->epoch == d->epoch &&
+      dev->since_key + 1 < keyframe_interval()) {
+    int m = encode_fields(dev, cur, n, idf, d->out);
+    if (m >= 0 && m < len + 3) {
+      dev->since_key++;
+      remember(dev, data, len);
+      *out_len = m;
+      return d->out;
+    }
+  }
+
+  d->out[0] = 'K';
+  d->out[1] = ' ';
+  memcpy(d->out + 2, data, len);
+  d->out[len + 2] = '\n';
+  *out_len = len + 3;
+  if (dev) {
+    dev->since_key = 0;
+    dev->epoch = d->epoch;
+    remember(dev, data, len);
+  }
+  return d->out;
+}
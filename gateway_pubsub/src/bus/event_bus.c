@@ -1,23 +1,86 @@
+#include <bus/delta.h>
+#include <bus/event_bus.h>
+#include <bus/filter.h>
+#include <bus/format.h>
+#include <bus/group.h>
+#include <bus/latency.h>
+#include <core/clock.h>
+#include <core/config.h>
 #include <core/connection.h>
 #include <core/event_loop.h>
+#include <core/splice.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 typedef struct subscriber {
-  connection_t *conn;
+  connection_t *conn; // 消费组为 NULL，由 group 选出接收者
+  filter_t *filter;   // NULL 表示接收该主题的全部消息；消费组共用
+  group_t *group;
+  delta_state_t *delta; // NULL 表示发送原始报文
+  int format;           // 输出格式（format_t），消费组共用
+  uint64_t spliced;     // 等于 splice_seq 时当前消息已 tee 给它
+  int splice_off;       // 已 tee 的字节数，其余走普通路径
   struct subscriber *next;
 } subscriber_t;
 
 typedef struct topic {
   char name[64];
   subscriber_t *subs;
+  int n_filtered;        // 带过滤条件的订阅数，为 0 时走无过滤快路径
+  int dirty;             // 订阅变化后需要重建过滤表
+  filter_table_t *table; // 按列存放的过滤条件
+  subscriber_t **index;  // 过滤表第 i 位对应的订阅端
+  int n_index;
+  histogram_t *latency;  // 读入到交给内核的延迟（本线程）
+  int prio;              // 输出队列的优先级（out_prio_t）
   struct topic *next;
 } topic_t;
 
-static topic_t *topics = NULL;
+// 每个线程一份主题表：pipeline 模式下 fan-out 线程只管理自己的订阅端
+static __thread topic_t *topics = NULL;
+static __thread event_forward_t forwarder = NULL;
+
+// 当前消息按各格式编码的结果，每条消息每种格式最多编码一次
+static __thread struct {
+  uint64_t seq; // 编码时的 publish_seq
+  char *buf;
+  int cap;
+  int len;
+} encoded[FORMAT_COUNT];
+static __thread uint64_t publish_seq = 0;
+static __thread uint64_t splice_seq = 1;
 
 void event_bus_init() { topics = NULL; }
 
+void event_bus_set_forwarder(event_forward_t fn) { forwarder = fn; }
+
+/**
+ * Looks up the priority class of a topic in GATEWAY_TOPIC_PRIORITY, e.g.
+ * "alarm=critical,sensor.1m=bulk". Unlisted topics are normal.
+ */
+static int topic_priority(const char *name) {
+  static const char *classes[OUT_PRIO_CLASSES] = {"critical", "normal",
+                                                  "bulk"};
+  const char *s = config_get_str("GATEWAY_TOPIC_PRIORITY", "");
+  int nlen = strlen(name);
+  while (*s) {
+    int len = strcspn(s, ",");
+    const char *eq = memchr(s, '=', len);
+    if (eq && eq - s == nlen && strncmp(s, name, nlen) == 0) {
+      int clen = s + len - eq - 1;
+      for (int p = 0; p < OUT_PRIO_CLASSES; p++) {
+        if ((int)strlen(classes[p]) == clen &&
+            strncmp(eq + 1, classes[p], clen) == 0)
+          return p;
+      }
+      fprintf(stderr, "bad priority for topic %s\n", name);
+    }
+    s += s[len] ? len + 1 : len;
+  }
+  return OUT_PRIO_NORMAL;
+}
+
 static topic_t *find_or_create_topic(const char *name) {
   topic_t *t = topics;
   while (t) {
@@ -28,18 +91,150 @@ static topic_t *find_or_create_topic(const char *name) {
 
   t = calloc(1, sizeof(topic_t));
   strncpy(t->name, name, sizeof(t->name) - 1);
+  t->latency = latency_histogram(t->name);
+  t->prio = topic_priority(t->name);
   t->next = topics;
   topics = t;
   return t;
 }
 
-void event_subscribe(const char *topic, connection_t *conn) {
+static int same_filter(const filter_t *a, const filter_t *b) {
+  if (!a || !b)
+    return a == b;
+  return strcmp(a->expr, b->expr) == 0;
+}
+
+int event_subscribe_group(const char *topic, connection_t *conn,
+                          const char *group, const char *filter) {
+  return event_subscribe_mode(topic, conn, group, 0, FORMAT_RAW, filter);
+}
+
+int event_subscribe_mode(const char *topic, connection_t *conn,
+                         const char *group, int delta, int format,
+                         const char *filter) {
+  if (group && delta) {
+    // 组内消息轮流发给不同成员，各成员手里的上一帧对不上
+    printf("DELTA is not supported for group %s of topic %s\n", group, topic);
+    return -1;
+  }
+  if (delta && format != FORMAT_RAW) {
+    printf("DELTA cannot be combined with FORMAT for topic %s\n", topic);
+    return -1;
+  }
+  filter_t *f = NULL;
+  if (filter && *filter) {
+    f = malloc(sizeof(filter_t));
+    if (filter_compile(filter, f) < 0) {
+      printf("invalid filter for topic %s: %s\n", topic, filter);
+      free(f);
+      return -1;
+    }
+  }
+
   topic_t *t = find_or_create_topic(topic);
 
+  if (group) {
+    // 组已存在时加入即可，组内成员必须使用相同的过滤条件和输出格式
+    for (subscriber_t *s = t->subs; s; s = s->next) {
+      if (!s->group || strcmp(group_name(s->group), group) != 0)
+        continue;
+      int ok = same_filter(s->filter, f) && s->format == format;
+      if (ok)
+        group_join(s->group, conn);
+      else
+        printf("group %s of topic %s uses a different filter or format\n",
+               group, topic);
+      free(f);
+      return ok ? 0 : -1;
+    }
+  }
+
   subscriber_t *s = calloc(1, sizeof(subscriber_t));
-  s->conn = conn;
+  s->filter = f;
+  s->format = format;
+  if (group) {
+    s->group = group_create(topic, group);
+    group_join(s->group, conn);
+  } else {
+    s->conn = conn;
+    if (delta)
+      s->delta = delta_create();
+  }
   s->next = t->subs;
   t->subs = s;
+
+  if (f)
+    t->n_filtered++;
+  t->dirty = 1;
+  return 0;
+}
+
+int event_subscribe(const char *topic, connection_t *conn,
+                    const char *filter) {
+  return event_subscribe_group(topic, conn, NULL, filter);
+}
+
+int event_subscribe_args(connection_t *conn, char *args) {
+  args[strcspn(args, "\r\n")] = 0;
+  char *topic = args;
+  char *rest = topic + strcspn(topic, " ");
+  if (*rest)
+    *rest++ = 0;
+
+  char *group = NULL;
+  if (strncmp(rest, "GROUP ", 6) == 0) {
+    group = rest + 6;
+    rest = group + strcspn(group, " ");
+    if (*rest)
+      *rest++ = 0;
+    if (!*group || strlen(group) >= GROUP_NAME_LEN) {
+      printf("invalid group name for topic %s\n", topic);
+      return -1;
+    }
+  }
+  int delta = 0;
+  int format = FORMAT_RAW;
+  if (strncmp(rest, "DELTA", 5) == 0 && (rest[5] == ' ' || rest[5] == 0)) {
+    delta = 1;
+    rest += rest[5] ? 6 : 5;
+  } else if (strncmp(rest, "FORMAT ", 7) == 0) {
+    char *name = rest + 7;
+    rest = name + strcspn(name, " ");
+    format = format_parse(name, rest - name);
+    if (*rest)
+      rest++;
+    if (format < 0) {
+      printf("unknown format for topic %s\n", topic);
+      return -1;
+    }
+  }
+  // 剩下的部分是内容过滤表达式
+  return event_subscribe_mode(topic, conn, group, delta, format, rest);
+}
+
+/**
+ * Rebuilds the column-wise filter table of a topic after its subscriber
+ * list changed. Subscribing is rare compared to publishing, so the cost of
+ * the rebuild is paid here instead of on every message.
+ */
+static void rebuild_filters(topic_t *t) {
+  int n = 0;
+  for (subscriber_t *s = t->subs; s; s = s->next)
+    n++;
+
+  filter_t **filters = malloc(sizeof(filter_t *) * (n ? n : 1));
+  t->index = realloc(t->index, sizeof(subscriber_t *) * (n ? n : 1));
+  int i = 0;
+  for (subscriber_t *s = t->subs; s; s = s->next, i++) {
+    t->index[i] = s;
+    filters[i] = s->filter;
+  }
+
+  filter_table_free(t->table);
+  t->table = filter_table_build(filters, n);
+  t->n_index = n;
+  free(filters);
+  t->dirty = 0;
 }
 
 void event_unsubscribe_all(connection_t *conn) {
@@ -47,10 +242,19 @@ void event_unsubscribe_all(connection_t *conn) {
   while (t) {
     subscriber_t **pp = &t->subs;
     while (*pp) {
-      if ((*pp)->conn == conn) {
-        subscriber_t *tmp = *pp;
-        *pp = (*pp)->next;
-        free(tmp);
+      subscriber_t *s = *pp;
+      // 消费组在最后一个成员离开时才删除
+      if (s->conn == conn ||
+          (s->group && group_has(s->group, conn) &&
+           group_leave(s->group, conn) == 0)) {
+        *pp = s->next;
+        if (s->filter)
+          t->n_filtered--;
+        t->dirty = 1;
+        group_free(s->group);
+        delta_free(s->delta);
+        free(s->filter);
+        free(s);
       } else {
         pp = &(*pp)->next;
       }
@@ -59,18 +263,199 @@ void event_unsubscribe_all(connection_t *conn) {
   }
 }
 
+// 同一条消息的同一种格式只编码一次，由使用该格式的所有订阅端共享
+static const char *encode_once(int format, const char *data, int *len) {
+  if (encoded[format].seq != publish_seq) {
+    int max = format_max_len(format, *len);
+    if (encoded[format].cap < max) {
+      encoded[format].cap = max;
+      encoded[format].buf = realloc(encoded[format].buf, max);
+    }
+    encoded[format].len =
+        format_encode(format, data, *len, encoded[format].buf);
+    encoded[format].seq = publish_seq;
+  }
+  *len = encoded[format].len;
+  return encoded[format].buf;
+}
+
+static void deliver(topic_t *t, subscriber_t *s, const char *data, int len,
+                    uint64_t ingest_ns) {
+  connection_t *conn =
+      s->group ? group_pick(s->group, data, len, ingest_ns) : s->conn;
+  if (!conn)
+    return;
+  if (s->spliced == splice_seq) {
+    // 管道里已有前 splice_off 字节，outbuf 此前为空，剩余部分紧随其后
+    data += s->splice_off;
+    len -= s->splice_off;
+    if (len == 0)
+      return;
+  } else if (s->delta) {
+    data = delta_encode(s->delta, conn->out_shed, data, len, &len);
+  } else if (s->format != FORMAT_RAW) {
+    data = encode_once(s->format, data, &len);
+  }
+  connection_append_msg(conn, t->prio, data, len, ingest_ns, t->latency);
+}
+
+// 把消息交给 mask 中置位的订阅端
+static void deliver_matches(topic_t *t, const uint64_t *mask,
+                            const char *data, int len, uint64_t ingest_ns) {
+  for (int w = 0; w * 64 < t->n_index; w++) {
+    uint64_t bits = mask[w];
+    while (bits) {
+      int i = w * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      deliver(t, t->index[i], data, len, ingest_ns);
+    }
+  }
+}
+
+/**
+ * Delivers a message only to the subscribers whose filter matches.
+ *
+ * The message is parsed once and compared against all subscribers of the
+ * topic at the same time; only matching ones get a copy.
+ */
+static void publish_filtered(topic_t *t, const char *data, int len,
+                             uint64_t ingest_ns) {
+  if (t->dirty)
+    rebuild_filters(t);
+  deliver_matches(t, filter_table_eval(t->table, data, len), data, len,
+                  ingest_ns);
+}
+
+static topic_t *find_topic(const char *name) {
+  for (topic_t *t = topics; t; t = t->next) {
+    if (strcmp(t->name, name) == 0)
+      return t;
+  }
+  return NULL;
+}
+
+static void publish_local(topic_t *t, const char *data, int len,
+                          uint64_t ingest_ns) {
+  publish_seq++; // 上一条消息的编码结果作废
+  if (t->n_filtered > 0) {
+    publish_filtered(t, data, len, ingest_ns);
+    return;
+  }
+  for (subscriber_t *s = t->subs; s; s = s->next)
+    deliver(t, s, data, len, ingest_ns);
+}
+
+// 能直接 tee 的订阅端：不需要看内容，且普通队列中没有更早的数据
+static int can_splice(const subscriber_t *s) {
+  const connection_t *c = s->conn;
+  return !s->filter && !s->group && !s->delta && s->format == FORMAT_RAW &&
+         !c->batch && c->state != CONN_STATE_CLOSING && c->out_len == 0 &&
+         c->pending_len == 0;
+}
+
+void event_publish_spliced(const char *topic, int len, uint64_t ingest_ns,
+                           char *buf) {
+  topic_t *t = forwarder ? NULL : find_topic(topic);
+  int need_copy = forwarder != NULL;
+  for (subscriber_t *s = t ? t->subs : NULL; s; s = s->next) {
+    if (!can_splice(s)) {
+      need_copy = 1;
+      continue;
+    }
+    int n = splice_tee(s->conn, len);
+    if (n > 0) {
+      s->spliced = splice_seq;
+      s->splice_off = n;
+      connection_enable_write(s->conn);
+    }
+    if (n < len)
+      need_copy = 1;
+  }
+
+  if (!need_copy) {
+    splice_discard(len);
+  } else {
+    len = splice_copy(buf, len);
+    if (forwarder)
+      forwarder(topic, buf, len, ingest_ns);
+    else if (len > 0)
+      publish_local(t, buf, len, ingest_ns);
+  }
+  splice_seq++; // 让本条消息的 spliced 标记失效
+}
+
 void event_publish(const char *topic, const char *data, int len) {
-  topic_t *t = topics;
-  while (t) {
-    if (strcmp(t->name, topic) == 0) {
-      subscriber_t *s = t->subs;
-      while (s) {
-        subscriber_t *next = s->next;
-        connection_append_out(s->conn, data, len);
-        s = s->next;
+  event_publish_at(topic, data, len, clock_now_ns());
+}
+
+void event_publish_at(const char *topic, const char *data, int len,
+                      uint64_t ingest_ns) {
+  if (forwarder) {
+    forwarder(topic, data, len, ingest_ns);
+    return;
+  }
+  topic_t *t = find_topic(topic);
+  if (t)
+    publish_local(t, data, len, ingest_ns);
+}
+
+void event_publish_batch(const char *topic, const event_msg_t *msgs, int n) {
+  if (forwarder) {
+    for (int m = 0; m < n; m++)
+      forwarder(topic, msgs[m].data, msgs[m].len, msgs[m].ingest_ns);
+    return;
+  }
+  topic_t *t = find_topic(topic);
+  if (!t)
+    return;
+  if (t->n_filtered == 0 || n == 1) {
+    for (int m = 0; m < n; m++)
+      publish_local(t, msgs[m].data, msgs[m].len, msgs[m].ingest_ns);
+    return;
+  }
+
+  // 投递只改变连接状态，不改变订阅，同一批内过滤表不变
+  if (t->dirty)
+    rebuild_filters(t);
+  const char *data[FILTER_BATCH_MAX];
+  int len[FILTER_BATCH_MAX];
+  int words = filter_table_words(t->table);
+  for (int off = 0; off < n; off += FILTER_BATCH_MAX) {
+    int k = n - off < FILTER_BATCH_MAX ? n - off : FILTER_BATCH_MAX;
+    for (int m = 0; m < k; m++) {
+      data[m] = msgs[off + m].data;
+      len[m] = msgs[off + m].len;
+    }
+    const uint64_t *masks = filter_table_eval_batch(t->table, data, len, k);
+    for (int m = 0; m < k; m++) {
+      publish_seq++; // 上一条消息的编码结果作废
+      deliver_matches(t, masks + m * words, data[m], len[m],
+                      msgs[off + m].ingest_ns);
+    }
+  }
+}
+
+int event_subscriptions(connection_t *conn, char *buf, int cap) {
+  int len = 0;
+  for (topic_t *t = topics; t; t = t->next) {
+    for (subscriber_t *s = t->subs; s; s = s->next) {
+      if (s->conn != conn && !(s->group && group_has(s->group, conn)))
+        continue;
+      // 格式与 SUB 命令一致："topic [GROUP name] [DELTA|FORMAT f] [filter]"
+      char entry[64 + 7 + GROUP_NAME_LEN + 12 + FILTER_EXPR_LEN + 1];
+      int n = snprintf(entry, sizeof(entry), "%s%s%s%s%s%s%s%s", t->name,
+                       s->group ? " GROUP " : "",
+                       s->group ? group_name(s->group) : "",
+                       s->delta ? " DELTA" : "",
+                       s->format != FORMAT_RAW ? " FORMAT " : "",
+                       s->format != FORMAT_RAW ? format_name(s->format) : "",
+                       s->filter ? " " : "", s->filter ? s->filter->expr : "");
+      if (len + n + 1 <= cap) {
+        memcpy(buf + len, entry, n + 1);
+        len += n + 1;
       }
-      return;
+      break;
     }
-    t = t->next;
   }
+  return len;
 }
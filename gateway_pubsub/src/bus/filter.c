@@ -0,0 +1,623 @@
+#include <bus/filter.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+struct filter_table {
+  int n;      // 订阅端数量
+  int padded; // n 向上取整到 8，便于整向量比较
+  int words;  // 掩码 uint64_t 个数
+
+  int n_fields;
+  char (*fields)[FILTER_FIELD_LEN];
+  float **lo; // lo[field][sub]
+  float **hi;
+  uint64_t **free_mask; // 对该字段没有约束的订阅端，字段缺失时仍然匹配
+
+  int has_ids;
+  uint64_t *any_id; // 没有设备 ID 限制的订阅端
+  int n_keys;
+  int32_t *id_keys;   // 升序，二分查找
+  uint64_t *id_masks; // n_keys * words
+
+  uint64_t *mask; // eval 结果
+  uint64_t *hits; // 单个字段的比较结果
+  float *values;  // 当前报文各字段的值，缺失为 NaN
+
+  // 批量评估：columns[f * FILTER_BATCH_MAX + m] 为第 m 条报文的字段 f
+  float *columns;
+  int32_t batch_ids[FILTER_BATCH_MAX];
+  int batch_has_id[FILTER_BATCH_MAX];
+  uint64_t *sub_ok;      // 每个订阅端一个字：匹配的报文
+  uint64_t *batch_masks; // FILTER_BATCH_MAX * words
+};
+
+/* ========== 表达式编译 ========== */
+
+// 返回相邻的可表示浮点数，用于把 > / < 转成闭区间
+static float float_step(float v, int up) {
+  union {
+    float f;
+    int32_t i;
+  } u = {v};
+  if (v == 0.0f) {
+    u.i = 1;
+    return up ? u.f : -u.f;
+  }
+  if ((v > 0) == (up != 0))
+    u.i++;
+  else
+    u.i--;
+  return u.f;
+}
+
+static filter_range_t *range_for(filter_t *f, const char *field, int len) {
+  for (int i = 0; i < f->n_ranges; i++) {
+    if ((int)strlen(f->ranges[i].field) == len &&
+        strncmp(f->ranges[i].field, field, len) == 0)
+      return &f->ranges[i];
+  }
+  if (f->n_ranges == FILTER_MAX_CLAUSES)
+    return NULL;
+
+  filter_range_t *r = &f->ranges[f->n_ranges++];
+  memcpy(r->field, field, len);
+  r->field[len] = 0;
+  r->lo = -INFINITY;
+  r->hi = INFINITY;
+  return r;
+}
+
+static int compile_ids(const char *s, const char *end, filter_t *f) {
+  while (s < end) {
+    char *next;
+    long id = strtol(s, &next, 10);
+    if (next == s || next > end || f->n_ids == FILTER_MAX_IDS)
+      return -1;
+    f->ids[f->n_ids++] = (int32_t)id;
+    s = next;
+    if (s < end && *s == ',')
+      s++;
+    else if (s != end)
+      return -1;
+  }
+  return f->n_ids > 0 ? 0 : -1;
+}
+
+static int compile_clause(const char *s, const char *end, filter_t *f) {
+  const char *op = s;
+  while (op < end && !strchr("<>=", *op))
+    op++;
+  int klen = op - s;
+  if (op == end || klen == 0 || klen >= FILTER_FIELD_LEN)
+    return -1;
+
+  char kind = *op++;
+  int inclusive = 0;
+  if (kind != '=' && op < end && *op == '=') {
+    inclusive = 1;
+    op++;
+  }
+
+  if (kind == '=' && klen == (int)strlen(FILTER_ID_FIELD) &&
+      strncmp(s, FILTER_ID_FIELD, klen) == 0)
+    return compile_ids(op, end, f);
+
+  char num[32];
+  int nlen = end - op;
+  if (nlen == 0 || nlen >= (int)sizeof(num))
+    return -1;
+  memcpy(num, op, nlen);
+  num[nlen] = 0;
+  char *num_end;
+  float v = strtof(num, &num_end);
+  if (*num_end != '\0' || isnan(v))
+    return -1;
+
+  filter_range_t *r = range_for(f, s, klen);
+  if (!r)
+    return -1;
+
+  float lo = -INFINITY, hi = INFINITY;
+  if (kind == '=') {
+    lo = hi = v;
+  } else if (kind == '>') {
+    lo = inclusive ? v : float_step(v, 1);
+  } else {
+    hi = inclusive ? v : float_step(v, 0);
+  }
+  // 同一字段的多个条件取交集
+  if (lo > r->lo)
+    r->lo = lo;
+  if (hi < r->hi)
+    r->hi = hi;
+  return 0;
+}
+
+int filter_compile(const char *expr, filter_t *f) {
+  memset(f, 0, sizeof(*f));
+  if (strlen(expr) >= sizeof(f->expr))
+    return -1;
+  strcpy(f->expr, expr);
+
+  const char *p = expr;
+  while (*p) {
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (!*p)
+      break;
+    const char *end = p + strcspn(p, " \t");
+    if (compile_clause(p, end, f) < 0)
+      return -1;
+    p = end;
+  }
+  return 0;
+}
+
+/* ========== 报文字段解析 ========== */
+
+/**
+ * Returns the next `key=value` token of a reading.
+ *
+ * @return 1 if a token was found, 0 at the end of the data.
+ */
+static int next_field(const char **p, const char *end, const char **key,
+                      int *klen, const char **val, int *vlen) {
+  const char *s = *p;
+  while (s < end) {
+    while (s < end && strchr(" ,;\t\r\n", *s))
+      s++;
+    const char *tok = s;
+    while (s < end && !strchr(" ,;\t\r\n", *s))
+      s++;
+    const char *eq = memchr(tok, '=', s - tok);
+    if (eq && eq > tok) {
+      *key = tok;
+      *klen = eq - tok;
+      *val = eq + 1;
+      *vlen = s - eq - 1;
+      *p = s;
+      return 1;
+    }
+  }
+  *p = s;
+  return 0;
+}
+
+static int parse_number(const char *val, int vlen, double *out) {
+  char num[32];
+  if (vlen <= 0 || vlen >= (int)sizeof(num))
+    return 0;
+  memcpy(num, val, vlen);
+  num[vlen] = 0;
+  char *end;
+  *out = strtod(num, &end);
+  return end != num && !isnan(*out);
+}
+
+int filter_next_number(const char **p, const char *end, const char **key,
+                       int *klen, double *value) {
+  const char *val;
+  int vlen;
+  while (next_field(p, end, key, klen, &val, &vlen)) {
+    if (parse_number(val, vlen, value))
+      return 1;
+  }
+  return 0;
+}
+
+int filter_field_value(const char *data, int len, const char *name,
+                       double *value) {
+  const char *p = data, *key, *val;
+  int klen, vlen;
+  int nlen = strlen(name);
+  while (next_field(&p, data + len, &key, &klen, &val, &vlen)) {
+    if (klen == nlen && memcmp(key, name, nlen) == 0)
+      return parse_number(val, vlen, value);
+  }
+  return 0;
+}
+
+/* ========== 向量化区间比较 ========== */
+
+typedef void (*range_kernel_t)(const float *lo, const float *hi, float v,
+                               int n, uint64_t *out);
+
+// n 为 8 的倍数；out 需预先清零
+static void range_mask_scalar(const float *lo, const float *hi, float v,
+                              int n, uint64_t *out) {
+  for (int i = 0; i < n; i++) {
+    if (v >= lo[i] && v <= hi[i])
+      out[i >> 6] |= 1ull << (i & 63);
+  }
+}
+
+#ifdef __SSE2__
+static void range_mask_sse2(const float *lo, const float *hi, float v, int n,
+                            uint64_t *out) {
+  __m128 vv = _mm_set1_ps(v);
+  for (int i = 0; i < n; i += 4) {
+    __m128 ge = _mm_cmpge_ps(vv, _mm_loadu_ps(lo + i));
+    __m128 le = _mm_cmple_ps(vv, _mm_loadu_ps(hi + i));
+    uint64_t bits = _mm_movemask_ps(_mm_and_ps(ge, le));
+    out[i >> 6] |= bits << (i & 63);
+  }
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void
+range_mask_avx2(const float *lo, const float *hi, float v, int n,
+                uint64_t *out) {
+  __m256 vv = _mm256_set1_ps(v);
+  for (int i = 0; i < n; i += 8) {
+    __m256 ge = _mm256_cmp_ps(vv, _mm256_loadu_ps(lo + i), _CMP_GE_OQ);
+    __m256 le = _mm256_cmp_ps(vv, _mm256_loadu_ps(hi + i), _CMP_LE_OQ);
+    uint64_t bits = _mm256_movemask_ps(_mm256_and_ps(ge, le));
+    out[i >> 6] |= bits << (i & 63);
+  }
+}
+#endif
+
+/*
+ * Batch kernels compare the values of one field across up to 64 messages
+ * with one subscriber's range. n is a multiple of 8; missing fields are NaN
+ * and never match. Returns bit m set for each matching message.
+ */
+typedef uint64_t (*batch_kernel_t)(const float *v, int n, float lo, float hi);
+
+static uint64_t batch_mask_scalar(const float *v, int n, float lo, float hi) {
+  uint64_t bits = 0;
+  for (int i = 0; i < n; i++) {
+    if (v[i] >= lo && v[i] <= hi)
+      bits |= 1ull << i;
+  }
+  return bits;
+}
+
+#ifdef __SSE2__
+static uint64_t batch_mask_sse2(const float *v, int n, float lo, float hi) {
+  __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+  uint64_t bits = 0;
+  for (int i = 0; i < n; i += 4) {
+    __m128 x = _mm_loadu_ps(v + i);
+    __m128 in = _mm_and_ps(_mm_cmpge_ps(x, vlo), _mm_cmple_ps(x, vhi));
+    bits |= (uint64_t)_mm_movemask_ps(in) << i;
+  }
+  return bits;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static uint64_t
+batch_mask_avx2(const float *v, int n, float lo, float hi) {
+  __m256 vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+  uint64_t bits = 0;
+  for (int i = 0; i < n; i += 8) {
+    __m256 x = _mm256_loadu_ps(v + i);
+    __m256 in = _mm256_and_ps(_mm256_cmp_ps(x, vlo, _CMP_GE_OQ),
+                              _mm256_cmp_ps(x, vhi, _CMP_LE_OQ));
+    bits |= (uint64_t)_mm256_movemask_ps(in) << i;
+  }
+  return bits;
+}
+#endif
+
+static range_kernel_t range_kernel(void) {
+  static range_kernel_t kernel = NULL;
+  if (kernel)
+    return kernel;
+
+  kernel = range_mask_scalar;
+#ifdef __SSE2__
+  kernel = range_mask_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    kernel = range_mask_avx2;
+#endif
+  return kernel;
+}
+
+static batch_kernel_t batch_kernel(void) {
+  static batch_kernel_t kernel = NULL;
+  if (kernel)
+    return kernel;
+
+  kernel = batch_mask_scalar;
+#ifdef __SSE2__
+  kernel = batch_mask_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    kernel = batch_mask_avx2;
+#endif
+  return kernel;
+}
+
+/* ========== 过滤表 ========== */
+
+static void set_bit(uint64_t *mask, int i) { mask[i >> 6] |= 1ull << (i & 63); }
+
+static int field_index(filter_table_t *t, const char *field) {
+  for (int i = 0; i < t->n_fields; i++) {
+    if (strcmp(t->fields[i], field) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int cmp_pair(const void *a, const void *b) {
+  const int32_t *x = a, *y = b;
+  if (x[0] != y[0])
+    return x[0] < y[0] ? -1 : 1;
+  return x[1] - y[1];
+}
+
+static void build_ids(filter_table_t *t, filter_t *const *filters) {
+  int total = 0;
+  for (int i = 0; i < t->n; i++) {
+    if (filters[i])
+      total += filters[i]->n_ids;
+  }
+  t->has_ids = total > 0;
+  if (!t->has_ids)
+    return;
+
+  // (id, 订阅端) 对排序后合并成 id -> 订阅端掩码
+  int32_t *pairs = malloc(sizeof(int32_t) * 2 * total);
+  int k = 0;
+  for (int i = 0; i < t->n; i++) {
+    if (!filters[i] || filters[i]->n_ids == 0) {
+      set_bit(t->any_id, i);
+      continue;
+    }
+    for (int j = 0; j < filters[i]->n_ids; j++) {
+      pairs[k++] = filters[i]->ids[j];
+      pairs[k++] = i;
+    }
+  }
+  qsort(pairs, total, sizeof(int32_t) * 2, cmp_pair);
+
+  t->id_keys = malloc(sizeof(int32_t) * total);
+  t->id_masks = calloc((size_t)total * t->words, sizeof(uint64_t));
+  for (int p = 0; p < total; p++) {
+    int32_t id = pairs[2 * p];
+    if (t->n_keys == 0 || t->id_keys[t->n_keys - 1] != id)
+      t->id_keys[t->n_keys++] = id;
+    set_bit(t->id_masks + (size_t)(t->n_keys - 1) * t->words, pairs[2 * p + 1]);
+  }
+  free(pairs);
+}
+
+filter_table_t *filter_table_build(filter_t *const *filters, int n) {
+  filter_table_t *t = calloc(1, sizeof(filter_table_t));
+  t->n = n;
+  t->padded = (n + 7) & ~7;
+  t->words = (n + 63) / 64;
+  if (t->words == 0)
+    t->words = 1;
+
+  int max_fields = 0;
+  for (int i = 0; i < n; i++) {
+    if (filters[i])
+      max_fields += filters[i]->n_ranges;
+  }
+  t->fields = calloc(max_fields ? max_fields : 1, FILTER_FIELD_LEN);
+  t->lo = calloc(max_fields ? max_fields : 1, sizeof(float *));
+  t->hi = calloc(max_fields ? max_fields : 1, sizeof(float *));
+  t->free_mask = calloc(max_fields ? max_fields : 1, sizeof(uint64_t *));
+
+  for (int i = 0; i < n; i++) {
+    for (int r = 0; filters[i] && r < filters[i]->n_ranges; r++) {
+      const filter_range_t *range = &filters[i]->ranges[r];
+      int f = field_index(t, range->field);
+      if (f < 0) {
+        f = t->n_fields++;
+        strcpy(t->fields[f], range->field);
+        t->lo[f] = malloc(sizeof(float) * t->padded);
+        t->hi[f] = malloc(sizeof(float) * t->padded);
+        t->free_mask[f] = calloc(t->words, sizeof(uint64_t));
+        for (int j = 0; j < t->padded; j++) {
+          // 默认不限制；补齐部分设为空区间
+          t->lo[f][j] = j < n ? -INFINITY : INFINITY;
+          t->hi[f][j] = j < n ? INFINITY : -INFINITY;
+          if (j < n)
+            set_bit(t->free_mask[f], j);
+        }
+      }
+      t->lo[f][i] = range->lo;
+      t->hi[f][i] = range->hi;
+      t->free_mask[f][i >> 6] &= ~(1ull << (i & 63));
+    }
+  }
+
+  t->any_id = calloc(t->words, sizeof(uint64_t));
+  build_ids(t, filters);
+
+  t->mask = calloc(t->words, sizeof(uint64_t));
+  t->hits = calloc(t->words, sizeof(uint64_t));
+  t->values = calloc(t->n_fields ? t->n_fields : 1, sizeof(float));
+  t->columns = calloc((size_t)(t->n_fields ? t->n_fields : 1) *
+                          FILTER_BATCH_MAX,
+                      sizeof(float));
+  t->sub_ok = calloc(n ? n : 1, sizeof(uint64_t));
+  t->batch_masks = calloc((size_t)FILTER_BATCH_MAX * t->words,
+                          sizeof(uint64_t));
+  return t;
+}
+
+void filter_table_free(filter_table_t *t) {
+  if (!t)
+    return;
+  for (int f = 0; f < t->n_fields; f++) {
+    free(t->lo[f]);
+    free(t->hi[f]);
+    free(t->free_mask[f]);
+  }
+  free(t->fields);
+  free(t->lo);
+  free(t->hi);
+  free(t->free_mask);
+  free(t->any_id);
+  free(t->id_keys);
+  free(t->id_masks);
+  free(t->mask);
+  free(t->hits);
+  free(t->values);
+  free(t->columns);
+  free(t->sub_ok);
+  free(t->batch_masks);
+  free(t);
+}
+
+static const uint64_t *lookup_id(const filter_table_t *t, int32_t id) {
+  int lo = 0, hi = t->n_keys - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (t->id_keys[mid] == id)
+      return t->id_masks + (size_t)mid * t->words;
+    if (t->id_keys[mid] < id)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return NULL;
+}
+
+int filter_table_words(const filter_table_t *t) { return t->words; }
+
+/**
+ * Parses the fields the table compares, each once, into values[f * stride];
+ * missing fields become NaN.
+ *
+ * @return 1 if the message carries a device id, stored in *id.
+ */
+static int parse_fields(const filter_table_t *t, const char *data, int len,
+                        float *values, int stride, int32_t *id) {
+  int have_id = 0;
+  for (int f = 0; f < t->n_fields; f++)
+    values[f * stride] = NAN;
+
+  const char *p = data, *key, *val;
+  int klen, vlen;
+  while (next_field(&p, data + len, &key, &klen, &val, &vlen)) {
+    double v;
+    if (t->has_ids && klen == (int)strlen(FILTER_ID_FIELD) &&
+        memcmp(key, FILTER_ID_FIELD, klen) == 0 &&
+        parse_number(val, vlen, &v)) {
+      have_id = 1;
+      *id = (int32_t)v;
+    }
+    for (int f = 0; f < t->n_fields; f++) {
+      if (isnan(values[f * stride]) && (int)strlen(t->fields[f]) == klen &&
+          memcmp(t->fields[f], key, klen) == 0 && parse_number(val, vlen, &v))
+        values[f * stride] = (float)v;
+    }
+  }
+  return have_id;
+}
+
+// 对已解析的一条报文逐字段比较所有订阅端，结果写入 mask
+static void eval_parsed(filter_table_t *t, const float *values, int stride,
+                        int have_id, int32_t id, uint64_t *mask) {
+  for (int w = 0; w < t->words; w++)
+    mask[w] = ~0ull;
+  if (t->n & 63)
+    mask[t->words - 1] = (1ull << (t->n & 63)) - 1;
+
+  range_kernel_t kernel = range_kernel();
+  for (int f = 0; f < t->n_fields; f++) {
+    float v = values[f * stride];
+    if (isnan(v)) {
+      for (int w = 0; w < t->words; w++)
+        mask[w] &= t->free_mask[f][w];
+      continue;
+    }
+    memset(t->hits, 0, sizeof(uint64_t) * t->words);
+    kernel(t->lo[f], t->hi[f], v, t->padded, t->hits);
+    for (int w = 0; w < t->words; w++)
+      mask[w] &= t->hits[w];
+  }
+
+  if (t->has_ids) {
+    const uint64_t *ids = have_id ? lookup_id(t, id) : NULL;
+    for (int w = 0; w < t->words; w++)
+      mask[w] &= t->any_id[w] | (ids ? ids[w] : 0);
+  }
+}
+
+const uint64_t *filter_table_eval(filter_table_t *t, const char *data,
+                                  int len) {
+  // 先把报文解析一遍，每个字段只解析一次，与订阅端数量无关
+  int32_t id = 0;
+  int have_id = parse_fields(t, data, len, t->values, 1, &id);
+  eval_parsed(t, t->values, 1, have_id, id, t->mask);
+  return t->mask;
+}
+
+/**
+ * Compares every subscriber's ranges with a whole batch at once: one kernel
+ * call per (subscriber, field) covers all messages. Used when the batch is
+ * larger than the subscriber count, so vector lanes are not spent on
+ * padding.
+ */
+static void eval_across_messages(filter_table_t *t, int n) {
+  batch_kernel_t kernel = batch_kernel();
+  int padded = (n + 7) & ~7;
+  uint64_t all = n == 64 ? ~0ull : (1ull << n) - 1;
+  for (int s = 0; s < t->n; s++) {
+    uint64_t ok = all;
+    for (int f = 0; f < t->n_fields && ok; f++) {
+      if (t->free_mask[f][s >> 6] & (1ull << (s & 63)))
+        continue;
+      ok &= kernel(t->columns + f * FILTER_BATCH_MAX, padded, t->lo[f][s],
+                   t->hi[f][s]);
+    }
+    t->sub_ok[s] = ok;
+  }
+
+  // 按订阅端的结果转置成每条报文的掩码
+  memset(t->batch_masks, 0, sizeof(uint64_t) * n * t->words);
+  for (int s = 0; s < t->n; s++) {
+    for (uint64_t bits = t->sub_ok[s]; bits; bits &= bits - 1) {
+      int m = __builtin_ctzll(bits);
+      t->batch_masks[m * t->words + (s >> 6)] |= 1ull << (s & 63);
+    }
+  }
+  if (!t->has_ids)
+    return;
+  for (int m = 0; m < n; m++) {
+    const uint64_t *ids =
+        t->batch_has_id[m] ? lookup_id(t, t->batch_ids[m]) : NULL;
+    uint64_t *mask = t->batch_masks + m * t->words;
+    for (int w = 0; w < t->words; w++)
+      mask[w] &= t->any_id[w] | (ids ? ids[w] : 0);
+  }
+}
+
+const uint64_t *filter_table_eval_batch(filter_table_t *t,
+                                        const char *const *data,
+                                        const int *len, int n) {
+  for (int m = 0; m < n; m++)
+    t->batch_has_id[m] = parse_fields(t, data[m], len[m], t->columns + m,
+                                      FILTER_BATCH_MAX, &t->batch_ids[m]);
+  // 补齐到 8 的部分不匹配任何区间
+  for (int f = 0; f < t->n_fields; f++) {
+    for (int m = n; m < ((n + 7) & ~7); m++)
+      t->columns[f * FILTER_BATCH_MAX + m] = NAN;
+  }
+
+  if (n > t->padded) {
+    eval_across_messages(t, n);
+  } else {
+    for (int m = 0; m < n; m++)
+      eval_parsed(t, t->columns + m, FILTER_BATCH_MAX, t->batch_has_id[m],
+                  t->batch_ids[m], t->batch_masks + m * t->words);
+  }
+  return t->batch_masks;
+}
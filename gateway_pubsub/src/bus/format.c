@@ -0,0 +1,138 @@
+#include <bus/format.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *names[FORMAT_COUNT] = {"raw", "json", "csv"};
+
+int format_parse(const char *name, int len) {
+  for (int f = 0; f < FORMAT_COUNT; f++) {
+    if ((int)strlen(names[f]) == len && strncmp(name, names[f], len) == 0)
+      return f;
+  }
+  return -1;
+}
+
+const char *format_name(int format) {
+  return format >= 0 && format < FORMAT_COUNT ? names[format] : "?";
+}
+
+int format_max_len(int format, int len) {
+  // JSON 中控制字符转义为 \u00XX，最坏情况每个字节 6 倍；CSV 引号加倍
+  return format == FORMAT_JSON ? 6 * len + 8 : 3 * len + 2;
+}
+
+static int is_sep(char c) {
+  return c == ' ' || c == ',' || c == ';' || c == '\t' || c == '\r' ||
+         c == '\n';
+}
+
+static int skip_digits(const char *s, int i, int len) {
+  while (i < len && s[i] >= '0' && s[i] <= '9')
+    i++;
+  return i;
+}
+
+// 符合 JSON 数字语法的值原样输出，否则作为字符串（如 "03"、"0x1f"）
+static int is_number(const char *s, int len) {
+  int i = 0;
+  if (i < len && s[i] == '-')
+    i++;
+  if (i == len || s[i] < '0' || s[i] > '9')
+    return 0;
+  i = s[i] == '0' ? i + 1 : skip_digits(s, i, len);
+  if (i < len && s[i] == '.') {
+    int start = ++i;
+    i = skip_digits(s, i, len);
+    if (i == start)
+      return 0;
+  }
+  if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+    i++;
+    if (i < len && (s[i] == '+' || s[i] == '-'))
+      i++;
+    int start = i;
+    i = skip_digits(s, i, len);
+    if (i == start)
+      return 0;
+  }
+  return i == len;
+}
+
+static int json_string(char *out, const char *s, int len) {
+  int n = 0;
+  out[n++] = '"';
+  for (int i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out[n++] = '\\';
+      out[n++] = c;
+    } else if (c < 0x20) {
+      n += sprintf(out + n, "\\u%04x", c);
+    } else {
+      out[n++] = c;
+    }
+  }
+  out[n++] = '"';
+  return n;
+}
+
+// RFC 4180：含引号的值整体加引号，内部引号写两次
+static int csv_quoted(char *out, const char *s, int len) {
+  int n = 0;
+  out[n++] = '"';
+  for (int i = 0; i < len; i++) {
+    if (s[i] == '"')
+      out[n++] = '"';
+    out[n++] = s[i];
+  }
+  out[n++] = '"';
+  return n;
+}
+
+int format_encode(int format, const char *data, int len, char *out) {
+  if (format == FORMAT_RAW) {
+    memcpy(out, data, len);
+    return len;
+  }
+
+  const char *p = data, *end = data + len;
+  int n = 0, fields = 0;
+  if (format == FORMAT_JSON)
+    out[n++] = '{';
+  while (1) {
+    while (p < end && is_sep(*p))
+      p++;
+    if (p == end)
+      break;
+    const char *s = p;
+    while (p < end && !is_sep(*p))
+      p++;
+    const char *eq = memchr(s, '=', p - s);
+    if (!eq)
+      continue; // 不是 key=value 的片段
+    const char *val = eq + 1;
+    int vlen = p - val;
+
+    if (fields++)
+      out[n++] = ',';
+    if (format == FORMAT_JSON) {
+      n += json_string(out + n, s, eq - s);
+      out[n++] = ':';
+      if (is_number(val, vlen)) {
+        memcpy(out + n, val, vlen);
+        n += vlen;
+      } else {
+        n += json_string(out + n, val, vlen);
+      }
+    } else if (memchr(val, '"', vlen)) {
+      n += csv_quoted(out + n, val, vlen);
+    } else {
+      memcpy(out + n, val, vlen);
+      n += vlen;
+    }
+  }
+  if (format == FORMAT_JSON)
+    out[n++] = '}';
+  out[n++] = '\n';
+  return n;
+}
@@ -0,0 +1,181 @@
+#include <bus/filter.h>
+#include <bus/group.h>
+#include <core/config.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { GROUP_RR, GROUP_LEAST, GROUP_HASH } group_policy_t;
+
+// 同名组在各 fan-out 线程之间共享的部分
+typedef struct group_shard {
+  char topic[64];
+  char name[GROUP_NAME_LEN];
+  uint64_t threads; // 有成员的 fan-out 线程位图，原子访问
+  struct group_shard *next;
+} group_shard_t;
+
+struct group {
+  char name[GROUP_NAME_LEN];
+  connection_t **members;
+  int n_members;
+  int cap_members;
+  unsigned rr;
+  group_shard_t *shard; // 非 pipeline 模式为 NULL
+};
+
+static group_shard_t *shards = NULL;
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int shard_index = -1;
+static int policy = -1;
+
+static int group_policy(void) {
+  if (policy < 0) {
+    const char *s = config_get_str("GATEWAY_GROUP_POLICY", "rr");
+    if (strcmp(s, "least") == 0)
+      policy = GROUP_LEAST;
+    else if (strcmp(s, "hash") == 0)
+      policy = GROUP_HASH;
+    else
+      policy = GROUP_RR;
+  }
+  return policy;
+}
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+void group_set_shard(int index) { shard_index = index; }
+
+static group_shard_t *shard_get(const char *topic, const char *name) {
+  pthread_mutex_lock(&shards_lock);
+  group_shard_t *s = shards;
+  while (s && (strcmp(s->topic, topic) != 0 || strcmp(s->name, name) != 0))
+    s = s->next;
+  if (!s) {
+    s = calloc(1, sizeof(group_shard_t));
+    strncpy(s->topic, topic, sizeof(s->topic) - 1);
+    strncpy(s->name, name, sizeof(s->name) - 1);
+    s->next = shards;
+    shards = s;
+  }
+  pthread_mutex_unlock(&shards_lock);
+  return s;
+}
+
+group_t *group_create(const char *topic, const char *name) {
+  group_t *g = calloc(1, sizeof(group_t));
+  strncpy(g->name, name, sizeof(g->name) - 1);
+  if (shard_index >= 0) {
+    g->shard = shard_get(topic, name);
+    __atomic_fetch_or(&g->shard->threads, 1ull << shard_index,
+                      __ATOMIC_RELAXED);
+  }
+  return g;
+}
+
+void group_free(group_t *g) {
+  if (!g)
+    return;
+  if (g->shard)
+    __atomic_fetch_and(&g->shard->threads, ~(1ull << shard_index),
+                       __ATOMIC_RELAXED);
+  free(g->members);
+  free(g);
+}
+
+const char *group_name(const group_t *g) { return g->name; }
+
+int group_has(const group_t *g, const connection_t *conn) {
+  for (int i = 0; i < g->n_members; i++) {
+    if (g->members[i] == conn)
+      return 1;
+  }
+  return 0;
+}
+
+void group_join(group_t *g, connection_t *conn) {
+  if (group_has(g, conn))
+    return;
+  if (g->n_members == g->cap_members) {
+    g->cap_members = g->cap_members ? g->cap_members * 2 : 4;
+    g->members = realloc(g->members, sizeof(connection_t *) * g->cap_members);
+  }
+  g->members[g->n_members++] = conn;
+}
+
+int group_leave(group_t *g, connection_t *conn) {
+  for (int i = 0; i < g->n_members; i++) {
+    if (g->members[i] == conn) {
+      g->members[i] = g->members[--g->n_members];
+      break;
+    }
+  }
+  return g->n_members;
+}
+
+// pipeline 模式下判断本线程是否负责投递 key 对应的消息
+static int owns(const group_t *g, uint64_t key) {
+  uint64_t mask = __atomic_load_n(&g->shard->threads, __ATOMIC_RELAXED);
+  int k = __builtin_popcountll(mask);
+  if (k <= 1)
+    return 1;
+  for (int nth = key % k; nth > 0; nth--)
+    mask &= mask - 1;
+  return __builtin_ctzll(mask) == shard_index;
+}
+
+connection_t *group_pick(group_t *g, const char *data, int len,
+                         uint64_t ingest_ns) {
+  if (g->n_members == 0)
+    return NULL;
+
+  int pol = group_policy();
+  double id;
+  int sticky = pol == GROUP_HASH &&
+               filter_field_value(data, len, FILTER_ID_FIELD, &id);
+  uint64_t key = mix64(sticky ? (uint64_t)(int64_t)id : ingest_ns);
+  if (g->shard && !owns(g, key))
+    return NULL;
+
+  if (sticky) {
+    // rendezvous hash：成员增减时只有少数设备换到别的成员
+    connection_t *best = NULL;
+    uint64_t best_score = 0;
+    for (int i = 0; i < g->n_members; i++) {
+      if (g->members[i]->state != CONN_STATE_OPEN)
+        continue;
+      uint64_t score = mix64(key ^ (uint64_t)g->members[i]->fd);
+      if (!best || score > best_score) {
+        best = g->members[i];
+        best_score = score;
+      }
+    }
+    return best;
+  }
+
+  // 从轮询位置开始找，排队字节数相同时也能分散开
+  unsigned start = g->rr++;
+  connection_t *best = NULL;
+  int best_queued = 0;
+  for (int i = 0; i < g->n_members; i++) {
+    connection_t *c = g->members[(start + i) % g->n_members];
+    if (c->state != CONN_STATE_OPEN)
+      continue; // 正在断开的成员不再分配消息
+    if (pol != GROUP_LEAST)
+      return c;
+    int queued = c->out_len + c->pending_len;
+    if (!best || queued < best_queued) {
+      best = c;
+      best_queued = queued;
+    }
+  }
+  return best;
+}
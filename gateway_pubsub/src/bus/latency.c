@@ -0,0 +1,122 @@
+#include <bus/latency.h>
+#include <core/budget.h>
+#include <core/connection.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+typedef struct latency_entry {
+  char topic[64];
+  histogram_t hist;
+  struct latency_entry *next;
+} latency_entry_t;
+
+// 注册表只在新建主题时加锁，记录延迟不加锁
+static latency_entry_t *entries = NULL;
+static pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+histogram_t *latency_histogram(const char *topic) {
+  latency_entry_t *e = calloc(1, sizeof(latency_entry_t));
+  strncpy(e->topic, topic, sizeof(e->topic) - 1);
+
+  pthread_mutex_lock(&entries_lock);
+  e->next = entries;
+  entries = e;
+  pthread_mutex_unlock(&entries_lock);
+  return &e->hist;
+}
+
+int latency_report(char *buf, int cap) {
+  int len = 0;
+  buf[0] = 0;
+  histogram_t *merged = malloc(sizeof(histogram_t));
+
+  pthread_mutex_lock(&entries_lock);
+  for (latency_entry_t *e = entries; e; e = e->next) {
+    // 同名主题只在第一次出现时输出（合并所有线程的直方图）
+    int seen = 0;
+    for (latency_entry_t *p = entries; p != e; p = p->next) {
+      if (strcmp(p->topic, e->topic) == 0) {
+        seen = 1;
+        break;
+      }
+    }
+    if (seen)
+      continue;
+
+    hist_reset(merged);
+    for (latency_entry_t *p = e; p; p = p->next) {
+      if (strcmp(p->topic, e->topic) == 0)
+        hist_merge(merged, &p->hist);
+    }
+
+    int n = snprintf(buf + len, cap - len,
+                     "latency topic=%s count=%llu p50=%.1fus p90=%.1fus "
+                     "p99=%.1fus p999=%.1fus max=%.1fus\n",
+                     e->topic, (unsigned long long)merged->count,
+                     hist_percentile(merged, 50) / 1e3,
+                     hist_percentile(merged, 90) / 1e3,
+                     hist_percentile(merged, 99) / 1e3,
+                     hist_percentile(merged, 99.9) / 1e3, merged->max / 1e3);
+    if (n < 0 || n >= cap - len) {
+      buf[len] = 0;
+      break;
+    }
+    len += n;
+  }
+  pthread_mutex_unlock(&entries_lock);
+
+  free(merged);
+  return len;
+}
+
+static void handle_signal(connection_t *conn) {
+  struct signalfd_siginfo info;
+  while (read(conn->fd, &info, sizeof(info)) == sizeof(info)) {
+    char report[8192];
+    int len = latency_report(report, sizeof(report));
+    len += event_loop_report(report + len, sizeof(report) - len);
+    budget_report(report + len, sizeof(report) - len);
+    fputs(report, stdout);
+    fflush(stdout);
+  }
+}
+
+static connection_t *signal_conn = NULL;
+
+void latency_signal_init(event_loop_t *loop) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  // 之后创建的线程继承该屏蔽字，信号只会经由 signalfd 送达
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    perror("signalfd");
+    return;
+  }
+
+  connection_t *conn = calloc(1, sizeof(connection_t));
+  conn->fd = fd;
+  conn->loop = loop;
+  conn->on_read = handle_signal;
+  event_loop_name_callback(handle_signal, "signal");
+  conn->events = EPOLLIN;
+  event_loop_add(loop, fd, conn->events, conn);
+  signal_conn = conn;
+}
+
+void latency_signal_release(void) {
+  if (!signal_conn)
+    return;
+  event_loop_del(signal_conn->loop, signal_conn->fd);
+  close(signal_conn->fd);
+  free(signal_conn);
+  signal_conn = NULL;
+}
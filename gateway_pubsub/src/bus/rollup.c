@@ -0,0 +1,277 @@
+#include <bus/event_bus.h>
+#include <bus/filter.h>
+#include <bus/rollup.h>
+#include <core/clock.h>
+#include <core/config.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_DEVICE_ID INT32_MIN // 报文中没有 id 字段
+#define MAX_READING_FIELDS 16  // 单条报文最多解析的数值字段
+
+// 一行聚合的最大长度："id=<int>"，每个字段四列 " <name>.mean=<%g>"，
+// 字段名最长 FILTER_FIELD_LEN - 1，%g 最长 13 个字符，%u 最长 10 个
+#define COLUMN_TEXT_MAX (1 + FILTER_FIELD_LEN + 6 + 13)
+#define LINE_TEXT_MAX (16 + ROLLUP_MAX_FIELDS * 4 * COLUMN_TEXT_MAX + 2)
+
+// 一个窗口内某台设备的聚合值，按字段分列存放
+typedef struct {
+  uint32_t count[ROLLUP_MAX_FIELDS];
+  float min[ROLLUP_MAX_FIELDS];
+  float max[ROLLUP_MAX_FIELDS];
+  double sum[ROLLUP_MAX_FIELDS];
+} rollup_cols_t;
+
+typedef struct {
+  int32_t id;
+  int n_fields;
+  char fields[ROLLUP_MAX_FIELDS][FILTER_FIELD_LEN];
+  rollup_cols_t win[ROLLUP_MAX_WINDOWS];
+} device_t;
+
+typedef struct {
+  int index; // 在 device_t.win 中的下标
+  uint64_t period_ms;
+  char topic[32];
+} window_t;
+
+static __thread window_t windows[ROLLUP_MAX_WINDOWS];
+static __thread int n_windows = 0;
+static __thread event_loop_t *rollup_loop = NULL;
+
+static __thread device_t *devices = NULL;
+static __thread int n_devices = 0;
+static __thread int cap_devices = 0;
+// 开放寻址哈希表：设备 id -> devices 下标 + 1，0 表示空槽
+static __thread int *slots = NULL;
+static __thread int n_slots = 0;
+
+// 所有 ingest 线程合计，供 STATS 使用
+static int enabled = 0;
+static int tracked = 0;       // 正在聚合的设备数
+static uint64_t untracked = 0; // 设备表已满或分配失败而未聚合的报文数
+
+static uint32_t hash_id(int32_t id) { return (uint32_t)id * 2654435761u; }
+
+static int rehash(int size) {
+  int *table = calloc(size, sizeof(int));
+  if (!table) {
+    perror("rollup calloc");
+    return -1;
+  }
+  free(slots);
+  slots = table;
+  n_slots = size;
+  for (int i = 0; i < n_devices; i++) {
+    uint32_t h = hash_id(devices[i].id) & (size - 1);
+    while (slots[h])
+      h = (h + 1) & (size - 1);
+    slots[h] = i + 1;
+  }
+  return 0;
+}
+
+// 返回设备的聚合状态；设备表已满时返回 NULL，该报文不参与聚合
+static device_t *device_get(int32_t id) {
+  if (n_slots == 0 && rehash(64) < 0)
+    goto untracked;
+  uint32_t h = hash_id(id) & (n_slots - 1);
+  while (slots[h]) {
+    device_t *d = &devices[slots[h] - 1];
+    if (d->id == id)
+      return d;
+    h = (h + 1) & (n_slots - 1);
+  }
+
+  if (n_devices == ROLLUP_MAX_DEVICES) {
+    if (__atomic_fetch_add(&untracked, 1, __ATOMIC_RELAXED) == 0)
+      printf("rollup: more than %d devices, new ones are not aggregated\n",
+             ROLLUP_MAX_DEVICES);
+    return NULL;
+  }
+  if ((n_devices + 1) * 2 > n_slots) { // 负载因子保持在 1/2 以下
+    if (rehash(n_slots * 2) < 0)
+      goto untracked;
+    h = hash_id(id) & (n_slots - 1);
+    while (slots[h])
+      h = (h + 1) & (n_slots - 1);
+  }
+  if (n_devices == cap_devices) {
+    int cap = cap_devices ? cap_devices * 2 : 64;
+    device_t *grown = realloc(devices, sizeof(device_t) * cap);
+    if (!grown) {
+      perror("rollup realloc");
+      goto untracked;
+    }
+    devices = grown;
+    cap_devices = cap;
+  }
+  device_t *d = &devices[n_devices++];
+  memset(d, 0, sizeof(*d));
+  d->id = id;
+  slots[h] = n_devices;
+  __atomic_fetch_add(&tracked, 1, __ATOMIC_RELAXED);
+  return d;
+
+untracked:
+  __atomic_fetch_add(&untracked, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static int field_slot(device_t *d, const char *key, int klen) {
+  for (int f = 0; f < d->n_fields; f++) {
+    if (strncmp(d->fields[f], key, klen) == 0 && d->fields[f][klen] == 0)
+      return f;
+  }
+  if (d->n_fields == ROLLUP_MAX_FIELDS || klen >= FILTER_FIELD_LEN)
+    return -1;
+  memcpy(d->fields[d->n_fields], key, klen);
+  d->fields[d->n_fields][klen] = 0;
+  return d->n_fields++;
+}
+
+void rollup_record(const char *data, int len) {
+  if (n_windows == 0)
+    return;
+
+  // 单次扫描收集所有数值字段，id 可能出现在任意位置
+  const char *keys[MAX_READING_FIELDS];
+  int klens[MAX_READING_FIELDS];
+  double values[MAX_READING_FIELDS];
+  int n = 0;
+  int32_t id = NO_DEVICE_ID;
+
+  const char *p = data, *key;
+  int klen;
+  double v;
+  while (n < MAX_READING_FIELDS &&
+         filter_next_number(&p, data + len, &key, &klen, &v)) {
+    if (klen == (int)strlen(FILTER_ID_FIELD) &&
+        memcmp(key, FILTER_ID_FIELD, klen) == 0) {
+      id = (int32_t)v;
+      continue;
+    }
+    keys[n] = key;
+    klens[n] = klen;
+    values[n++] = v;
+  }
+  if (n == 0)
+    return;
+
+  device_t *d = device_get(id);
+  if (!d)
+    return;
+  for (int i = 0; i < n; i++) {
+    int f = field_slot(d, keys[i], klens[i]);
+    if (f < 0)
+      continue;
+    float fv = (float)values[i];
+    for (int w = 0; w < n_windows; w++) {
+      rollup_cols_t *c = &d->win[w];
+      if (c->count[f]++ == 0) {
+        c->min[f] = c->max[f] = fv;
+        c->sum[f] = values[i];
+        continue;
+      }
+      if (fv < c->min[f])
+        c->min[f] = fv;
+      if (fv > c->max[f])
+        c->max[f] = fv;
+      c->sum[f] += values[i];
+    }
+  }
+}
+
+// 格式化一台设备在窗口内的聚合行，窗口内没有数据时返回 0
+static int format_device(device_t *d, rollup_cols_t *c, char *buf, int cap) {
+  int len = 0, any = 0;
+  if (d->id != NO_DEVICE_ID)
+    len += snprintf(buf, cap, FILTER_ID_FIELD "=%d", (int)d->id);
+  for (int f = 0; f < d->n_fields && len < cap; f++) {
+    if (c->count[f] == 0)
+      continue;
+    any = 1;
+    const char *name = d->fields[f];
+    len += snprintf(buf + len, cap - len,
+                    "%s%s.min=%g %s.max=%g %s.mean=%g %s.n=%u",
+                    len ? " " : "", name, c->min[f], name, c->max[f], name,
+                    c->sum[f] / c->count[f], name, c->count[f]);
+  }
+  if (!any)
+    return 0;
+  if (len >= cap - 1) {
+    // 缓冲区按列数计算，不应发生
+    printf("rollup: line of device %d truncated\n", (int)d->id);
+    len = cap - 2;
+  }
+  buf[len++] = '\n';
+  return len;
+}
+
+static void flush_window(void *arg) {
+  window_t *w = arg;
+  char buf[LINE_TEXT_MAX];
+  uint64_t now = clock_now_ns();
+
+  for (int i = 0; i < n_devices; i++) {
+    rollup_cols_t *c = &devices[i].win[w->index];
+    int len = format_device(&devices[i], c, buf, sizeof(buf));
+    if (len > 0)
+      event_publish_at(w->topic, buf, len, now);
+    memset(c->count, 0, sizeof(c->count));
+  }
+  event_loop_add_timer(rollup_loop, w->period_ms, flush_window, w);
+}
+
+// 解析 "500ms" / "1s" / "1m"，返回毫秒数，格式错误返回 0
+static uint64_t parse_period(const char *s, int len) {
+  char *end;
+  long n = strtol(s, &end, 10);
+  int ulen = s + len - end;
+  if (n <= 0 || end == s)
+    return 0;
+  if (ulen == 2 && strncmp(end, "ms", 2) == 0)
+    return n;
+  if (ulen == 1 && *end == 's')
+    return n * 1000;
+  if (ulen == 1 && *end == 'm')
+    return n * 60000;
+  return 0;
+}
+
+void rollup_init(event_loop_t *loop) {
+  const char *list = config_get_str("GATEWAY_ROLLUP_WINDOWS", "1s,1m");
+  rollup_loop = loop;
+  n_windows = 0;
+  if (strcmp(list, "none") == 0)
+    return;
+
+  while (*list && n_windows < ROLLUP_MAX_WINDOWS) {
+    int len = strcspn(list, ",");
+    uint64_t period = parse_period(list, len);
+    if (period > 0) {
+      window_t *w = &windows[n_windows];
+      w->index = n_windows++;
+      w->period_ms = period;
+      snprintf(w->topic, sizeof(w->topic), ROLLUP_SOURCE_TOPIC ".%.*s", len,
+               list);
+      event_loop_add_timer(loop, period, flush_window, w);
+      __atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+    } else {
+      fprintf(stderr, "rollup: bad window '%.*s'\n", len, list);
+    }
+    list += list[len] ? len + 1 : len;
+  }
+}
+
+int rollup_report(char *buf, int cap) {
+  if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+    return 0;
+  int n = snprintf(buf, cap, "rollup devices=%d untracked=%llu\n",
+                   __atomic_load_n(&tracked, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&untracked,
+                                                       __ATOMIC_RELAXED));
+  return n < 0 ? 0 : n < cap ? n : cap - 1;
+}
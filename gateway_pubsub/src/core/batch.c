@@ -0,0 +1,224 @@
+#include <core/batch.h>
+#include <core/budget.h>
+#include <core/config.h>
+#include <core/event_loop.h>
+#include <core/lz.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_BYTES_DEFAULT 16384
+#define BATCH_BYTES_MAX (1 << 20)
+#define BATCH_LINGER_DEFAULT 5
+#define BATCH_HDR_LEN 8
+#define BATCH_VARINT_MAX 5
+#define BATCH_COMPRESS_MIN 64 // 更小的帧压缩不划算
+
+typedef struct batch {
+  connection_t *conn;
+  char *buf; // 前 BATCH_HDR_LEN 字节留给帧头，不压缩时原地发出
+  int len;   // 含帧头
+  int cap;
+  int msgs;
+  int prio;           // 帧内最重要的优先级
+  uint64_t ingest_ns; // 最早一条消息
+  histogram_t *hist;
+  event_timer_t *linger;
+} batch_t;
+
+static struct {
+  int bytes;
+  int linger_ms;
+  int compress;
+} cfg;
+static pthread_once_t cfg_once = PTHREAD_ONCE_INIT;
+
+static struct {
+  uint64_t attached;
+  uint64_t frames;
+  uint64_t compressed;
+  uint64_t msgs;
+  uint64_t raw_bytes;
+  uint64_t wire_bytes;
+} stats;
+
+// 压缩结果，各线程一份
+static __thread char *scratch = NULL;
+static __thread int scratch_cap = 0;
+
+static void cfg_init(void) {
+  cfg.bytes = config_get_int("GATEWAY_SUB_BATCH_BYTES", BATCH_BYTES_DEFAULT);
+  if (cfg.bytes < 256)
+    cfg.bytes = 256;
+  if (cfg.bytes > BATCH_BYTES_MAX)
+    cfg.bytes = BATCH_BYTES_MAX;
+  cfg.linger_ms = config_get_int("GATEWAY_SUB_LINGER_MS", BATCH_LINGER_DEFAULT);
+  if (cfg.linger_ms < 0)
+    cfg.linger_ms = 0;
+  cfg.compress = config_get_int("GATEWAY_SUB_COMPRESS", 1);
+}
+
+static void count(uint64_t *counter, uint64_t n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+void batch_attach(connection_t *conn) {
+  pthread_once(&cfg_once, cfg_init);
+  batch_t *b = calloc(1, sizeof(batch_t));
+  b->conn = conn;
+  b->cap = BATCH_HDR_LEN + cfg.bytes;
+  b->buf = malloc(b->cap);
+  b->len = BATCH_HDR_LEN;
+  conn->batch = b;
+  // 至少能排下两个整帧，否则不压缩的满帧会被当作慢订阅端断开
+  if (conn->high_watermark < 2 * b->cap)
+    conn->high_watermark = 2 * b->cap;
+  count(&stats.attached, 1);
+}
+
+static void put32(char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+void batch_flush(connection_t *conn) {
+  batch_t *b = conn->batch;
+  if (!b || b->msgs == 0)
+    return;
+  if (b->linger) {
+    event_loop_cancel_timer(conn->loop, b->linger);
+    b->linger = NULL;
+  }
+
+  int raw = b->len - BATCH_HDR_LEN;
+  char *frame = b->buf;
+  int wire = -1;
+  if (cfg.compress && raw >= BATCH_COMPRESS_MIN) {
+    if (scratch_cap < b->cap) {
+      free(scratch);
+      scratch_cap = b->cap;
+      scratch = malloc(scratch_cap);
+    }
+    // 只接受比原文短的结果，否则原样发送
+    wire = lz_compress(b->buf + BATCH_HDR_LEN, raw, scratch + BATCH_HDR_LEN,
+                       raw - 1);
+    if (wire > 0) {
+      frame = scratch;
+      count(&stats.compressed, 1);
+    }
+  }
+  if (wire < 0)
+    wire = raw;
+  put32(frame, wire);
+  put32(frame + 4, raw);
+
+  count(&stats.frames, 1);
+  count(&stats.msgs, b->msgs);
+  count(&stats.raw_bytes, raw);
+  count(&stats.wire_bytes, BATCH_HDR_LEN + wire);
+
+  // 帧交给输出队列，由队列重新计入预算
+  budget_account(-raw);
+  b->len = BATCH_HDR_LEN;
+  b->msgs = 0;
+  connection_queue_msg(conn, b->prio, frame, BATCH_HDR_LEN + wire,
+                       b->ingest_ns, b->hist);
+}
+
+static void linger_expired(void *arg) {
+  batch_t *b = arg;
+  b->linger = NULL;
+  batch_flush(b->conn);
+}
+
+static int put_varint(char *p, uint32_t v) {
+  int n = 0;
+  for (; v >= 0x80; v >>= 7)
+    p[n++] = (char)(v | 0x80);
+  p[n++] = (char)v;
+  return n;
+}
+
+void batch_add(connection_t *conn, int prio, const char *data, int len,
+               uint64_t ingest_ns, histogram_t *hist) {
+  batch_t *b = conn->batch;
+  if (b->msgs > 0 && b->len + BATCH_VARINT_MAX + len > b->cap)
+    batch_flush(conn);
+  if (b->len + BATCH_VARINT_MAX + len > b->cap) {
+    // 单条消息超过帧容量：本帧只放它一条
+    int cap = BATCH_HDR_LEN + BATCH_VARINT_MAX + len;
+    char *buf = realloc(b->buf, cap);
+    if (!buf) {
+      perror("realloc");
+      return;
+    }
+    b->buf = buf;
+    b->cap = cap;
+  }
+
+  if (b->msgs == 0) {
+    b->prio = prio;
+    b->ingest_ns = ingest_ns;
+    b->hist = NULL;
+  } else if (prio < b->prio) {
+    b->prio = prio;
+  }
+  if (!b->hist && hist) {
+    b->ingest_ns = ingest_ns;
+    b->hist = hist;
+  }
+  int prefix = put_varint(b->buf + b->len, len);
+  memcpy(b->buf + b->len + prefix, data, len);
+  b->len += prefix + len;
+  b->msgs++;
+  budget_account(prefix + len);
+
+  if (prio == OUT_PRIO_CRITICAL || b->len - BATCH_HDR_LEN >= cfg.bytes) {
+    batch_flush(conn);
+    if (b->cap > BATCH_HDR_LEN + cfg.bytes) {
+      // 超大消息撑大的缓冲区缩回常规大小
+      char *buf = realloc(b->buf, BATCH_HDR_LEN + cfg.bytes);
+      if (buf) {
+        b->buf = buf;
+        b->cap = BATCH_HDR_LEN + cfg.bytes;
+      }
+    }
+  } else if (!b->linger) {
+    b->linger =
+        event_loop_add_timer(conn->loop, cfg.linger_ms, linger_expired, b);
+  }
+}
+
+void batch_release(connection_t *conn) {
+  batch_t *b = conn->batch;
+  if (!b)
+    return;
+  if (b->linger)
+    event_loop_cancel_timer(conn->loop, b->linger);
+  budget_account(-(b->len - BATCH_HDR_LEN));
+  free(b->buf);
+  free(b);
+  conn->batch = NULL;
+}
+
+int batch_report(char *buf, int cap) {
+  if (__atomic_load_n(&stats.attached, __ATOMIC_RELAXED) == 0)
+    return 0;
+  uint64_t frames = __atomic_load_n(&stats.frames, __ATOMIC_RELAXED);
+  uint64_t msgs = __atomic_load_n(&stats.msgs, __ATOMIC_RELAXED);
+  uint64_t raw = __atomic_load_n(&stats.raw_bytes, __ATOMIC_RELAXED);
+  uint64_t wire = __atomic_load_n(&stats.wire_bytes, __ATOMIC_RELAXED);
+  int n = snprintf(
+      buf, cap,
+      "batch frames=%llu compressed=%llu msgs=%llu msgs/frame=%.1f "
+      "raw=%llu wire=%llu ratio=%.2f\n",
+      (unsigned long long)frames,
+      (unsigned long long)__atomic_load_n(&stats.compressed, __ATOMIC_RELAXED),
+      (unsigned long long)msgs, frames ? (double)msgs / frames : 0.0,
+      (unsigned long long)raw, (unsigned long long)wire,
+      raw ? (double)wire / raw : 0.0);
+  return n < 0 ? 0 : n < cap ? n : cap - 1;
+}
@@ -0,0 +1,54 @@
+#include <core/budget.h>
+#include <core/config.h>
+#include <stdio.h>
+
+#define BUDGET_DEFAULT (32L << 20)
+
+static long used = 0;
+static long limit = -1; // 首次使用时读取配置
+static unsigned long stats[BUDGET_STATS];
+
+void budget_account(long delta) {
+  __atomic_fetch_add(&used, delta, __ATOMIC_RELAXED);
+}
+
+long budget_used(void) { return __atomic_load_n(&used, __ATOMIC_RELAXED); }
+
+long budget_limit(void) {
+  if (limit < 0) {
+    long l = config_get_int("GATEWAY_OUT_BUDGET", BUDGET_DEFAULT);
+    __atomic_store_n(&limit, l > 0 ? l : BUDGET_DEFAULT, __ATOMIC_RELAXED);
+  }
+  return __atomic_load_n(&limit, __ATOMIC_RELAXED);
+}
+
+budget_level_t budget_level(void) {
+  long u = budget_used(), l = budget_limit();
+  if (u * 10 >= l * 9)
+    return BUDGET_EVICT;
+  if (u * 4 >= l * 3)
+    return BUDGET_PAUSE;
+  if (u * 2 >= l)
+    return BUDGET_SHED;
+  return BUDGET_OK;
+}
+
+void budget_count(budget_stat_t stat) {
+  __atomic_fetch_add(&stats[stat], 1, __ATOMIC_RELAXED);
+}
+
+int budget_report(char *buf, int cap) {
+  static const char *levels[] = {"ok", "shed", "pause", "evict"};
+  int n = snprintf(
+      buf, cap,
+      "budget used=%ld limit=%ld level=%s shed=%lu paused=%lu evicted=%lu\n",
+      budget_used(), budget_limit(), levels[budget_level()],
+      __atomic_load_n(&stats[BUDGET_STAT_SHED], __ATOMIC_RELAXED),
+      __atomic_load_n(&stats[BUDGET_STAT_PAUSED], __ATOMIC_RELAXED),
+      __atomic_load_n(&stats[BUDGET_STAT_EVICTED], __ATOMIC_RELAXED));
+  if (n < 0 || n >= cap) {
+    buf[0] = 0;
+    return 0;
+  }
+  return n;
+}
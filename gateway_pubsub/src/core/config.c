@@ -0,0 +1,21 @@
+#include <core/config.h>
+#include <stdlib.h>
+
+long config_get_int(const char *name, long def) {
+  const char *val = getenv(name);
+  if (!val || !*val)
+    return def;
+
+  char *end;
+  long n = strtol(val, &end, 0);
+  if (*end != '\0')
+    return def; // 非法数值时使用默认值
+  return n;
+}
+
+const char *config_get_str(const char *name, const char *def) {
+  const char *val = getenv(name);
+  if (!val || !*val)
+    return def;
+  return val;
+}
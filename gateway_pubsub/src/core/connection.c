@@ -1,24 +1,49 @@
 #include <bus/event_bus.h>
+#include <core/batch.h>
+#include <core/budget.h>
+#include <core/clock.h>
+#include <core/config.h>
 #include <core/connection.h>
 #include <core/event_loop.h>
+#include <core/histogram.h>
+#include <core/splice.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+// 本线程创建的活动连接（不含 listener），pipeline 模式下每个线程各自一份
+static __thread connection_t *conn_list = NULL;
+
+connection_t *connection_list(void) { return conn_list; }
+
+static int conn_count = 0;
+
+int connection_count(void) {
+  return __atomic_load_n(&conn_count, __ATOMIC_RELAXED);
+}
+
 connection_t *connection_create(event_loop_t *loop, int fd) {
   connection_t *conn = calloc(1, sizeof(connection_t));
   conn->fd = fd;
   conn->loop = loop;
   conn->events = EPOLLIN; // 默认监听可读事件
 
-  conn->out_cap = 4096;                 // 初始输出缓冲区容量
+  conn->inbuf = malloc(CONN_INBUF_SIZE);
+  conn->out_cap = OUT_BUF_INITIAL;      // 初始输出缓冲区容量
   conn->outbuf = malloc(conn->out_cap); // 输出缓冲区，动态分配
 
   conn->high_watermark = 8192; // 可选：设置高水位线，单位为字节
+  conn->pipe_rd = conn->pipe_wr = -1;
 
   conn->state = CONN_STATE_OPEN; // 初始状态为打开
+  __atomic_fetch_add(&conn_count, 1, __ATOMIC_RELAXED);
+
+  conn->next = conn_list;
+  if (conn_list)
+    conn_list->prev = conn;
+  conn_list = conn;
 
   return conn;
 }
@@ -26,6 +51,24 @@ connection_t *connection_create(event_loop_t *loop, int fd) {
 void connection_destroy(connection_t *conn) {
   if (!conn)
     return;
+  if (conn->on_close)
+    conn->on_close(conn);
+  __atomic_fetch_sub(&conn_count, 1, __ATOMIC_RELAXED);
+  budget_account(-(long)(conn->out_len + conn->pending_len));
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else if (conn_list == conn)
+    conn_list = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  for (int p = 0; p < OUT_PRIO_CLASSES; p++) {
+    free(conn->prio_q[p].buf);
+    free(conn->prio_q[p].msgs);
+  }
+  splice_release(conn);
+  batch_release(conn);
+  free(conn->marks);
+  free(conn->inbuf);
   free(conn->outbuf);
   free(conn);
 }
@@ -77,32 +120,318 @@ void connection_close(connection_t *conn) {
   connection_destroy(conn);
 }
 
-void connection_append_out(connection_t *conn, const char *data, int len) {
-  // 确保输出缓冲区有足够的空间
-  if (conn->out_len + len > conn->out_cap) {
-    int new_cap = conn->out_cap * 2;
-    while (new_cap < conn->out_len + len) {
-      new_cap *= 2;
-    }
-    char *new_buf = realloc(conn->outbuf, new_cap);
-    if (!new_buf) {
-      perror("realloc");
-      return;
-    }
-    conn->outbuf = new_buf;
-    conn->out_cap = new_cap;
+// 确保输出缓冲区还能容纳 len 字节
+static int out_reserve(connection_t *conn, int len) {
+  if (conn->out_len + len <= conn->out_cap)
+    return 0;
+  int new_cap = conn->out_cap * 2;
+  while (new_cap < conn->out_len + len) {
+    new_cap *= 2;
   }
-  int was_empty = (conn->out_len == 0);
-  // 将数据追加到输出缓冲区
+  char *new_buf = realloc(conn->outbuf, new_cap);
+  if (!new_buf) {
+    perror("realloc");
+    return -1;
+  }
+  conn->outbuf = new_buf;
+  conn->out_cap = new_cap;
+  return 0;
+}
+
+static void out_copy(connection_t *conn, const char *data, int len) {
   memcpy(conn->outbuf + conn->out_len, data, len);
   conn->out_len += len;
+  conn->out_appended += len;
+  budget_account(len);
+}
+
+void connection_append_out(connection_t *conn, const char *data, int len) {
+  if (conn->state == CONN_STATE_CLOSING)
+    return; // 即将断开，不再占用内存
+  if (out_reserve(conn, len) < 0)
+    return;
+  // 将数据追加到输出缓冲区
+  out_copy(conn, data, len);
   // 启用写事件以便发送数据
-  if (was_empty) {
-    connection_enable_write(conn);
+  connection_enable_write(conn);
+
+  if (conn->out_len + conn->pending_len >= conn->high_watermark) {
+    printf("slow subscriber\n");
+    conn->state = CONN_STATE_CLOSING;
+  }
+}
+
+int connection_append_cmd(connection_t *conn, const char *data, int len,
+                          int cap) {
+  if (conn->state == CONN_STATE_CLOSING)
+    return -1;
+  if (conn->out_len + len > cap || out_reserve(conn, len) < 0) {
+    conn->downlink_busy = 1;
+    return -1;
+  }
+  out_copy(conn, data, len);
+  connection_enable_write(conn);
+  return 0;
+}
+
+void connection_adopt_out(connection_t *conn, const char *data, int len) {
+  if (out_reserve(conn, len) < 0)
+    return;
+  out_copy(conn, data, len);
+  connection_enable_write(conn);
+  // 继承的积压不算慢订阅端：水位线在原值之上留出这部分
+  conn->high_watermark += len;
+}
+
+/* ========== 优先级队列 ========== */
+
+#define OUT_QUANTUM 512 // 加权轮询中权重 1 每轮可发送的字节数
+
+static int out_weights[OUT_PRIO_CLASSES];
+static int out_weighted = -1; // -1 表示尚未读取配置
+
+// GATEWAY_OUT_WEIGHTS="8,2,1" 启用加权轮询，否则严格按优先级发送
+static int load_weights(void) {
+  if (out_weighted >= 0)
+    return out_weighted;
+  const char *s = config_get_str("GATEWAY_OUT_WEIGHTS", NULL);
+  int n = 0;
+  while (s && *s && n < OUT_PRIO_CLASSES) {
+    char *end;
+    long w = strtol(s, &end, 10);
+    if (end == s || w <= 0)
+      break;
+    out_weights[n++] = (int)w;
+    s = *end == ',' ? end + 1 : end;
+  }
+  out_weighted = n == OUT_PRIO_CLASSES;
+  return out_weighted;
+}
+
+static out_msg_t *queue_front(out_queue_t *q) { return &q->msgs[q->msgs_head]; }
+
+static int queue_push(out_queue_t *q, const char *data, int len,
+                      uint64_t ingest_ns, histogram_t *hist) {
+  if (q->head + q->len + len > q->cap) {
+    if (q->head > 0) {
+      memmove(q->buf, q->buf + q->head, q->len);
+      q->head = 0;
+    }
+    if (q->len + len > q->cap) {
+      int new_cap = q->cap ? q->cap * 2 : 1024;
+      while (new_cap < q->len + len)
+        new_cap *= 2;
+      char *buf = realloc(q->buf, new_cap);
+      if (!buf)
+        return -1;
+      q->buf = buf;
+      q->cap = new_cap;
+    }
+  }
+  if (q->msgs_len == q->msgs_cap) {
+    int new_cap = q->msgs_cap ? q->msgs_cap * 2 : 16;
+    out_msg_t *msgs = malloc(sizeof(out_msg_t) * new_cap);
+    if (!msgs)
+      return -1;
+    // 展开环形队列
+    for (int i = 0; i < q->msgs_len; i++)
+      msgs[i] = q->msgs[(q->msgs_head + i) & (q->msgs_cap - 1)];
+    free(q->msgs);
+    q->msgs = msgs;
+    q->msgs_head = 0;
+    q->msgs_cap = new_cap;
+  }
+
+  memcpy(q->buf + q->head + q->len, data, len);
+  q->len += len;
+  out_msg_t *m = &q->msgs[(q->msgs_head + q->msgs_len) & (q->msgs_cap - 1)];
+  m->len = len;
+  m->ingest_ns = ingest_ns;
+  m->hist = hist;
+  q->msgs_len++;
+  return 0;
+}
+
+static void queue_pop(out_queue_t *q) {
+  int len = queue_front(q)->len;
+  q->head += len;
+  q->len -= len;
+  if (q->len == 0)
+    q->head = 0;
+  q->msgs_head = (q->msgs_head + 1) & (q->msgs_cap - 1);
+  q->msgs_len--;
+}
+
+// 从 prio 队列头部丢弃最早的消息，直到排队总量不超过 limit
+static void shed(connection_t *conn, int prio, int limit) {
+  out_queue_t *q = &conn->prio_q[prio];
+  while (q->msgs_len > 0 && conn->out_len + conn->pending_len > limit) {
+    conn->pending_len -= queue_front(q)->len;
+    budget_account(-queue_front(q)->len);
+    queue_pop(q);
+    conn->out_shed++;
+    budget_count(BUDGET_STAT_SHED);
+  }
+}
+
+void connection_append_msg(connection_t *conn, int prio, const char *data,
+                           int len, uint64_t ingest_ns, histogram_t *hist) {
+  if (conn->state == CONN_STATE_CLOSING)
+    return;
+  if (conn->batch) {
+    batch_add(conn, prio, data, len, ingest_ns, hist);
+    return;
+  }
+  connection_queue_msg(conn, prio, data, len, ingest_ns, hist);
+}
+
+void connection_queue_msg(connection_t *conn, int prio, const char *data,
+                          int len, uint64_t ingest_ns, histogram_t *hist) {
+  if (conn->state == CONN_STATE_CLOSING)
+    return;
+  if (prio < 0 || prio >= OUT_PRIO_CLASSES)
+    prio = OUT_PRIO_NORMAL;
+
+  // 全局预算过半时先丢弃低优先级数据（仅在订阅端已有积压时）
+  if (budget_level() >= BUDGET_SHED) {
+    shed(conn, OUT_PRIO_BULK, 0);
+    if (prio == OUT_PRIO_BULK &&
+        (conn->pending_len > 0 || conn->out_len >= OUT_WIRE_CHUNK)) {
+      conn->out_shed++;
+      budget_count(BUDGET_STAT_SHED);
+      return;
+    }
   }
 
-  if (conn->out_len >= conn->high_watermark) {
+  int limit = conn->high_watermark;
+  if (prio == OUT_PRIO_CRITICAL)
+    limit *= 2; // 告警有额外余量，不因普通数据积压而断开
+  if (conn->out_len + conn->pending_len + len > conn->high_watermark)
+    shed(conn, OUT_PRIO_BULK, conn->high_watermark - len);
+  if (conn->out_len + conn->pending_len + len > limit) {
+    if (prio == OUT_PRIO_BULK) {
+      conn->out_shed++;
+      budget_count(BUDGET_STAT_SHED);
+      return;
+    }
     printf("slow subscriber\n");
     conn->state = CONN_STATE_CLOSING;
   }
+
+  // 没有积压时直接进入 outbuf，避免多一次拷贝
+  if (conn->pending_len == 0 && conn->out_len < OUT_WIRE_CHUNK) {
+    if (out_reserve(conn, len) < 0)
+      return;
+    out_copy(conn, data, len);
+    if (hist)
+      connection_mark_delivery(conn, ingest_ns, hist);
+  } else {
+    if (queue_push(&conn->prio_q[prio], data, len, ingest_ns, hist) < 0) {
+      perror("queue_push");
+      return;
+    }
+    conn->pending_len += len;
+    budget_account(len);
+  }
+  connection_enable_write(conn);
+}
+
+// 选出下一条进入 outbuf 的消息所属的优先级，调用前需确保有排队消息
+static int next_class(connection_t *conn) {
+  if (!load_weights()) {
+    for (int p = 0; p < OUT_PRIO_CLASSES; p++) {
+      if (conn->prio_q[p].msgs_len > 0)
+        return p;
+    }
+  }
+
+  // 差额轮询：每轮给当前优先级 weight * OUT_QUANTUM 字节的额度
+  while (1) {
+    out_queue_t *q = &conn->prio_q[conn->prio_cur];
+    if (q->msgs_len > 0 && queue_front(q)->len <= q->deficit) {
+      q->deficit -= queue_front(q)->len;
+      return conn->prio_cur;
+    }
+    if (q->msgs_len == 0)
+      q->deficit = 0;
+    conn->prio_cur = (conn->prio_cur + 1) % OUT_PRIO_CLASSES;
+    q = &conn->prio_q[conn->prio_cur];
+    if (q->msgs_len > 0)
+      q->deficit += out_weights[conn->prio_cur] * OUT_QUANTUM;
+  }
+}
+
+void connection_fill_out(connection_t *conn, int limit) {
+  while (conn->pending_len > 0 && conn->out_len < limit) {
+    out_queue_t *q = &conn->prio_q[next_class(conn)];
+    out_msg_t m = *queue_front(q);
+    if (out_reserve(conn, m.len) < 0)
+      return;
+    out_copy(conn, q->buf + q->head, m.len);
+    if (m.hist)
+      connection_mark_delivery(conn, m.ingest_ns, m.hist);
+    conn->pending_len -= m.len;
+    budget_account(-m.len);
+    queue_pop(q);
+  }
+}
+
+void connection_trim(connection_t *conn) {
+  if (conn->out_len == 0 && conn->out_cap > OUT_BUF_INITIAL) {
+    char *buf = realloc(conn->outbuf, OUT_BUF_INITIAL);
+    if (buf) {
+      conn->outbuf = buf;
+      conn->out_cap = OUT_BUF_INITIAL;
+    }
+  }
+  for (int p = 0; p < OUT_PRIO_CLASSES; p++) {
+    out_queue_t *q = &conn->prio_q[p];
+    if (q->len == 0 && q->buf) {
+      free(q->buf);
+      q->buf = NULL;
+      q->head = q->cap = 0;
+    }
+  }
+}
+
+void connection_mark_delivery(connection_t *conn, uint64_t ingest_ns,
+                              histogram_t *hist) {
+  if (conn->marks_len == conn->marks_cap) {
+    int new_cap = conn->marks_cap ? conn->marks_cap * 2 : 16;
+    delivery_mark_t *marks = malloc(sizeof(delivery_mark_t) * new_cap);
+    if (!marks)
+      return;
+    // 展开环形队列
+    for (int i = 0; i < conn->marks_len; i++)
+      marks[i] = conn->marks[(conn->marks_head + i) & (conn->marks_cap - 1)];
+    free(conn->marks);
+    conn->marks = marks;
+    conn->marks_head = 0;
+    conn->marks_cap = new_cap;
+  }
+
+  delivery_mark_t *m =
+      &conn->marks[(conn->marks_head + conn->marks_len) & (conn->marks_cap - 1)];
+  m->end = conn->out_appended;
+  m->ingest_ns = ingest_ns;
+  m->hist = hist;
+  conn->marks_len++;
+}
+
+void connection_out_sent(connection_t *conn, int n) {
+  conn->out_sent += n;
+  budget_account(-n);
+  if (conn->marks_len == 0 ||
+      conn->marks[conn->marks_head].end > conn->out_sent)
+    return;
+
+  uint64_t now = clock_now_ns(); // 每次写只取一次时间
+  while (conn->marks_len > 0) {
+    delivery_mark_t *m = &conn->marks[conn->marks_head];
+    if (m->end > conn->out_sent)
+      break;
+    hist_record(m->hist, now - m->ingest_ns);
+    conn->marks_head = (conn->marks_head + 1) & (conn->marks_cap - 1);
+    conn->marks_len--;
+  }
 }
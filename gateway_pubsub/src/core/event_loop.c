@@ -1,50 +1,587 @@
+#include <core/clock.h>
+#include <core/config.h>
+#include <core/connection.h>
 #include <core/event_loop.h>
+#include <core/histogram.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 
+// 统计值由循环所在线程单写，其它线程出报告时读取
+#define STAT_ADD(p, v) __atomic_store_n(p, *(p) + (v), __ATOMIC_RELAXED)
+#define STAT_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+#define MAX_LOOPS 130 // 主线程 + pipeline 的全部工作线程
+#define SLOTS_INITIAL 64
+#define PROF_MAX 16      // 每个循环单独统计的回调种类上限
+#define CB_NAMES_MAX 32
+#define STALL_CULPRITS 3 // 卡顿日志中列出的最慢回调数
+#define STALL_MS_DEFAULT 20
+#define STALL_LOG_INTERVAL_NS 1000000000ull
+
+/*
+ * Dispatch record of one registered fd, indexed by fd. Only what the loop
+ * needs to route an event lives here, two records per cache line, so a batch
+ * of events touches a few contiguous lines instead of one large connection_t
+ * each. The epoll data carries (gen << 32 | fd); gen changes whenever the fd
+ * is removed, so events queued for a connection that a previous callback of
+ * the same batch closed are recognised and dropped.
+ */
+typedef struct event_slot {
+  uint32_t gen;
+  uint32_t events;
+  connection_t *conn; // NULL 表示未注册
+  void (*on_read)(connection_t *);
+  void (*on_write)(connection_t *);
+} event_slot_t;
+
+// 一种回调（函数 + 读/写）的耗时分布，单位为 TSC 周期
+typedef struct cb_profile {
+  event_cb_t fn;
+  int write;
+  histogram_t hist;
+} cb_profile_t;
+
+// 一轮中耗时最长的回调，fd 为 -1 表示定时器或 tick
+typedef struct culprit {
+  const char *kind;
+  event_cb_t fn;
+  int fd;
+  uint64_t ticks;
+} culprit_t;
+
 struct event_loop {
   int epfd;
+  int nfds; // 已注册的 fd 数量，降为 0 时事件循环退出（热重启排空）
+  event_loop_tick_t tick; // 每批事件处理完后调用，可为 NULL
+  void *tick_arg;
+  event_timer_t **timers; // 按到期时间排列的最小堆
+  int n_timers;
+  int cap_timers;
+  uint64_t busy_poll_ns; // 阻塞前忙轮询的时长，0 表示关闭
+  event_loop_stats_t stats;
+  event_slot_t *slots; // 按 fd 索引
+  int n_slots;
   struct epoll_event events[64];
+
+  cb_profile_t *prof[PROF_MAX]; // 只增不删，报告线程按 n_prof 读取
+  int n_prof;
+  histogram_t iter_hist; // 每轮处理事件、定时器和 tick 的耗时（纳秒）
+  uint64_t stall_ns;     // 超过该值的一轮记为卡顿，0 表示不打印日志
+  uint64_t stalls;
+  uint64_t stall_logged_ns; // 限制日志频率
+  uint64_t stalls_quiet;    // 上次日志之后未打印的卡顿次数
+};
+
+static event_loop_t *loops[MAX_LOOPS];
+static int n_loops = 0;
+static pthread_mutex_t loops_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+  event_cb_t fn;
+  const char *name;
+} cb_names[CB_NAMES_MAX];
+static int n_cb_names = 0;
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// TSC 与单调时钟的对照点，用于把周期数换算成纳秒
+static uint64_t tick_base = 0;
+static uint64_t tick_base_ns = 0;
+
+struct event_timer {
+  uint64_t deadline; // 单调时间，纳秒
+  event_timer_cb_t cb;
+  void *arg;
+  int index; // 在堆中的位置
 };
 
 event_loop_t *event_loop_create() {
   event_loop_t *loop = calloc(1, sizeof(event_loop_t));
   loop->epfd = epoll_create1(0);
+  loop->busy_poll_ns = config_get_int("GATEWAY_BUSY_POLL_US", 0) * 1000;
+  loop->stall_ns =
+      config_get_int("GATEWAY_LOOP_STALL_MS", STALL_MS_DEFAULT) * 1000000ull;
+
+  pthread_mutex_lock(&loops_lock);
+  if (tick_base == 0) {
+    tick_base = clock_ticks();
+    tick_base_ns = clock_now_ns();
+  }
+  if (n_loops < MAX_LOOPS)
+    loops[n_loops++] = loop;
+  pthread_mutex_unlock(&loops_lock);
   return loop;
 }
 
+void event_loop_set_tick(event_loop_t *loop, event_loop_tick_t tick,
+                         void *arg) {
+  loop->tick = tick;
+  loop->tick_arg = arg;
+}
+
+void event_loop_name_callback(event_cb_t fn, const char *name) {
+  pthread_mutex_lock(&names_lock);
+  int known = 0;
+  for (int i = 0; i < n_cb_names; i++)
+    known |= cb_names[i].fn == fn;
+  if (!known && n_cb_names < CB_NAMES_MAX) {
+    cb_names[n_cb_names].fn = fn;
+    cb_names[n_cb_names].name = name;
+    n_cb_names++;
+  }
+  pthread_mutex_unlock(&names_lock);
+}
+
+// 未登记名字的回调以函数地址表示
+static const char *callback_name(event_cb_t fn, char *buf, int cap) {
+  const char *name = NULL;
+  pthread_mutex_lock(&names_lock);
+  for (int i = 0; i < n_cb_names && !name; i++) {
+    if (cb_names[i].fn == fn)
+      name = cb_names[i].name;
+  }
+  pthread_mutex_unlock(&names_lock);
+  if (!name) {
+    snprintf(buf, cap, "%p", (void *)fn);
+    name = buf;
+  }
+  return name;
+}
+
+// 从进程启动到现在的平均频率，运行几毫秒之后就足够准确
+static double ns_per_tick(void) {
+  uint64_t ticks = clock_ticks() - tick_base;
+  uint64_t ns = clock_now_ns() - tick_base_ns;
+  return ticks ? (double)ns / ticks : 1.0;
+}
+
+/* ========== 回调耗时统计 ========== */
+
+static void profile_record(event_loop_t *loop, event_cb_t fn, int write,
+                           uint64_t ticks) {
+  for (int i = 0; i < loop->n_prof; i++) {
+    cb_profile_t *p = loop->prof[i];
+    if (p->fn == fn && p->write == write) {
+      hist_record(&p->hist, ticks);
+      return;
+    }
+  }
+  if (loop->n_prof == PROF_MAX)
+    return;
+  cb_profile_t *p = calloc(1, sizeof(cb_profile_t));
+  p->fn = fn;
+  p->write = write;
+  hist_record(&p->hist, ticks);
+  loop->prof[loop->n_prof] = p;
+  __atomic_store_n(&loop->n_prof, loop->n_prof + 1, __ATOMIC_RELEASE);
+}
+
+// 按耗时从大到小保留本轮最慢的几个回调
+static void culprit_note(culprit_t *worst, const char *kind, event_cb_t fn,
+                         int fd, uint64_t ticks) {
+  int i = STALL_CULPRITS;
+  while (i > 0 && worst[i - 1].ticks < ticks) {
+    if (i < STALL_CULPRITS)
+      worst[i] = worst[i - 1];
+    i--;
+  }
+  if (i < STALL_CULPRITS)
+    worst[i] = (culprit_t){kind, fn, fd, ticks};
+}
+
+static void dispatch(event_loop_t *loop, event_slot_t *slot, int fd,
+                     int write, culprit_t *worst) {
+  event_cb_t fn = write ? slot->on_write : slot->on_read;
+  uint64_t start = clock_ticks();
+  fn(slot->conn); // 之后 slot 可能已失效
+  uint64_t ticks = clock_ticks() - start;
+  profile_record(loop, fn, write, ticks);
+  culprit_note(worst, write ? "write" : "read", fn, fd, ticks);
+}
+
+/**
+ * Logs an iteration that took longer than GATEWAY_LOOP_STALL_MS, with its
+ * slowest callbacks and their connections. At most one line per second is
+ * printed; the stalls in between are counted in the next line.
+ */
+static void log_stall(event_loop_t *loop, uint64_t work_ns, uint64_t now,
+                      const culprit_t *worst) {
+  STAT_ADD(&loop->stalls, 1);
+  if (now - loop->stall_logged_ns < STALL_LOG_INTERVAL_NS) {
+    loop->stalls_quiet++;
+    return;
+  }
+  loop->stall_logged_ns = now;
+
+  char line[512];
+  int len = snprintf(line, sizeof(line),
+                     "event loop stalled %.1fms (budget %llums):",
+                     work_ns / 1e6,
+                     (unsigned long long)(loop->stall_ns / 1000000));
+  double scale = ns_per_tick() / 1e6;
+  for (int i = 0; i < STALL_CULPRITS && worst[i].ticks; i++) {
+    if (worst[i].ticks * scale * 1e6 < loop->stall_ns / 10)
+      break; // 不到预算十分之一的不是原因
+    char name[32];
+    if (worst[i].fd >= 0)
+      len += snprintf(line + len, sizeof(line) - len, " %s %s fd=%d %.2fms",
+                      worst[i].kind,
+                      callback_name(worst[i].fn, name, sizeof(name)),
+                      worst[i].fd, worst[i].ticks * scale);
+    else
+      len += snprintf(line + len, sizeof(line) - len, " %s %.2fms",
+                      worst[i].kind, worst[i].ticks * scale);
+  }
+  if (loop->stalls_quiet)
+    snprintf(line + len, sizeof(line) - len, " (+%llu not logged)",
+             (unsigned long long)loop->stalls_quiet);
+  loop->stalls_quiet = 0;
+  printf("%s\n", line);
+}
+
+/* ========== fd 索引的分发表 ========== */
+
+static event_slot_t *slot_get(event_loop_t *loop, int fd) {
+  if (fd < loop->n_slots)
+    return &loop->slots[fd];
+
+  int n = loop->n_slots ? loop->n_slots : SLOTS_INITIAL;
+  while (n <= fd)
+    n *= 2;
+  // aligned_alloc 没有对应的 realloc，手动搬迁
+  event_slot_t *slots = aligned_alloc(64, sizeof(event_slot_t) * n);
+  if (!slots)
+    return NULL;
+  if (loop->n_slots)
+    memcpy(slots, loop->slots, sizeof(event_slot_t) * loop->n_slots);
+  memset(slots + loop->n_slots, 0,
+         sizeof(event_slot_t) * (n - loop->n_slots));
+  free(loop->slots);
+  loop->slots = slots;
+  loop->n_slots = n;
+  return &slots[fd];
+}
+
+static void slot_fill(event_slot_t *slot, uint32_t events, connection_t *conn) {
+  slot->events = events;
+  slot->conn = conn;
+  slot->on_read = conn->on_read;
+  slot->on_write = conn->on_write;
+}
+
+static uint64_t slot_handle(int fd, const event_slot_t *slot) {
+  return (uint64_t)slot->gen << 32 | (uint32_t)fd;
+}
+
 void event_loop_add(event_loop_t *loop, int fd, uint32_t events, void *ptr) {
+  event_slot_t *slot = slot_get(loop, fd);
+  if (!slot)
+    return;
+  slot->gen++; // 同一 fd 号复用时，旧事件不会被分发给新连接
+  slot_fill(slot, events, ptr);
+
   struct epoll_event ev = {0};
   ev.events = events;
-  ev.data.ptr = ptr;
-  epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+  ev.data.u64 = slot_handle(fd, slot);
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+    loop->nfds++;
+  } else {
+    slot->conn = NULL;
+  }
 }
 
 void event_loop_mod(event_loop_t *loop, int fd, uint32_t events, void *ptr) {
+  if (fd < 0 || fd >= loop->n_slots || !loop->slots[fd].conn)
+    return;
+  event_slot_t *slot = &loop->slots[fd];
+  slot_fill(slot, events, ptr);
+
   struct epoll_event ev = {0};
   ev.events = events;
-  ev.data.ptr = ptr;
+  ev.data.u64 = slot_handle(fd, slot);
   epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+/* ========== 定时器（最小堆） ========== */
+
+static void timer_swap(event_loop_t *loop, int i, int j) {
+  event_timer_t *t = loop->timers[i];
+  loop->timers[i] = loop->timers[j];
+  loop->timers[j] = t;
+  loop->timers[i]->index = i;
+  loop->timers[j]->index = j;
+}
+
+static void timer_up(event_loop_t *loop, int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (loop->timers[parent]->deadline <= loop->timers[i]->deadline)
+      break;
+    timer_swap(loop, i, parent);
+    i = parent;
+  }
+}
+
+static void timer_down(event_loop_t *loop, int i) {
+  while (1) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < loop->n_timers &&
+        loop->timers[l]->deadline < loop->timers[min]->deadline)
+      min = l;
+    if (r < loop->n_timers &&
+        loop->timers[r]->deadline < loop->timers[min]->deadline)
+      min = r;
+    if (min == i)
+      return;
+    timer_swap(loop, i, min);
+    i = min;
+  }
+}
+
+static void timer_remove(event_loop_t *loop, int i) {
+  int last = --loop->n_timers;
+  if (i != last) {
+    timer_swap(loop, i, last);
+    timer_down(loop, i);
+    timer_up(loop, i);
+  }
+}
+
+event_timer_t *event_loop_add_timer(event_loop_t *loop, uint64_t delay_ms,
+                                    event_timer_cb_t cb, void *arg) {
+  if (loop->n_timers == loop->cap_timers) {
+    int cap = loop->cap_timers ? loop->cap_timers * 2 : 16;
+    event_timer_t **timers = realloc(loop->timers, sizeof(*timers) * cap);
+    if (!timers)
+      return NULL;
+    loop->timers = timers;
+    loop->cap_timers = cap;
+  }
+
+  event_timer_t *t = malloc(sizeof(event_timer_t));
+  t->deadline = clock_now_ns() + delay_ms * 1000000ull;
+  t->cb = cb;
+  t->arg = arg;
+  t->index = loop->n_timers++;
+  loop->timers[t->index] = t;
+  timer_up(loop, t->index);
+  return t;
+}
+
+void event_loop_cancel_timer(event_loop_t *loop, event_timer_t *timer) {
+  if (!timer)
+    return;
+  timer_remove(loop, timer->index);
+  free(timer);
+}
+
+// epoll_wait 的超时：最近一个定时器到期前的毫秒数，没有定时器时为 -1
+static int timer_timeout_ms(event_loop_t *loop) {
+  if (loop->n_timers == 0)
+    return -1;
+  uint64_t now = clock_now_ns();
+  uint64_t deadline = loop->timers[0]->deadline;
+  if (deadline <= now)
+    return 0;
+  return (int)((deadline - now + 999999) / 1000000);
+}
+
+static void run_timers(event_loop_t *loop) {
+  if (loop->n_timers == 0)
+    return;
+  uint64_t now = clock_now_ns();
+  while (loop->n_timers > 0 && loop->timers[0]->deadline <= now) {
+    event_timer_t *t = loop->timers[0];
+    timer_remove(loop, 0);
+    t->cb(t->arg); // 回调中可以再添加定时器
+    free(t);
+  }
+}
+
 void event_loop_del(event_loop_t *loop, int fd) {
-  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if (fd >= 0 && fd < loop->n_slots && loop->slots[fd].conn) {
+    loop->slots[fd].gen++; // 本批次中尚未分发的事件随之失效
+    loop->slots[fd].conn = NULL;
+  }
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL) == 0)
+    loop->nfds--;
+}
+
+uint64_t event_loop_busy_poll_us(event_loop_t *loop) {
+  return loop->busy_poll_ns / 1000;
+}
+
+/**
+ * Waits for events, spinning with a zero timeout first in busy-poll mode.
+ *
+ * @param now - In: time the previous batch finished. Out: time the wait
+ *              returned.
+ * @return Result of epoll_wait().
+ */
+static int poll_events(event_loop_t *loop, uint64_t *now) {
+  if (loop->busy_poll_ns > 0) {
+    uint64_t start = *now;
+    do {
+      int n = epoll_wait(loop->epfd, loop->events, 64, 0);
+      *now = clock_now_ns();
+      if (n != 0) {
+        STAT_ADD(&loop->stats.spin_ns, *now - start);
+        if (n > 0)
+          STAT_ADD(&loop->stats.spin_hits, 1);
+        return n;
+      }
+      // 有定时器到期时不再空转
+    } while (*now - start < loop->busy_poll_ns &&
+             !(loop->n_timers > 0 && loop->timers[0]->deadline <= *now));
+    STAT_ADD(&loop->stats.spin_ns, *now - start);
+  }
+
+  uint64_t start = *now;
+  int n = epoll_wait(loop->epfd, loop->events, 64, timer_timeout_ms(loop));
+  *now = clock_now_ns();
+  STAT_ADD(&loop->stats.block_ns, *now - start);
+  STAT_ADD(&loop->stats.wakeups, 1);
+  return n;
 }
 
+/**
+ * Returns the live dispatch record behind an epoll handle, or NULL if the
+ * connection was closed (or its fd reused) since the event was queued.
+ */
+static event_slot_t *slot_lookup(event_loop_t *loop, uint64_t handle) {
+  int fd = (int)(uint32_t)handle;
+  if (fd >= loop->n_slots)
+    return NULL;
+  event_slot_t *slot = &loop->slots[fd];
+  if (slot->gen != (uint32_t)(handle >> 32) || !slot->conn)
+    return NULL;
+  return slot;
+}
+
+/**
+ * Runs the event loop until no file descriptor is registered any more.
+ *
+ * In normal operation the listeners keep the loop alive forever. After a hot
+ * restart hand-off the old process removes its listeners, so the loop returns
+ * once the remaining connections have drained.
+ *
+ * A callback may close any connection, including ones with events later in
+ * the same batch; those events are skipped.
+ *
+ * @param loop - Event loop to run.
+ */
 void event_loop_run(event_loop_t *loop) {
-  while (1) {
-    int n = epoll_wait(loop->epfd, loop->events, 64, -1);
+  uint64_t now = clock_now_ns();
+  while (loop->nfds > 0) {
+    int n = poll_events(loop, &now);
+    culprit_t worst[STALL_CULPRITS] = {{0}};
     for (int i = 0; i < n; i++) {
-      connection_t *conn = loop->events[i].data.ptr;
+      uint64_t handle = loop->events[i].data.u64;
       uint32_t events = loop->events[i].events;
+      event_slot_t *slot = slot_lookup(loop, handle);
+      int fd = (int)(uint32_t)handle;
 
-      if (events & EPOLLIN) {
-        conn->on_read(conn);
+      // EPOLLHUP / EPOLLERR 即使没有监听 EPOLLIN 也会上报，交给读回调处理，
+      // 否则暂停读取的连接断开后会一直空转
+      if (slot && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        slot->conn->hangup = (events & (EPOLLHUP | EPOLLERR)) != 0;
+        dispatch(loop, slot, fd, 0, worst);
+        slot = slot_lookup(loop, handle); // 回调可能关闭了连接或扩容了分发表
       }
-      if (events & EPOLLOUT) {
-        conn->on_write(conn);
+      if (slot && (events & EPOLLOUT)) {
+        dispatch(loop, slot, fd, 1, worst);
       }
     }
+    uint64_t start = clock_ticks();
+    run_timers(loop);
+    uint64_t mid = clock_ticks();
+    if (loop->tick)
+      loop->tick(loop, loop->tick_arg);
+    culprit_note(worst, "timers", NULL, -1, mid - start);
+    culprit_note(worst, "tick", NULL, -1, clock_ticks() - mid);
+
+    uint64_t end = clock_now_ns();
+    STAT_ADD(&loop->stats.work_ns, end - now);
+    if (n > 0) // 忙轮询空转和单纯的定时器唤醒不计入
+      hist_record(&loop->iter_hist, end - now);
+    if (loop->stall_ns && end - now > loop->stall_ns)
+      log_stall(loop, end - now, end, worst);
+    now = end;
+  }
+}
+
+void event_loop_stats(event_loop_t *loop, event_loop_stats_t *out) {
+  out->spin_ns = STAT_LOAD(&loop->stats.spin_ns);
+  out->block_ns = STAT_LOAD(&loop->stats.block_ns);
+  out->work_ns = STAT_LOAD(&loop->stats.work_ns);
+  out->spin_hits = STAT_LOAD(&loop->stats.spin_hits);
+  out->wakeups = STAT_LOAD(&loop->stats.wakeups);
+}
+
+// 一个循环的单轮耗时和各回调耗时的分位数
+static int profile_report(event_loop_t *loop, int id, char *buf, int cap) {
+  const histogram_t *h = &loop->iter_hist;
+  int len = snprintf(buf, cap,
+                     "loop id=%d iteration p50=%.1fus p99=%.1fus "
+                     "max=%.1fus stalls=%llu\n",
+                     id, hist_percentile(h, 50) / 1e3,
+                     hist_percentile(h, 99) / 1e3,
+                     __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1e3,
+                     (unsigned long long)STAT_LOAD(&loop->stalls));
+  if (len < 0 || len >= cap)
+    return -1;
+
+  double scale = ns_per_tick() / 1e3;
+  int n_prof = __atomic_load_n(&loop->n_prof, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n_prof; i++) {
+    const cb_profile_t *p = loop->prof[i];
+    char name[32];
+    int n = snprintf(
+        buf + len, cap - len,
+        "loop id=%d cb=%s.%s n=%llu p50=%.1fus p99=%.1fus max=%.1fus\n", id,
+        callback_name(p->fn, name, sizeof(name)), p->write ? "write" : "read",
+        (unsigned long long)__atomic_load_n(&p->hist.count, __ATOMIC_RELAXED),
+        hist_percentile(&p->hist, 50) * scale,
+        hist_percentile(&p->hist, 99) * scale,
+        __atomic_load_n(&p->hist.max, __ATOMIC_RELAXED) * scale);
+    if (n < 0 || n >= cap - len)
+      return -1;
+    len += n;
+  }
+  return len;
+}
+
+int event_loop_report(char *buf, int cap) {
+  int len = 0;
+  buf[0] = 0;
+  pthread_mutex_lock(&loops_lock);
+  for (int i = 0; i < n_loops; i++) {
+    event_loop_stats_t st;
+    event_loop_stats(loops[i], &st);
+    uint64_t total = st.spin_ns + st.block_ns + st.work_ns;
+    int n = snprintf(buf + len, cap - len,
+                     "loop id=%d busy_poll=%lluus spin=%.1fms block=%.1fms "
+                     "work=%.1fms spin_hits=%llu wakeups=%llu work%%=%.1f\n",
+                     i, (unsigned long long)(loops[i]->busy_poll_ns / 1000),
+                     st.spin_ns / 1e6, st.block_ns / 1e6, st.work_ns / 1e6,
+                     (unsigned long long)st.spin_hits,
+                     (unsigned long long)st.wakeups,
+                     total ? 100.0 * st.work_ns / total : 0.0);
+    if (n < 0 || n >= cap - len) {
+      buf[len] = 0;
+      break;
+    }
+    len += n;
+    n = profile_report(loops[i], i, buf + len, cap - len);
+    if (n < 0) {
+      buf[len] = 0;
+      break;
+    }
+    len += n;
   }
+  pthread_mutex_unlock(&loops_lock);
+  return len;
 }
@@ -0,0 +1,64 @@
+#include <core/histogram.h>
+#include <string.h>
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+static int bucket_index(uint64_t v) {
+  if (v < HIST_SUB_COUNT)
+    return (int)v;
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) - HIST_SUB_COUNT);
+}
+
+// 桶内最大值
+static uint64_t bucket_upper(int idx) {
+  if (idx < HIST_SUB_COUNT)
+    return idx;
+  int shift = idx / HIST_SUB_COUNT - 1;
+  uint64_t sub = idx % HIST_SUB_COUNT + HIST_SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+void hist_reset(histogram_t *h) { memset(h, 0, sizeof(*h)); }
+
+void hist_record(histogram_t *h, uint64_t value) {
+  // 单写者：普通读改写即可，relaxed 只为让并发读取方看到完整的值
+  int idx = bucket_index(value);
+  STORE(&h->counts[idx], h->counts[idx] + 1);
+  STORE(&h->count, h->count + 1);
+  STORE(&h->sum, h->sum + value);
+  if (value > h->max)
+    STORE(&h->max, value);
+}
+
+void hist_merge(histogram_t *dst, const histogram_t *src) {
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    dst->counts[i] += LOAD(&src->counts[i]);
+  dst->count += LOAD(&src->count);
+  dst->sum += LOAD(&src->sum);
+  uint64_t max = LOAD(&src->max);
+  if (max > dst->max)
+    dst->max = max;
+}
+
+uint64_t hist_percentile(const histogram_t *h, double p) {
+  uint64_t count = LOAD(&h->count);
+  if (count == 0)
+    return 0;
+
+  uint64_t target = (uint64_t)(p / 100.0 * count + 0.5);
+  if (target == 0)
+    target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += LOAD(&h->counts[i]);
+    if (seen >= target) {
+      uint64_t upper = bucket_upper(i);
+      uint64_t max = LOAD(&h->max);
+      return upper < max ? upper : max;
+    }
+  }
+  return LOAD(&h->max);
+}
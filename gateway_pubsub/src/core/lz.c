@@ -0,0 +1,97 @@
+#include <core/lz.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // 块末尾至少 5 字节字面量
+#define LZ_MFLIMIT 12      // 最后一个匹配须在末尾 12 字节之前开始
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static int hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 长度超过 15 的部分：每字节 255，最后一个字节小于 255
+static uint8_t *put_len(uint8_t *op, int len) {
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+// 一个序列的最大编码长度
+static int seq_max(int lit, int mlen) {
+  return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+int lz_compress(const char *src, int n, char *dst, int cap) {
+  const uint8_t *base = (const uint8_t *)src;
+  const uint8_t *ip = base, *anchor = base, *end = base + n;
+  uint8_t *op = (uint8_t *)dst, *oend = op + cap;
+
+  if (n > LZ_MFLIMIT) { // 更短的输入只能全部作为字面量
+    const uint8_t *mflimit = end - LZ_MFLIMIT;
+    const uint8_t *matchlimit = end - LZ_LAST_LITERALS;
+    int32_t table[1 << LZ_HASH_BITS]; // 位置 + 1，0 表示空
+    memset(table, 0, sizeof(table));
+
+    while (ip < mflimit) {
+      uint32_t seq = read32(ip);
+      int h = hash4(seq);
+      int32_t ref = table[h] - 1;
+      table[h] = ip - base + 1;
+      if (ref < 0 || ip - base - ref > LZ_MAX_OFFSET ||
+          read32(base + ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      const uint8_t *match = base + ref;
+      while (ip > anchor && match > base && ip[-1] == match[-1]) {
+        ip--;
+        match--;
+      }
+      const uint8_t *p = ip + LZ_MIN_MATCH, *m = match + LZ_MIN_MATCH;
+      while (p < matchlimit && *p == *m) {
+        p++;
+        m++;
+      }
+
+      int lit = ip - anchor;
+      int mlen = p - ip - LZ_MIN_MATCH;
+      if (seq_max(lit, mlen) > oend - op)
+        return -1;
+      uint8_t *token = op++;
+      *token = (lit < 15 ? lit : 15) << 4;
+      if (lit >= 15)
+        op = put_len(op, lit - 15);
+      memcpy(op, anchor, lit);
+      op += lit;
+      int off = ip - match;
+      *op++ = off & 0xff; // 小端
+      *op++ = off >> 8;
+      *token |= mlen < 15 ? mlen : 15;
+      if (mlen >= 15)
+        op = put_len(op, mlen - 15);
+      ip = anchor = p;
+    }
+  }
+
+  int lit = end - anchor;
+  if (seq_max(lit, 0) > oend - op)
+    return -1;
+  uint8_t *token = op++;
+  *token = (lit < 15 ? lit : 15) << 4;
+  if (lit >= 15)
+    op = put_len(op, lit - 15);
+  memcpy(op, anchor, lit);
+  op += lit;
+  return op - (uint8_t *)dst;
+}
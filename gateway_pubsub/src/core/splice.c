@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <core/budget.h>
+#include <core/config.h>
+#include <core/splice.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int enabled = -1;
+static __thread int ingest_pipe[2] = {-1, -1};
+static int null_fd = -1; // 丢弃 ingest 管道数据，不经过用户态
+
+// 只在单线程模式下使用，不需要原子操作
+static uint64_t teed_bytes = 0;
+static uint64_t copied_bytes = 0;
+static uint64_t copies = 0;
+
+int splice_enabled(void) {
+  if (enabled < 0)
+    enabled = config_get_int("GATEWAY_SPLICE", 0) != 0;
+  return enabled;
+}
+
+void splice_disable(void) { enabled = 0; }
+
+int splice_ingest(int fd, int len) {
+  if (ingest_pipe[0] < 0 && pipe2(ingest_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    return -1;
+  return splice(fd, NULL, ingest_pipe[1], NULL, len,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+int splice_tee(connection_t *conn, int len) {
+  if (conn->pipe_rd < 0) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+      return 0;
+    conn->pipe_rd = fds[0];
+    conn->pipe_wr = fds[1];
+  }
+  int n = tee(ingest_pipe[0], conn->pipe_wr, len, SPLICE_F_NONBLOCK);
+  if (n <= 0)
+    return 0; // 管道已满，走普通路径
+  conn->pipe_len += n;
+  teed_bytes += n;
+  budget_account(n); // 管道中的数据同样占用内核内存
+  return n;
+}
+
+int splice_copy(char *buf, int len) {
+  int off = 0;
+  while (off < len) {
+    int n = read(ingest_pipe[0], buf + off, len - off);
+    if (n <= 0)
+      break;
+    off += n;
+  }
+  copied_bytes += off;
+  copies++;
+  return off;
+}
+
+void splice_discard(int len) {
+  if (null_fd < 0)
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  while (len > 0) {
+    int n = splice(ingest_pipe[0], NULL, null_fd, NULL, len, SPLICE_F_MOVE);
+    if (n <= 0) {
+      char buf[CONN_INBUF_SIZE];
+      splice_copy(buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf));
+      return;
+    }
+    len -= n;
+  }
+}
+
+int splice_flush(connection_t *conn) {
+  while (conn->pipe_len > 0) {
+    int n = splice(conn->pipe_rd, NULL, conn->fd, NULL, conn->pipe_len,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      conn->pipe_len -= n;
+      budget_account(-n);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void splice_unsplice(connection_t *conn) {
+  if (conn->pipe_len == 0)
+    return;
+  int need = conn->out_len + conn->pipe_len;
+  if (need > conn->out_cap) {
+    char *buf = realloc(conn->outbuf, need);
+    if (!buf)
+      return;
+    conn->outbuf = buf;
+    conn->out_cap = need;
+  }
+  memmove(conn->outbuf + conn->pipe_len, conn->outbuf, conn->out_len);
+  int off = 0;
+  while (off < conn->pipe_len) {
+    int n = read(conn->pipe_rd, conn->outbuf + off, conn->pipe_len - off);
+    if (n <= 0)
+      break;
+    off += n;
+  }
+  if (off < conn->pipe_len)
+    memmove(conn->outbuf + off, conn->outbuf + conn->pipe_len, conn->out_len);
+  conn->out_len += off;
+  budget_account(off - conn->pipe_len); // 已计入预算，只扣除没读出来的部分
+  conn->pipe_len = 0;
+}
+
+void splice_release(connection_t *conn) {
+  if (conn->pipe_rd < 0)
+    return;
+  close(conn->pipe_rd);
+  close(conn->pipe_wr);
+  conn->pipe_rd = conn->pipe_wr = -1;
+  budget_account(-conn->pipe_len);
+  conn->pipe_len = 0;
+}
+
+int splice_report(char *buf, int cap) {
+  if (!splice_enabled())
+    return 0;
+  int n = snprintf(buf, cap, "splice teed=%llu copied=%llu copies=%llu\n",
+                   (unsigned long long)teed_bytes,
+                   (unsigned long long)copied_bytes,
+                   (unsigned long long)copies);
+  return n < 0 ? 0 : n < cap ? n : cap - 1;
+}
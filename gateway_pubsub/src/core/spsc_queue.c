@@ -0,0 +1,51 @@
+#include <core/spsc_queue.h>
+#include <stdlib.h>
+
+spsc_queue_t *spsc_create(uint32_t capacity) {
+  uint32_t cap = 2;
+  while (cap < capacity)
+    cap <<= 1;
+
+  spsc_queue_t *q = aligned_alloc(64, (sizeof(spsc_queue_t) + 63) & ~63);
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->staged = 0;
+  q->mask = cap - 1;
+  q->slots = calloc(cap, sizeof(void *));
+  return q;
+}
+
+void spsc_destroy(spsc_queue_t *q) {
+  if (!q)
+    return;
+  free(q->slots);
+  free(q);
+}
+
+int spsc_push(spsc_queue_t *q, void *item) {
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  if (q->staged - head > q->mask)
+    return -1;
+  q->slots[q->staged & q->mask] = item;
+  q->staged++;
+  return 0;
+}
+
+int spsc_commit(spsc_queue_t *q) {
+  uint32_t old = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if (q->staged == old)
+    return 0;
+  // 与 spsc_pop 中的 head 写入/ tail 读取配对（seq_cst），
+  // 保证消费者要么看到新数据，要么生产者看到队列曾被取空并唤醒它
+  atomic_store(&q->tail, q->staged);
+  return atomic_load(&q->head) == old;
+}
+
+int spsc_pop(spsc_queue_t *q, void **item) {
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if (head == atomic_load(&q->tail))
+    return 0;
+  *item = q->slots[head & q->mask];
+  atomic_store(&q->head, head + 1);
+  return 1;
+}
@@ -0,0 +1,184 @@
+#include <bus/filter.h>
+#include <core/config.h>
+#include <protocol/dedup.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEDUP_STRIPES 64 // 按设备 ID 分段加锁，ingest 线程之间很少争用
+
+/*
+ * 每台设备一条记录，连续存放在开放寻址表中：
+ * 固定头部后面紧跟 words 个 uint64_t 位图，bit i 表示 high - i 已出现过。
+ */
+typedef struct {
+  int32_t id;
+  uint32_t used;
+  uint32_t high; // 见过的最大序号
+  uint32_t pad;
+  uint64_t bits[];
+} entry_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  char *slots; // cap 条记录，每条 stride 字节
+  int cap;     // 2 的幂
+  int used;
+} __attribute__((aligned(64))) stripe_t;
+
+static stripe_t stripes[DEDUP_STRIPES];
+static int words = 0; // 0 表示未启用
+static size_t stride = 0;
+static char field[FILTER_FIELD_LEN] = "seq";
+static int devices = 0;
+static uint64_t dropped = 0; // 窗口内重复
+static uint64_t resets = 0;  // 序号倒退超过窗口，按设备重启处理
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void dedup_init(void) {
+  long window = config_get_int("GATEWAY_DEDUP_WINDOW", 0);
+  if (window <= 0)
+    return;
+  if (window > DEDUP_WINDOW_MAX)
+    window = DEDUP_WINDOW_MAX;
+  words = (window + 63) / 64;
+  stride = sizeof(entry_t) + words * sizeof(uint64_t);
+  snprintf(field, sizeof(field), "%s",
+           config_get_str("GATEWAY_DEDUP_FIELD", "seq"));
+  for (int i = 0; i < DEDUP_STRIPES; i++)
+    pthread_mutex_init(&stripes[i].lock, NULL);
+}
+
+static uint32_t hash_id(int32_t id) {
+  uint32_t x = (uint32_t)id;
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+static entry_t *slot_at(const stripe_t *st, int i) {
+  return (entry_t *)(st->slots + (size_t)i * stride);
+}
+
+// 低位选分段，高位在段内探测
+static entry_t *probe(const stripe_t *st, int32_t id, uint32_t h) {
+  int mask = st->cap - 1;
+  for (int i = (h / DEDUP_STRIPES) & mask;; i = (i + 1) & mask) {
+    entry_t *e = slot_at(st, i);
+    if (!e->used || e->id == id)
+      return e;
+  }
+}
+
+static void grow(stripe_t *st) {
+  stripe_t old = *st;
+  st->cap = old.cap ? old.cap * 2 : 16;
+  st->slots = calloc(st->cap, stride);
+  for (int i = 0; i < old.cap; i++) {
+    entry_t *e = slot_at(&old, i);
+    if (e->used)
+      memcpy(probe(st, e->id, hash_id(e->id)), e, stride);
+  }
+  free(old.slots);
+}
+
+// 位图整体左移 d 位：原来的 bit i 变成 bit i + d
+static void shift(uint64_t *bits, uint32_t d) {
+  if (d >= (uint32_t)words * 64) {
+    memset(bits, 0, words * sizeof(uint64_t));
+    return;
+  }
+  int ws = d / 64, bs = d % 64;
+  for (int k = words - 1; k >= 0; k--) {
+    int src = k - ws;
+    uint64_t v = 0;
+    if (src >= 0) {
+      v = bits[src] << bs;
+      if (bs && src > 0)
+        v |= bits[src - 1] >> (64 - bs);
+    }
+    bits[k] = v;
+  }
+}
+
+/*
+ * 调用方持有分段锁。倒退超过窗口时重置窗口，按新序号处理。
+ *
+ * @return 0 新序号，1 窗口内重复
+ */
+static int seen(entry_t *e, uint32_t seq) {
+  int32_t diff = (int32_t)(seq - e->high); // 序号回绕时仍按先后比较
+  if (diff > 0) {
+    shift(e->bits, diff);
+    e->bits[0] |= 1;
+    e->high = seq;
+    return 0;
+  }
+  uint32_t back = -diff;
+  if (back >= (uint32_t)words * 64) {
+    // 窗口之外无从判断是否重复，视为设备重启后重新计数
+    __atomic_fetch_add(&resets, 1, __ATOMIC_RELAXED);
+    memset(e->bits, 0, words * sizeof(uint64_t));
+    e->bits[0] = 1;
+    e->high = seq;
+    return 0;
+  }
+  uint64_t bit = 1ull << (back % 64);
+  if (e->bits[back / 64] & bit)
+    return 1;
+  e->bits[back / 64] |= bit;
+  return 0;
+}
+
+int dedup_drop(const char *data, int len) {
+  pthread_once(&once, dedup_init);
+  if (words == 0)
+    return 0;
+
+  double id, seq;
+  if (!filter_field_value(data, len, field, &seq) || seq < 0 ||
+      seq > UINT32_MAX || !filter_field_value(data, len, FILTER_ID_FIELD, &id))
+    return 0;
+
+  uint32_t h = hash_id((int32_t)id);
+  stripe_t *st = &stripes[h % DEDUP_STRIPES];
+  pthread_mutex_lock(&st->lock);
+  int dup = 0;
+  entry_t *e = st->cap ? probe(st, (int32_t)id, h) : NULL;
+  if (e && e->used) {
+    dup = seen(e, (uint32_t)seq);
+  } else if (__atomic_load_n(&devices, __ATOMIC_RELAXED) < DEDUP_MAX_DEVICES) {
+    if ((st->used + 1) * 2 > st->cap) { // 负载因子保持在 1/2 以下
+      grow(st);
+      e = probe(st, (int32_t)id, h);
+    }
+    e->used = 1;
+    e->id = (int32_t)id;
+    e->high = (uint32_t)seq;
+    e->bits[0] = 1;
+    st->used++;
+    __atomic_fetch_add(&devices, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&st->lock);
+
+  if (dup)
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+  return dup;
+}
+
+int dedup_report(char *buf, int cap) {
+  pthread_once(&once, dedup_init);
+  if (words == 0)
+    return 0;
+  int n = snprintf(
+      buf, cap, "dedup window=%d devices=%d dropped=%llu resets=%llu\n",
+      words * 64, __atomic_load_n(&devices, __ATOMIC_RELAXED),
+      (unsigned long long)__atomic_load_n(&dropped, __ATOMIC_RELAXED),
+      (unsigned long long)__atomic_load_n(&resets, __ATOMIC_RELAXED));
+  return n < 0 ? 0 : n < cap ? n : cap - 1;
+}
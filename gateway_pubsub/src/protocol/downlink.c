@@ -0,0 +1,342 @@
+#include <bus/filter.h>
+#include <core/config.h>
+#include <core/event_loop.h>
+#include <protocol/downlink.h>
+#include <protocol/mcu_protocol.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DOWNLINK_TIMEOUT_DEFAULT 5000
+#define DOWNLINK_MAX_BYTES_DEFAULT 65536
+
+/* ========== 开放寻址哈希表（线性探测，删除时回移） ========== */
+
+typedef struct {
+  uint64_t key;
+  void *val; // NULL 表示空槽
+} slot_t;
+
+typedef struct {
+  slot_t *slots;
+  int cap; // 2 的幂
+  int used;
+} table_t;
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+static slot_t *table_find(table_t *t, uint64_t key) {
+  if (t->used == 0)
+    return NULL;
+  int mask = t->cap - 1;
+  for (int h = mix64(key) & mask; t->slots[h].val; h = (h + 1) & mask) {
+    if (t->slots[h].key == key)
+      return &t->slots[h];
+  }
+  return NULL;
+}
+
+static void table_put(table_t *t, uint64_t key, void *val);
+
+static void table_grow(table_t *t) {
+  table_t old = *t;
+  t->cap = old.cap ? old.cap * 2 : 16;
+  t->slots = calloc(t->cap, sizeof(slot_t));
+  t->used = 0;
+  for (int i = 0; i < old.cap; i++) {
+    if (old.slots[i].val)
+      table_put(t, old.slots[i].key, old.slots[i].val);
+  }
+  free(old.slots);
+}
+
+static void table_put(table_t *t, uint64_t key, void *val) {
+  if ((t->used + 1) * 2 > t->cap) // 负载因子保持在 1/2 以下
+    table_grow(t);
+  int mask = t->cap - 1;
+  int h = mix64(key) & mask;
+  while (t->slots[h].val && t->slots[h].key != key)
+    h = (h + 1) & mask;
+  if (!t->slots[h].val)
+    t->used++;
+  t->slots[h].key = key;
+  t->slots[h].val = val;
+}
+
+// 删除后把探测链上的后继元素前移，不留墓碑
+static void table_remove(table_t *t, slot_t *s) {
+  int mask = t->cap - 1;
+  int hole = s - t->slots;
+  for (int j = (hole + 1) & mask; t->slots[j].val; j = (j + 1) & mask) {
+    int home = mix64(t->slots[j].key) & mask;
+    // home 在 (hole, j] 之间（环形）的元素不能前移
+    int stays = hole <= j ? (home > hole && home <= j)
+                          : (home > hole || home <= j);
+    if (!stays) {
+      t->slots[hole] = t->slots[j];
+      hole = j;
+    }
+  }
+  t->slots[hole].val = NULL;
+  t->used--;
+}
+
+/* ========== 设备路由（所有线程共享） ========== */
+
+typedef struct {
+  int shard; // 拥有该 MCU 连接的线程
+  connection_t *conn; // 只能由 shard 对应的线程访问
+  int busy; // 下行积压达到上限，排空前新命令直接回复 busy
+} route_t;
+
+static table_t routes;
+static pthread_mutex_t routes_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int shard = 0;
+
+/* ========== 等待应答的请求（发起请求的线程私有） ========== */
+
+typedef struct {
+  int32_t device;
+  uint32_t req;
+  connection_t *conn;
+  event_timer_t *timer;
+} pending_t;
+
+static __thread table_t pending;
+static int outstanding = 0; // 所有线程等待中的请求数，为 0 时上行不检查 req
+static int timeout_ms = -1;
+static int max_bytes = -1;
+
+static __thread downlink_forward_t cmd_forwarder = NULL;
+static __thread downlink_reply_forward_t reply_forwarder = NULL;
+
+void downlink_set_shard(int index) { shard = index; }
+
+void downlink_set_forwarders(downlink_forward_t cmd,
+                             downlink_reply_forward_t reply) {
+  cmd_forwarder = cmd;
+  reply_forwarder = reply;
+}
+
+static uint64_t pending_key(int32_t device, uint32_t req) {
+  return (uint64_t)(uint32_t)device << 32 | req;
+}
+
+static int parse_req(const char *frame, int len, uint32_t *req) {
+  double v;
+  if (!filter_field_value(frame, len, DOWNLINK_REQ_FIELD, &v) || v < 0 ||
+      v > UINT32_MAX)
+    return 0;
+  *req = (uint32_t)v;
+  return 1;
+}
+
+// 控制流量走最高优先级，不排在遥测数据后面
+static void respond(connection_t *conn, const char *line, int len) {
+  if (len >= 0)
+    connection_append_msg(conn, OUT_PRIO_CRITICAL, line, len, 0, NULL);
+}
+
+static void pending_free(slot_t *s) {
+  pending_t *p = s->val;
+  table_remove(&pending, s);
+  __atomic_fetch_sub(&outstanding, 1, __ATOMIC_RELAXED);
+  free(p);
+}
+
+static void expire(void *arg) {
+  pending_t *p = arg;
+  char line[64];
+  respond(p->conn, line,
+          snprintf(line, sizeof(line), "ERR %d req=%u timeout\n",
+                   (int)p->device, p->req));
+  pending_free(table_find(&pending, pending_key(p->device, p->req)));
+}
+
+static void track(connection_t *conn, int32_t device, uint32_t req) {
+  if (timeout_ms < 0)
+    timeout_ms = config_get_int("GATEWAY_DOWNLINK_TIMEOUT_MS",
+                                DOWNLINK_TIMEOUT_DEFAULT);
+  uint64_t key = pending_key(device, req);
+  slot_t *s = table_find(&pending, key);
+  if (s) {
+    // 同一请求号重发：以最后一次为准
+    pending_t *old = s->val;
+    event_loop_cancel_timer(old->conn->loop, old->timer);
+    pending_free(s);
+  }
+
+  pending_t *p = malloc(sizeof(pending_t));
+  p->device = device;
+  p->req = req;
+  p->conn = conn;
+  p->timer = event_loop_add_timer(conn->loop, timeout_ms, expire, p);
+  table_put(&pending, key, p);
+  __atomic_fetch_add(&outstanding, 1, __ATOMIC_RELAXED);
+}
+
+void downlink_command(connection_t *conn, char *args) {
+  char *end;
+  long device = strtol(args, &end, 10);
+  char *frame = end + strspn(end, " ");
+  int len = strcspn(frame, "\r\n");
+  if (end == args || frame == end || len == 0) {
+    respond(conn, "ERR bad command\n", 16);
+    return;
+  }
+
+  pthread_mutex_lock(&routes_lock);
+  slot_t *s = table_find(&routes, (uint32_t)device);
+  int owner = s ? ((route_t *)s->val)->shard : -1;
+  int busy = s && ((route_t *)s->val)->busy;
+  pthread_mutex_unlock(&routes_lock);
+  if (owner < 0) {
+    char line[64];
+    respond(conn, line, snprintf(line, sizeof(line), "ERR %ld no route\n",
+                                 device));
+    return;
+  }
+
+  // 应答只会在本线程之后的事件中到达，先转发再登记请求不会错过
+  if (busy ||
+      (cmd_forwarder ? cmd_forwarder(owner, (int32_t)device, frame, len)
+                     : downlink_deliver((int32_t)device, frame, len)) < 0) {
+    char line[64];
+    respond(conn, line, snprintf(line, sizeof(line), "ERR %ld busy\n",
+                                 device));
+    return;
+  }
+
+  uint32_t req;
+  if (parse_req(frame, len, &req))
+    track(conn, (int32_t)device, req);
+}
+
+// 更新设备路由上的 busy 标志，供其他线程的 downlink_command() 查看
+static void set_busy(connection_t *mcu, int busy) {
+  pthread_mutex_lock(&routes_lock);
+  slot_t *s = table_find(&routes, (uint32_t)mcu->device_id);
+  if (s && ((route_t *)s->val)->conn == mcu)
+    ((route_t *)s->val)->busy = busy;
+  pthread_mutex_unlock(&routes_lock);
+}
+
+int downlink_deliver(int32_t device, const char *frame, int len) {
+  if (max_bytes < 0)
+    max_bytes = config_get_int("GATEWAY_DOWNLINK_MAX_BYTES",
+                               DOWNLINK_MAX_BYTES_DEFAULT);
+  pthread_mutex_lock(&routes_lock);
+  slot_t *s = table_find(&routes, (uint32_t)device);
+  route_t *r = s ? s->val : NULL;
+  connection_t *mcu = r && r->shard == shard ? r->conn : NULL;
+  pthread_mutex_unlock(&routes_lock);
+  if (!mcu || mcu->state == CONN_STATE_CLOSING)
+    return 0; // 设备在命令转发途中断开，请求方会等到超时
+
+  // 分隔符和帧一起预留，命令要么完整写入，要么整条拒绝
+  int delim = mcu_frame_delim();
+  int add_delim = delim >= 0 && (unsigned char)frame[len - 1] != delim;
+  int was_busy = mcu->downlink_busy;
+  if (connection_append_cmd(mcu, frame, len, max_bytes - add_delim) < 0) {
+    if (!was_busy)
+      set_busy(mcu, 1);
+    return -1;
+  }
+  if (add_delim) {
+    char d = (char)delim;
+    connection_append_cmd(mcu, &d, 1, max_bytes);
+  }
+  return 0;
+}
+
+void downlink_drained(connection_t *mcu) {
+  mcu->downlink_busy = 0;
+  if (mcu->device_known)
+    set_busy(mcu, 0);
+}
+
+// 连接上第一条带 id 的报文决定其设备 ID；设备重连后路由指向新连接
+static void learn(connection_t *mcu, const char *frame, int len) {
+  double id;
+  if (!filter_field_value(frame, len, FILTER_ID_FIELD, &id))
+    return;
+  mcu->device_id = (int32_t)id;
+  mcu->device_known = 1;
+
+  pthread_mutex_lock(&routes_lock);
+  slot_t *s = table_find(&routes, (uint32_t)mcu->device_id);
+  route_t *r = s ? s->val : malloc(sizeof(route_t));
+  r->shard = shard;
+  r->conn = mcu;
+  if (!s)
+    table_put(&routes, (uint32_t)mcu->device_id, r);
+  pthread_mutex_unlock(&routes_lock);
+}
+
+int downlink_outstanding(void) {
+  return __atomic_load_n(&outstanding, __ATOMIC_RELAXED) > 0;
+}
+
+int downlink_uplink(connection_t *mcu, const char *frame, int len) {
+  if (!mcu->device_known)
+    learn(mcu, frame, len);
+  if (__atomic_load_n(&outstanding, __ATOMIC_RELAXED) == 0 ||
+      !mcu->device_known)
+    return 0;
+
+  uint32_t req;
+  if (!parse_req(frame, len, &req))
+    return 0;
+  if (reply_forwarder)
+    reply_forwarder(mcu->device_id, frame, len);
+  else
+    downlink_reply(mcu->device_id, frame, len);
+  return 1;
+}
+
+void downlink_reply(int32_t device, const char *frame, int len) {
+  uint32_t req;
+  if (pending.used == 0 || !parse_req(frame, len, &req))
+    return;
+  slot_t *s = table_find(&pending, pending_key(device, req));
+  if (!s)
+    return; // 在其他 fan-out 线程上等待，或已超时
+  pending_t *p = s->val;
+  event_loop_cancel_timer(p->conn->loop, p->timer);
+  char line[CONN_INBUF_SIZE + 32];
+  respond(p->conn, line, snprintf(line, sizeof(line), "REPLY %d %.*s\n",
+                                  (int)device, len, frame));
+  pending_free(s);
+}
+
+void downlink_forget(connection_t *conn) {
+  if (conn->device_known) {
+    pthread_mutex_lock(&routes_lock);
+    slot_t *s = table_find(&routes, (uint32_t)conn->device_id);
+    if (s && ((route_t *)s->val)->conn == conn) {
+      free(s->val);
+      table_remove(&routes, s);
+    }
+    pthread_mutex_unlock(&routes_lock);
+    conn->device_known = 0;
+  }
+
+  // 删除会把后面的元素移到当前位置，所以删除后不前进
+  for (int i = 0; i < pending.cap && pending.used > 0;) {
+    pending_t *p = pending.slots[i].val;
+    if (p && p->conn == conn) {
+      event_loop_cancel_timer(conn->loop, p->timer);
+      pending_free(&pending.slots[i]);
+    } else {
+      i++;
+    }
+  }
+}
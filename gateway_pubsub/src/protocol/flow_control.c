@@ -0,0 +1,93 @@
+#include <bus/event_bus.h>
+#include <core/budget.h>
+#include <core/connection.h>
+#include <protocol/downlink.h>
+#include <protocol/flow_control.h>
+#include <protocol/mcu_protocol.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FLOW_INTERVAL_MS 100
+
+static int is_mcu(connection_t *c) { return c->on_read == handle_mcu_read; }
+
+// 暂停读入量不低于平均值的 MCU，预算回落后全部恢复
+static void throttle_mcus(budget_level_t level) {
+  uint64_t total = 0;
+  int active = 0;
+  for (connection_t *c = connection_list(); c; c = c->next) {
+    if (is_mcu(c) && !c->flow_paused) {
+      total += c->in_bytes - c->in_bytes_mark;
+      active++;
+    }
+  }
+
+  for (connection_t *c = connection_list(); c; c = c->next) {
+    if (!is_mcu(c))
+      continue;
+    uint64_t recent = c->in_bytes - c->in_bytes_mark;
+    c->in_bytes_mark = c->in_bytes;
+
+    if (level < BUDGET_PAUSE) {
+      if (c->flow_paused) {
+        c->flow_paused = 0;
+        if (!c->rate_paused) // 限速暂停由其定时器解除
+          connection_enable_read(c);
+      }
+    } else if (!c->flow_paused && recent > 0 && recent * active >= total) {
+      c->flow_paused = 1;
+      connection_disable_read(c);
+      budget_count(BUDGET_STAT_PAUSED);
+    }
+  }
+}
+
+static void evict_subscribers(void) {
+  while (budget_level() >= BUDGET_EVICT) {
+    connection_t *victim = NULL;
+    int victim_queued = 0;
+    for (connection_t *c = connection_list(); c; c = c->next) {
+      int queued = c->out_len + c->pending_len + c->pipe_len;
+      if (!is_mcu(c) && queued > victim_queued) {
+        victim = c;
+        victim_queued = queued;
+      }
+    }
+    if (!victim)
+      return; // 积压在其它线程
+    printf("output budget exhausted, evicting fd=%d (%d bytes queued)\n",
+           victim->fd, victim_queued);
+    budget_count(BUDGET_STAT_EVICTED);
+    event_unsubscribe_all(victim);
+    downlink_forget(victim);
+    connection_close(victim);
+  }
+}
+
+// 慢订阅端的 socket 可能一直不可写，handle_write 没有机会关闭它
+static void close_slow_subscribers(void) {
+  connection_t *c = connection_list();
+  while (c) {
+    connection_t *next = c->next;
+    if (c->state == CONN_STATE_CLOSING) {
+      event_unsubscribe_all(c);
+      downlink_forget(c);
+      connection_close(c);
+    }
+    c = next;
+  }
+}
+
+static void flow_tick(void *arg) {
+  event_loop_t *loop = arg;
+  close_slow_subscribers();
+  budget_level_t level = budget_level();
+  throttle_mcus(level);
+  if (level >= BUDGET_EVICT)
+    evict_subscribers();
+  event_loop_add_timer(loop, FLOW_INTERVAL_MS, flow_tick, loop);
+}
+
+void flow_control_init(event_loop_t *loop) {
+  event_loop_add_timer(loop, FLOW_INTERVAL_MS, flow_tick, loop);
+}
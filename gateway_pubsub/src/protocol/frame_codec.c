@@ -0,0 +1,98 @@
+#include <protocol/frame_codec.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+typedef int (*split_kernel_t)(const char *buf, int len, unsigned char delim,
+                              frame_cb_t cb, void *arg);
+
+static inline void emit(const char *buf, int start, int end, frame_cb_t cb,
+                        void *arg) {
+  if (end > start) // 连续的分隔符（空行、重复的同步字节）不产生帧
+    cb(buf + start, end - start, arg);
+}
+
+// 逐字节扫描 [i, len)，返回最后一个分隔符之后的偏移
+static inline int split_tail(const char *buf, int i, int len, int start,
+                             unsigned char delim, frame_cb_t cb, void *arg) {
+  for (; i < len; i++) {
+    if ((unsigned char)buf[i] == delim) {
+      emit(buf, start, i, cb, arg);
+      start = i + 1;
+    }
+  }
+  return start;
+}
+
+static int split_scalar(const char *buf, int len, unsigned char delim,
+                        frame_cb_t cb, void *arg) {
+  return split_tail(buf, 0, len, 0, delim, cb, arg);
+}
+
+/*
+ * The vector kernels compare a whole block against the delimiter and walk
+ * the set bits of the movemask, so each byte is examined once no matter how
+ * many frames the buffer holds.
+ */
+
+#ifdef __SSE2__
+static int split_sse2(const char *buf, int len, unsigned char delim,
+                      frame_cb_t cb, void *arg) {
+  __m128i d = _mm_set1_epi8((char)delim);
+  int start = 0, i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, d));
+    while (bits) {
+      int pos = i + __builtin_ctz(bits);
+      emit(buf, start, pos, cb, arg);
+      start = pos + 1;
+      bits &= bits - 1;
+    }
+  }
+  return split_tail(buf, i, len, start, delim, cb, arg);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static int
+split_avx2(const char *buf, int len, unsigned char delim, frame_cb_t cb,
+           void *arg) {
+  __m256i d = _mm256_set1_epi8((char)delim);
+  int start = 0, i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, d));
+    while (bits) {
+      int pos = i + __builtin_ctz(bits);
+      emit(buf, start, pos, cb, arg);
+      start = pos + 1;
+      bits &= bits - 1;
+    }
+  }
+  return split_tail(buf, i, len, start, delim, cb, arg);
+}
+#endif
+
+static split_kernel_t split_kernel(void) {
+  static split_kernel_t kernel = NULL;
+  if (kernel)
+    return kernel;
+
+  kernel = split_scalar;
+#ifdef __SSE2__
+  kernel = split_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    kernel = split_avx2;
+#endif
+  return kernel;
+}
+
+int frame_split(const char *buf, int len, unsigned char delim, frame_cb_t cb,
+                void *arg) {
+  return split_kernel()(buf, len, delim, cb, arg);
+}
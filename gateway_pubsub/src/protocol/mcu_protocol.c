@@ -1,28 +1,243 @@
 #include <bus/event_bus.h>
+#include <bus/filter.h>
+#include <bus/rollup.h>
+#include <core/clock.h>
+#include <core/config.h>
+#include <core/event_loop.h>
+#include <core/splice.h>
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <protocol/dedup.h>
+#include <protocol/downlink.h>
+#include <protocol/frame_codec.h>
 #include <protocol/mcu_protocol.h>
+#include <protocol/rate_limit.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
+#define FRAME_DELIM_UNSET -2
+
+/*
+ * GATEWAY_MCU_DELIM selects delimiter framing, e.g. 10 for newline
+ * terminated frames or 0x7e for sync-byte separated ones. When it is not
+ * set every read() is published as one message.
+ */
+static int frame_delim = FRAME_DELIM_UNSET;
+
+int mcu_frame_delim(void) {
+  if (frame_delim == FRAME_DELIM_UNSET) {
+    long d = config_get_int("GATEWAY_MCU_DELIM", -1);
+    frame_delim = d >= 0 && d <= 255 ? (int)d : -1;
+  }
+  return frame_delim;
+}
+
+// 一次读入的上下文，传给 frame_split 的回调
+typedef struct {
+  connection_t *conn;
+  uint64_t ingest_ns;
+  event_msg_t batch[FILTER_BATCH_MAX]; // 指向 inbuf，移动 inbuf 之前发布
+  int n;
+} read_ctx_t;
+
+// 发布原始报文，并计入窗口聚合；下行命令的应答只交给请求方
+static void publish_reading(connection_t *conn, const char *data, int len,
+                            uint64_t ingest_ns) {
+  if (dedup_drop(data, len))
+    return; // 重连后重发的帧
+  if (downlink_uplink(conn, data, len))
+    return;
+  event_publish_at("sensor", data, len, ingest_ns);
+  rollup_record(data, len);
+}
+
+// 一次读入的帧一起发布，过滤条件按批评估
+static void publish_batch(read_ctx_t *ctx) {
+  event_publish_batch("sensor", ctx->batch, ctx->n);
+  for (int m = 0; m < ctx->n; m++)
+    rollup_record(ctx->batch[m].data, ctx->batch[m].len);
+  ctx->n = 0;
+}
+
+static void publish_frame(const char *frame, int len, void *arg) {
+  read_ctx_t *ctx = arg;
+  if (frame_delim == '\n' && frame[len - 1] == '\r')
+    len--; // CRLF 结尾的固件
+  if (len == 0 || dedup_drop(frame, len) ||
+      downlink_uplink(ctx->conn, frame, len))
+    return;
+  ctx->batch[ctx->n++] = (event_msg_t){frame, len, ctx->ingest_ns};
+  if (ctx->n == FILTER_BATCH_MAX)
+    publish_batch(ctx);
+}
+
+static void close_mcu(connection_t *conn) {
+  downlink_forget(conn);
+  connection_close(conn);
+}
+
+/**
+ * Publishes every complete frame in conn->inbuf and keeps the incomplete
+ * tail for the next read.
+ *
+ * @param conn - MCU connection; inbuf holds `len` bytes.
+ * @param len - Bytes buffered, including the ones just read.
+ * @param ingest_ns - Time the data was read.
+ */
+static void split_inbuf(connection_t *conn, int len, uint64_t ingest_ns) {
+  int off = 0;
+  if (conn->in_discard) {
+    const char *p = memchr(conn->inbuf, frame_delim, len);
+    if (!p) {
+      conn->in_len = 0;
+      return;
+    }
+    off = p - conn->inbuf + 1;
+    conn->in_discard = 0;
+  }
+
+  read_ctx_t ctx = {.conn = conn, .ingest_ns = ingest_ns};
+  off += frame_split(conn->inbuf + off, len - off, (unsigned char)frame_delim,
+                     publish_frame, &ctx);
+  publish_batch(&ctx);
+  len -= off;
+  if (len == CONN_INBUF_SIZE) {
+    // 整个缓冲区没有分隔符：帧过长，丢弃并等待下一个分隔符重新同步
+    printf("MCU fd=%d: frame exceeds %d bytes, resyncing\n", conn->fd, len);
+    conn->in_discard = 1;
+    len = 0;
+  }
+  memmove(conn->inbuf, conn->inbuf + off, len);
+  conn->in_len = len;
+}
+
+static void handle_framed_read(connection_t *conn) {
+  while (1) {
+    int n = read(conn->fd, conn->inbuf + conn->in_len,
+                 CONN_INBUF_SIZE - conn->in_len);
+
+    if (n > 0) {
+      conn->in_bytes += n;
+      split_inbuf(conn, conn->in_len + n, clock_now_ns());
+      if (rate_limit_charge(conn, n))
+        return;
+    } else if (n == 0) {
+      // 对端关闭时把最后一个没有分隔符的帧也发布出去
+      if (!conn->in_discard && conn->in_len > 0) {
+        read_ctx_t ctx = {.conn = conn, .ingest_ns = clock_now_ns()};
+        publish_frame(conn->inbuf, conn->in_len, &ctx);
+        publish_batch(&ctx);
+      }
+      printf("Connection fd=%d closed by peer\n", conn->fd);
+      conn->state = CONN_STATE_READ_EOF;
+      close_mcu(conn);
+      return;
+    } else {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      close_mcu(conn);
+      return;
+    }
+  }
+}
+
+// 拼接模式下复制到用户态检查的报文头长度
+#define SPLICE_PEEK 256
+
+/**
+ * Returns how much of a peeked header can be parsed: all of it when the
+ * whole reading was peeked, else up to the last complete field.
+ */
+static int peeked_fields(const char *head, int peeked, int len) {
+  if (peeked >= len)
+    return len;
+  while (peeked > 0 && head[peeked - 1] != ' ')
+    peeked--;
+  return peeked;
+}
+
+// 原始数据直接进管道，由事件总线 tee 给订阅端；报文头先窥视到 inbuf，
+// 去重、下行路由和窗口聚合照常处理
+static void handle_spliced_read(connection_t *conn) {
+  while (1) {
+    int peeked = recv(conn->fd, conn->inbuf, SPLICE_PEEK, MSG_PEEK);
+    int n = splice_ingest(conn->fd, CONN_INBUF_SIZE);
+
+    if (n > 0) {
+      conn->in_bytes += n;
+      uint64_t now = clock_now_ns();
+      int head = peeked_fields(conn->inbuf, peeked > 0 ? peeked : 0, n);
+      if (head < n && downlink_outstanding()) {
+        // 可能是下行请求的应答，要转发整帧：取出后走普通路径
+        splice_copy(conn->inbuf, n);
+        publish_reading(conn, conn->inbuf, n, now);
+      } else if (dedup_drop(conn->inbuf, head) ||
+                 downlink_uplink(conn, conn->inbuf, head)) {
+        splice_discard(n);
+      } else {
+        rollup_record(conn->inbuf, head); // inbuf 随后可能被用作复制缓冲区
+        event_publish_spliced("sensor", n, now, conn->inbuf);
+      }
+      if (rate_limit_charge(conn, n))
+        return;
+    } else if (n == 0) {
+      printf("Connection fd=%d closed by peer\n", conn->fd);
+      conn->state = CONN_STATE_READ_EOF;
+      close_mcu(conn);
+      return;
+    } else {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      close_mcu(conn);
+      return;
+    }
+  }
+}
+
 void handle_mcu_read(connection_t *conn) {
+  // 同一批次中已暂停读取；对端已断开时照常读完并关闭
+  if ((conn->rate_paused || conn->flow_paused) && !conn->hangup)
+    return;
+  if (event_loop_busy_poll_us(conn->loop) > 0) {
+    // 内核在发出一次 ACK 后会退出 quickack 模式，每次读之前重新打开
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+  }
+
+  if (mcu_frame_delim() >= 0) {
+    handle_framed_read(conn);
+    return;
+  }
+  if (splice_enabled()) {
+    handle_spliced_read(conn);
+    return;
+  }
+
   while (1) {
 
-    int n = read(conn->fd, conn->inbuf, sizeof(conn->inbuf));
+    int n = read(conn->fd, conn->inbuf, CONN_INBUF_SIZE);
 
     if (n > 0) {
-      event_publish("sensor", conn->inbuf, n);
+      conn->in_bytes += n;
+      // 记录读入时间，用于统计到订阅端的排队延迟
+      publish_reading(conn, conn->inbuf, n, clock_now_ns());
+      if (rate_limit_charge(conn, n))
+        return;
 
     } else if (n == 0) {
       printf("Connection fd=%d closed by peer\n", conn->fd);
       conn->state = CONN_STATE_READ_EOF;
-      connection_close(conn);
+      close_mcu(conn);
       return;
     } else {
-      if (errno != EAGAIN || errno != EWOULDBLOCK) {
-        connection_close(conn);
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
         return;
-      }
+      close_mcu(conn);
+      return;
     }
   }
 }
@@ -46,9 +261,23 @@ void handle_mcu_read(connection_t *conn) {
 void handle_write(connection_t *conn) {
   if (conn->state == CONN_STATE_CLOSING) {
     event_unsubscribe_all(conn);
+    downlink_forget(conn);
     connection_close(conn);
     return;
   }
+  if (conn->pipe_len > 0) {
+    // 管道中的数据先于 outbuf 发出
+    if (splice_flush(conn) < 0) {
+      event_unsubscribe_all(conn);
+      downlink_forget(conn);
+      connection_close(conn);
+      return;
+    }
+    if (conn->pipe_len > 0)
+      return; // socket 已写满，等下一次可写
+  }
+  // 每次只把有限的数据排入 outbuf，其余按优先级留在各自队列
+  connection_fill_out(conn, OUT_WIRE_CHUNK);
   while (conn->out_len > 0) {
 
     int n = write(conn->fd, conn->outbuf, conn->out_len);
@@ -58,6 +287,8 @@ void handle_write(connection_t *conn) {
       memmove(conn->outbuf, conn->outbuf + n, conn->out_len - n);
 
       conn->out_len -= n;
+      connection_out_sent(conn, n);
+      connection_fill_out(conn, OUT_WIRE_CHUNK);
 
     } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
       printf("Unix socket not ready for writing, will retry later\n%s\n",
@@ -65,10 +296,14 @@ void handle_write(connection_t *conn) {
       return;
     } else {
       event_unsubscribe_all(conn);
+      downlink_forget(conn);
       connection_close(conn);
       return;
     }
   }
 
+  if (conn->downlink_busy)
+    downlink_drained(conn);
+  connection_trim(conn);
   connection_disable_write(conn);
 }
@@ -0,0 +1,166 @@
+#include <core/clock.h>
+#include <core/config.h>
+#include <core/event_loop.h>
+#include <protocol/rate_limit.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BURST_MS_DEFAULT 100
+
+typedef struct {
+  long lo, hi; // 设备 ID 闭区间
+  long rate;   // 字节/秒，0 表示不限
+} rate_class_t;
+
+static rate_class_t classes[RATE_MAX_CLASSES];
+static int n_classes = 0;
+static long default_rate = 0;
+static long burst_ms = BURST_MS_DEFAULT;
+static int any_limit = 0;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static uint64_t pauses = 0; // 所有线程累计暂停读取的次数
+
+// 一个 MCU 连接的令牌桶，单位为字节
+typedef struct mcu_rate {
+  long rate;
+  double burst;
+  double tokens;
+  uint64_t last_ns;
+  int classified; // 已按设备 ID 确定速率
+  event_timer_t *timer;
+} mcu_rate_t;
+
+// "1-99=65536,500=0"
+static void parse_classes(const char *s) {
+  while (*s && n_classes < RATE_MAX_CLASSES) {
+    int len = strcspn(s, ",");
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end > s && *end == '-')
+      hi = strtol(end + 1, &end, 10);
+    if (end > s && *end == '=' && end < s + len) {
+      rate_class_t *c = &classes[n_classes++];
+      c->lo = lo;
+      c->hi = hi;
+      c->rate = strtol(end + 1, NULL, 10);
+      if (c->rate > 0)
+        any_limit = 1;
+    } else {
+      fprintf(stderr, "bad MCU rate class '%.*s'\n", len, s);
+    }
+    s += s[len] ? len + 1 : len;
+  }
+}
+
+static void rate_limit_init(void) {
+  default_rate = config_get_int("GATEWAY_MCU_RATE", 0);
+  burst_ms = config_get_int("GATEWAY_MCU_BURST_MS", BURST_MS_DEFAULT);
+  if (burst_ms <= 0)
+    burst_ms = BURST_MS_DEFAULT;
+  any_limit = default_rate > 0;
+  parse_classes(config_get_str("GATEWAY_MCU_RATE_CLASSES", ""));
+}
+
+static void set_rate(mcu_rate_t *b, long rate) {
+  b->rate = rate;
+  b->burst = (double)rate * burst_ms / 1000;
+  if (b->burst < CONN_INBUF_SIZE)
+    b->burst = CONN_INBUF_SIZE; // 至少容得下一次完整的 read
+  if (b->tokens > b->burst)
+    b->tokens = b->burst;
+}
+
+static long class_rate(int32_t device) {
+  for (int i = 0; i < n_classes; i++) {
+    if (device >= classes[i].lo && device <= classes[i].hi)
+      return classes[i].rate;
+  }
+  return default_rate;
+}
+
+static void refill(mcu_rate_t *b, uint64_t now) {
+  b->tokens += (double)b->rate * (now - b->last_ns) / 1e9;
+  if (b->tokens > b->burst)
+    b->tokens = b->burst;
+  b->last_ns = now;
+}
+
+static void release(connection_t *mcu) {
+  mcu_rate_t *b = mcu->rate;
+  event_loop_cancel_timer(mcu->loop, b->timer);
+  free(b);
+  mcu->rate = NULL;
+}
+
+static void schedule_resume(connection_t *mcu);
+
+static void resume(void *arg) {
+  connection_t *mcu = arg;
+  mcu_rate_t *b = mcu->rate;
+  b->timer = NULL;
+  refill(b, clock_now_ns());
+  if (b->tokens < b->burst / 4) {
+    schedule_resume(mcu);
+    return;
+  }
+  mcu->rate_paused = 0;
+  if (!mcu->flow_paused) // 预算暂停由 flow_control 解除
+    connection_enable_read(mcu);
+}
+
+// 令牌补到桶容量的四分之一时恢复读取
+static void schedule_resume(connection_t *mcu) {
+  mcu_rate_t *b = mcu->rate;
+  double missing = b->burst / 4 - b->tokens;
+  uint64_t ms = (uint64_t)(missing * 1000 / b->rate) + 1;
+  b->timer = event_loop_add_timer(mcu->loop, ms, resume, mcu);
+}
+
+int rate_limit_charge(connection_t *mcu, int n) {
+  pthread_once(&once, rate_limit_init);
+  if (!any_limit)
+    return 0;
+
+  uint64_t now = clock_now_ns();
+  mcu_rate_t *b = mcu->rate;
+  if (!b) {
+    b = calloc(1, sizeof(mcu_rate_t));
+    set_rate(b, default_rate);
+    b->tokens = b->burst;
+    b->last_ns = now;
+    mcu->rate = b;
+    mcu->on_close = release;
+  }
+  if (!b->classified && mcu->device_known) {
+    b->classified = 1;
+    set_rate(b, class_rate(mcu->device_id));
+  }
+  if (b->rate <= 0)
+    return 0;
+
+  refill(b, now);
+  b->tokens -= n;
+  if (b->tokens > 0)
+    return 0;
+
+  if (!mcu->rate_paused) {
+    mcu->rate_paused = 1;
+    connection_disable_read(mcu);
+    __atomic_fetch_add(&pauses, 1, __ATOMIC_RELAXED);
+    schedule_resume(mcu);
+  }
+  return 1;
+}
+
+int rate_limit_report(char *buf, int cap) {
+  pthread_once(&once, rate_limit_init);
+  if (!any_limit)
+    return 0;
+  int n = snprintf(buf, cap, "ratelimit default=%ld classes=%d pauses=%llu\n",
+                   default_rate, n_classes,
+                   (unsigned long long)__atomic_load_n(&pauses,
+                                                       __ATOMIC_RELAXED));
+  return n < 0 ? 0 : n < cap ? n : cap - 1;
+}
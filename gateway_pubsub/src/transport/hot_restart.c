@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+#include <bus/event_bus.h>
+#include <bus/latency.h>
+#include <core/batch.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <core/splice.h>
+#include <protocol/downlink.h>
+#include <protocol/mcu_protocol.h>
+#include <transport/hot_restart.h>
+#include <transport/remote_listener.h>
+#include <transport/tcp_listener.h>
+#include <transport/unix_listener.h>
+
+// 交接期间收发阻塞的最长时间，防止对端异常时卡死
+#define HOT_RESTART_TIMEOUT_SEC 5
+// 单个订阅端可交接的主题列表长度上限
+#define HOT_RESTART_TOPICS_MAX 4096
+
+typedef struct hr_record {
+  uint32_t type;
+  int fd;
+  char *payload; // topics_len 字节主题名 + data_len 字节数据
+  uint32_t topics_len;
+  uint32_t data_len;
+  struct hr_record *next;
+} hr_record_t;
+
+// 按 listener 的记录类型索引
+static int inherited_listeners[HR_MSG_REMOTE_LISTENER + 1] = {-1, -1, -1, -1,
+                                                             -1, -1, -1};
+static hr_record_t *inherited = NULL;
+static connection_t *restart_listener = NULL;
+
+static int write_full(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int read_full(int fd, char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Sends one hand-off record, attaching fd (if >= 0) to its header.
+ *
+ * @return 0 on success, -1 if the successor went away.
+ */
+static int hr_send(int sock, uint32_t type, int fd, const char *topics,
+                   uint32_t topics_len, const char *data, uint32_t data_len) {
+  hr_msg_hdr_t hdr = {type, topics_len, data_len};
+  struct iovec iov = {&hdr, sizeof(hdr)};
+  char cbuf[CMSG_SPACE(sizeof(int))] = {0};
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd >= 0) {
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  ssize_t n = sendmsg(sock, &msg, 0);
+  if (n < 0)
+    return -1;
+  // fd 随第一个字节送达，剩余部分按普通流写入
+  if (write_full(sock, (char *)&hdr + n, sizeof(hdr) - n) < 0)
+    return -1;
+  if (write_full(sock, topics, topics_len) < 0)
+    return -1;
+  return write_full(sock, data, data_len);
+}
+
+/**
+ * Receives one hand-off record.
+ *
+ * @return The record, or NULL on a protocol or I/O error.
+ */
+static hr_record_t *hr_recv(int sock) {
+  hr_msg_hdr_t hdr;
+  struct iovec iov = {&hdr, sizeof(hdr)};
+  char cbuf[CMSG_SPACE(sizeof(int))];
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (n <= 0)
+    return NULL;
+  if (read_full(sock, (char *)&hdr + n, sizeof(hdr) - n) < 0)
+    return NULL;
+
+  hr_record_t *rec = calloc(1, sizeof(hr_record_t));
+  rec->type = hdr.type;
+  rec->fd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(&rec->fd, CMSG_DATA(cmsg), sizeof(int));
+
+  rec->topics_len = hdr.topics_len;
+  rec->data_len = hdr.data_len;
+  if (hdr.topics_len > HOT_RESTART_TOPICS_MAX || hdr.data_len > (1u << 30))
+    goto fail;
+  rec->payload = malloc(hdr.topics_len + hdr.data_len + 1);
+  if (!rec->payload ||
+      read_full(sock, rec->payload, hdr.topics_len + hdr.data_len) < 0)
+    goto fail;
+  return rec;
+
+fail:
+  if (rec->fd >= 0)
+    close(rec->fd);
+  free(rec->payload);
+  free(rec);
+  return NULL;
+}
+
+int hot_restart_inherit(void) {
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, HOT_RESTART_PATH);
+
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return 0; // 没有正在运行的旧进程，正常冷启动
+  }
+
+  struct timeval tv = {HOT_RESTART_TIMEOUT_SEC, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  int count = 0;
+  while (1) {
+    hr_record_t *rec = hr_recv(sock);
+    if (!rec) {
+      // 旧进程仍持有端口，无法再冷启动
+      fprintf(stderr, "hot restart: hand-off interrupted\n");
+      exit(EXIT_FAILURE);
+    }
+    if (rec->type == HR_MSG_END) {
+      free(rec->payload);
+      free(rec);
+      break;
+    }
+    if (rec->type == HR_MSG_TCP_LISTENER ||
+        rec->type == HR_MSG_UNIX_LISTENER ||
+        rec->type == HR_MSG_REMOTE_LISTENER) {
+      inherited_listeners[rec->type] = rec->fd;
+      free(rec->payload);
+      free(rec);
+    } else {
+      rec->next = inherited;
+      inherited = rec;
+      count++;
+    }
+  }
+
+  char ack = 1;
+  if (write_full(sock, &ack, 1) < 0) {
+    fprintf(stderr, "hot restart: failed to acknowledge hand-off\n");
+    exit(EXIT_FAILURE);
+  }
+  close(sock);
+
+  printf("hot restart: inherited listeners and %d connections\n", count);
+  return 1;
+}
+
+int hot_restart_take_listener(int type) {
+  int fd = inherited_listeners[type];
+  inherited_listeners[type] = -1;
+  return fd;
+}
+
+void hot_restart_adopt(event_loop_t *loop) {
+  while (inherited) {
+    hr_record_t *rec = inherited;
+    inherited = rec->next;
+
+    set_nonblocking(rec->fd);
+    connection_t *conn = connection_create(loop, rec->fd);
+    conn->on_write = handle_write;
+    char *data = rec->payload + rec->topics_len;
+
+    if (rec->type == HR_MSG_MCU) {
+      conn->on_read = handle_mcu_read;
+      if (rec->data_len <= CONN_INBUF_SIZE) {
+        memcpy(conn->inbuf, data, rec->data_len);
+        conn->in_len = rec->data_len;
+      }
+      event_loop_add(loop, conn->fd, conn->events, conn);
+    } else {
+      if (rec->type == HR_MSG_REMOTE_SUBSCRIBER)
+        remote_subscriber_setup(conn);
+      else
+        conn->on_read = handle_unix_read;
+      event_loop_add(loop, conn->fd, conn->events, conn);
+
+      char *topic = rec->payload;
+      char *end = rec->payload + rec->topics_len;
+      while (topic < end) {
+        char *next = topic + strlen(topic) + 1;
+        event_subscribe_args(conn, topic);
+        topic = next;
+      }
+      // 先写入旧进程未发完的数据（远程订阅端为整帧），保证订阅端看到的字节流连续
+      if (rec->data_len > 0)
+        connection_adopt_out(conn, data, rec->data_len);
+    }
+
+    free(rec->payload);
+    free(rec);
+  }
+}
+
+/**
+ * Sends every socket of this process to the successor.
+ *
+ * @return 0 if the whole state was sent, -1 otherwise.
+ */
+static int hr_send_all(int sock) {
+  connection_t *tcp = transport_tcp_listener();
+  connection_t *unix_l = transport_unix_listener();
+  connection_t *remote = transport_remote_listener();
+
+  if (tcp && hr_send(sock, HR_MSG_TCP_LISTENER, tcp->fd, NULL, 0, NULL, 0) < 0)
+    return -1;
+  if (unix_l &&
+      hr_send(sock, HR_MSG_UNIX_LISTENER, unix_l->fd, NULL, 0, NULL, 0) < 0)
+    return -1;
+  if (remote &&
+      hr_send(sock, HR_MSG_REMOTE_LISTENER, remote->fd, NULL, 0, NULL, 0) < 0)
+    return -1;
+
+  char topics[HOT_RESTART_TOPICS_MAX];
+  for (connection_t *c = connection_list(); c; c = c->next) {
+    if (c->state == CONN_STATE_CLOSING)
+      continue; // 即将关闭的慢订阅端不交接
+
+    int rc = 0;
+    if (c->on_read == handle_mcu_read) {
+      rc = hr_send(sock, HR_MSG_MCU, c->fd, NULL, 0, c->inbuf, c->in_len);
+    } else if (c->on_read == handle_unix_read ||
+               c->on_read == handle_remote_read) {
+      int topics_len = event_subscriptions(c, topics, sizeof(topics));
+      splice_unsplice(c); // 管道中的数据排在 outbuf 前面一起交接
+      batch_flush(c);     // 未满的帧也一起交接
+      connection_fill_out(c, INT_MAX); // 按优先级顺序合并进 outbuf 一起交接
+      rc = hr_send(sock,
+                   c->on_read == handle_remote_read ? HR_MSG_REMOTE_SUBSCRIBER
+                                                    : HR_MSG_SUBSCRIBER,
+                   c->fd, topics, topics_len, c->outbuf, c->out_len);
+    }
+    if (rc < 0)
+      return -1;
+  }
+
+  return hr_send(sock, HR_MSG_END, -1, NULL, 0, NULL, 0);
+}
+
+static void release_listener(connection_t *listener) {
+  if (!listener || listener->fd < 0)
+    return;
+  event_loop_del(listener->loop, listener->fd);
+  close(listener->fd);
+  listener->fd = -1;
+}
+
+/**
+ * Drops this process' copies of every handed-over socket.
+ *
+ * The successor holds its own references, so close() here neither resets
+ * connections nor loses queued accepts.
+ */
+static void hr_release_all(void) {
+  release_listener(transport_tcp_listener());
+  release_listener(transport_unix_listener());
+  release_listener(transport_remote_listener());
+  latency_signal_release();
+
+  connection_t *c = connection_list();
+  while (c) {
+    connection_t *next = c->next;
+    if (c->on_read == handle_unix_read || c->on_read == handle_remote_read)
+      event_unsubscribe_all(c);
+    downlink_forget(c); // 新进程从后续上行报文重新学习设备路由
+    connection_close(c);
+    c = next;
+  }
+
+  event_loop_del(restart_listener->loop, restart_listener->fd);
+  close(restart_listener->fd);
+  free(restart_listener);
+  restart_listener = NULL;
+}
+
+static void handle_restart_accept(connection_t *listener) {
+  int sock = accept(listener->fd, NULL, NULL);
+  if (sock < 0)
+    return;
+
+  printf("hot restart: handing sockets to new process\n");
+
+  // 交接过程同步完成，期间不处理其他事件，状态不会变化
+  struct timeval tv = {HOT_RESTART_TIMEOUT_SEC, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  char ack = 0;
+  if (hr_send_all(sock) < 0 || read_full(sock, &ack, 1) < 0 || ack != 1) {
+    // 新进程未确认，继续由本进程服务
+    printf("hot restart: hand-off aborted\n");
+    close(sock);
+    return;
+  }
+  close(sock);
+
+  hr_release_all();
+  printf("hot restart: hand-off complete\n");
+}
+
+void hot_restart_listen(event_loop_t *loop) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, HOT_RESTART_PATH);
+
+  unlink(HOT_RESTART_PATH);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("hot restart bind failed"); // 热重启不可用，但不影响正常服务
+    close(fd);
+    return;
+  }
+  listen(fd, 1);
+  set_nonblocking(fd);
+
+  restart_listener = calloc(1, sizeof(connection_t));
+  restart_listener->fd = fd;
+  restart_listener->loop = loop;
+  restart_listener->on_read = handle_restart_accept;
+  event_loop_name_callback(handle_restart_accept, "restart_accept");
+  restart_listener->events = EPOLLIN;
+  event_loop_add(loop, fd, restart_listener->events, restart_listener);
+}
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <bus/event_bus.h>
+#include <bus/filter.h>
+#include <bus/group.h>
+#include <bus/rollup.h>
+#include <core/config.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <core/splice.h>
+#include <core/spsc_queue.h>
+#include <protocol/downlink.h>
+#include <protocol/flow_control.h>
+#include <protocol/mcu_protocol.h>
+#include <transport/pipeline.h>
+#include <transport/remote_listener.h>
+#include <transport/unix_listener.h>
+
+#define PIPELINE_MAX_THREADS 64
+#define PIPELINE_QUEUE_DEFAULT 4096 // 每个 ingest -> fan-out 队列的槽位数
+#define PIPELINE_INBOX_SIZE 1024    // 主线程 -> 工作线程的新连接队列
+#define PIPELINE_CMD_QUEUE 256      // fan-out -> ingest 的下行命令队列
+
+typedef enum { WORKER_INGEST, WORKER_FANOUT } worker_kind_t;
+
+// 一条待分发的消息，由所有 fan-out 线程共享，最后一个使用者释放
+typedef struct pipeline_msg {
+  _Atomic int refs;
+  int len;
+  uint64_t ingest_ns;
+  int32_t device; // 下行命令 / 应答的设备 ID
+  int reply;      // 下行命令的应答，不经过事件总线
+  char topic[64];
+  char data[];
+} pipeline_msg_t;
+
+typedef struct worker {
+  pthread_t tid;
+  worker_kind_t kind;
+  int index;
+  int cpu; // -1 表示不绑核
+  event_loop_t *loop;
+  connection_t *wake; // eventfd，用于跨线程唤醒
+  spsc_queue_t *inbox; // 主线程分配过来的新连接 fd
+  spsc_queue_t **queues; // ingest: 发往每个 fan-out；fan-out: 来自每个 ingest
+  int n_queues;
+  spsc_queue_t **cmds; // 下行命令，ingest: 来自每个 fan-out；fan-out: 发往每个 ingest
+  int n_cmds;
+} worker_t;
+
+static worker_t *ingest = NULL;
+static worker_t *fanout = NULL;
+static int n_ingest = 0;
+static int n_fanout = 0;
+static int next_ingest = 0;
+static int next_fanout = 0;
+
+static __thread worker_t *self = NULL;
+
+static void wake_worker(worker_t *w) {
+  uint64_t one = 1;
+  if (write(w->wake->fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    perror("pipeline wake");
+}
+
+/* ========== ingest 线程 ========== */
+
+static void flush_queue(worker_t *w, int i) {
+  if (spsc_commit(w->queues[i]))
+    wake_worker(&fanout[i]);
+}
+
+static pipeline_msg_t *msg_create(int refs, const char *topic,
+                                   const char *data, int len,
+                                   uint64_t ingest_ns) {
+  pipeline_msg_t *msg = malloc(sizeof(pipeline_msg_t) + len);
+  atomic_init(&msg->refs, refs);
+  msg->len = len;
+  msg->ingest_ns = ingest_ns;
+  msg->device = 0;
+  msg->reply = 0;
+  strncpy(msg->topic, topic, sizeof(msg->topic) - 1);
+  msg->topic[sizeof(msg->topic) - 1] = 0;
+  memcpy(msg->data, data, len);
+  return msg;
+}
+
+// 从 fan-out 线程发来的下行命令
+static void ingest_commands(worker_t *w) {
+  void *item;
+  for (int i = 0; i < w->n_cmds; i++) {
+    while (spsc_pop(w->cmds[i], &item)) {
+      pipeline_msg_t *msg = item;
+      downlink_deliver(msg->device, msg->data, msg->len);
+      free(msg);
+    }
+  }
+}
+
+static void forward_all(worker_t *w, pipeline_msg_t *msg) {
+  for (int i = 0; i < w->n_queues; i++) {
+    while (spsc_push(w->queues[i], msg) < 0) {
+      // 队列满：先发布已暂存的批次，等 fan-out 腾出空间（对 MCU 形成背压）。
+      // 等待期间照常取走下行命令，fan-out 线程不会因命令队列满而互相等待
+      flush_queue(w, i);
+      ingest_commands(w);
+      sched_yield();
+    }
+  }
+}
+
+/**
+ * Bus forwarder of ingest threads: queues the message for every fan-out
+ * thread. Queues are committed in batches by ingest_tick().
+ */
+static void ingest_forward(const char *topic, const char *data, int len,
+                           uint64_t ingest_ns) {
+  forward_all(self, msg_create(self->n_queues, topic, data, len, ingest_ns));
+}
+
+// 应答广播给所有 fan-out 线程，只有等待该请求的线程会认领
+static void ingest_reply(int32_t device, const char *frame, int len) {
+  pipeline_msg_t *msg = msg_create(self->n_queues, "", frame, len, 0);
+  msg->device = device;
+  msg->reply = 1;
+  forward_all(self, msg);
+}
+
+// 每轮 epoll 处理完后一次性发布本轮读到的所有消息
+static void ingest_tick(event_loop_t *loop, void *arg) {
+  (void)loop; // 队列在 worker 里，不需要 loop
+  worker_t *w = arg;
+  for (int i = 0; i < w->n_queues; i++)
+    flush_queue(w, i);
+}
+
+/* ========== fan-out 线程 ========== */
+
+/**
+ * Publishes messages taken from an ingest queue. Runs of consecutive
+ * messages of the same topic are published as one batch, so their filters
+ * are evaluated together.
+ */
+static void deliver_batch(pipeline_msg_t **msgs, int n) {
+  event_msg_t run[FILTER_BATCH_MAX];
+  int n_run = 0;
+  for (int i = 0; i < n; i++) {
+    pipeline_msg_t *msg = msgs[i];
+    if (n_run > 0 &&
+        (msg->reply || strcmp(msg->topic, msgs[i - 1]->topic) != 0)) {
+      event_publish_batch(msgs[i - 1]->topic, run, n_run);
+      n_run = 0;
+    }
+    if (msg->reply)
+      downlink_reply(msg->device, msg->data, msg->len);
+    else
+      run[n_run++] = (event_msg_t){msg->data, msg->len, msg->ingest_ns};
+  }
+  if (n_run > 0)
+    event_publish_batch(msgs[n - 1]->topic, run, n_run);
+
+  for (int i = 0; i < n; i++) {
+    if (atomic_fetch_sub(&msgs[i]->refs, 1) == 1)
+      free(msgs[i]);
+  }
+}
+
+// 控制流量不攒批，立即提交并唤醒目标 ingest 线程；队列满时不等待
+static int fanout_command(int shard, int32_t device, const char *frame,
+                          int len) {
+  worker_t *w = self;
+  if (shard < 0 || shard >= w->n_cmds)
+    return -1;
+  pipeline_msg_t *msg = msg_create(1, "", frame, len, 0);
+  msg->device = device;
+  int rc = spsc_push(w->cmds[shard], msg);
+  if (rc < 0)
+    free(msg);
+  spsc_commit(w->cmds[shard]);
+  wake_worker(&ingest[shard]);
+  return rc < 0 ? -1 : 0;
+}
+
+/* ========== 通用 ========== */
+
+// inbox 中的条目为 fd * 2 + 是否远程订阅端
+static void adopt_fd(worker_t *w, intptr_t item) {
+  connection_t *conn = connection_create(w->loop, (int)(item >> 1));
+  if (w->kind == WORKER_INGEST) {
+    conn->on_read = handle_mcu_read;
+    conn->on_write = handle_write;
+  } else if (item & 1) {
+    remote_subscriber_setup(conn);
+  } else {
+    conn->on_read = handle_unix_read;
+    conn->on_write = handle_write;
+  }
+  event_loop_add(w->loop, conn->fd, conn->events, conn);
+}
+
+static void handle_wake(connection_t *conn) {
+  worker_t *w = conn->user_data;
+  uint64_t n;
+  if (read(conn->fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+    perror("pipeline eventfd");
+
+  void *item;
+  while (spsc_pop(w->inbox, &item))
+    adopt_fd(w, (intptr_t)item);
+
+  if (w->kind == WORKER_FANOUT) {
+    pipeline_msg_t *batch[FILTER_BATCH_MAX];
+    for (int i = 0; i < w->n_queues; i++) {
+      int n = 0;
+      while (spsc_pop(w->queues[i], &item)) {
+        batch[n++] = item;
+        if (n == FILTER_BATCH_MAX) {
+          deliver_batch(batch, n);
+          n = 0;
+        }
+      }
+      if (n > 0)
+        deliver_batch(batch, n);
+    }
+  } else {
+    ingest_commands(w);
+  }
+}
+
+static void *worker_main(void *arg) {
+  worker_t *w = arg;
+  self = w;
+
+  char name[16];
+  snprintf(name, sizeof(name), "%s-%d",
+           w->kind == WORKER_INGEST ? "ingest" : "fanout", w->index);
+  pthread_setname_np(pthread_self(), name);
+
+  if (w->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+      fprintf(stderr, "%s: cannot pin to cpu %d: %s\n", name, w->cpu,
+              strerror(rc));
+  }
+
+  event_bus_init();
+  if (w->kind == WORKER_INGEST) {
+    event_bus_set_forwarder(ingest_forward);
+    event_loop_set_tick(w->loop, ingest_tick, w);
+    rollup_init(w->loop); // 聚合在 ingest 线程完成，结果与原始报文一样转发
+    downlink_set_shard(w->index);
+    downlink_set_forwarders(NULL, ingest_reply);
+  } else {
+    group_set_shard(w->index); // 跨线程的消费组按消息选出唯一的投递线程
+    downlink_set_forwarders(fanout_command, NULL);
+  }
+  flow_control_init(w->loop);
+  event_loop_run(w->loop);
+  return NULL;
+}
+
+// 解析 "2,3,5" 形式的 CPU 列表
+static int parse_cpus(const char *list, int *cpus, int max) {
+  int n = 0;
+  while (list && *list && n < max) {
+    char *end;
+    long cpu = strtol(list, &end, 10);
+    if (end == list)
+      break;
+    cpus[n++] = (int)cpu;
+    list = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static worker_t *create_workers(worker_kind_t kind, int count,
+                                const char *cpu_list) {
+  int cpus[PIPELINE_MAX_THREADS];
+  int n_cpus = parse_cpus(cpu_list, cpus, PIPELINE_MAX_THREADS);
+
+  event_loop_name_callback(handle_wake, "pipeline_wake");
+  worker_t *workers = calloc(count, sizeof(worker_t));
+  for (int i = 0; i < count; i++) {
+    worker_t *w = &workers[i];
+    w->kind = kind;
+    w->index = i;
+    w->cpu = n_cpus ? cpus[i % n_cpus] : -1;
+    w->loop = event_loop_create();
+    w->inbox = spsc_create(PIPELINE_INBOX_SIZE);
+
+    w->wake = calloc(1, sizeof(connection_t));
+    w->wake->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    w->wake->loop = w->loop;
+    w->wake->on_read = handle_wake;
+    w->wake->events = EPOLLIN;
+    w->wake->user_data = w;
+    event_loop_add(w->loop, w->wake->fd, w->wake->events, w->wake);
+  }
+  return workers;
+}
+
+int pipeline_start(void) {
+  n_ingest = config_get_int("GATEWAY_INGEST_THREADS", 0);
+  n_fanout = config_get_int("GATEWAY_FANOUT_THREADS", 0);
+  if (n_ingest <= 0 || n_fanout <= 0) {
+    n_ingest = n_fanout = 0;
+    return 0;
+  }
+  if (n_ingest > PIPELINE_MAX_THREADS)
+    n_ingest = PIPELINE_MAX_THREADS;
+  if (n_fanout > PIPELINE_MAX_THREADS)
+    n_fanout = PIPELINE_MAX_THREADS;
+  splice_disable(); // 读入和写出不在同一线程，无法共用 ingest 管道
+
+  ingest = create_workers(WORKER_INGEST, n_ingest,
+                          config_get_str("GATEWAY_INGEST_CPUS", NULL));
+  fanout = create_workers(WORKER_FANOUT, n_fanout,
+                          config_get_str("GATEWAY_FANOUT_CPUS", NULL));
+
+  // 每对 (ingest i, fan-out j) 一条 SPSC 队列，全程无锁
+  int qsize = config_get_int("GATEWAY_PIPELINE_QUEUE", PIPELINE_QUEUE_DEFAULT);
+  for (int i = 0; i < n_ingest; i++) {
+    ingest[i].queues = calloc(n_fanout, sizeof(spsc_queue_t *));
+    ingest[i].n_queues = n_fanout;
+  }
+  for (int i = 0; i < n_ingest; i++) {
+    ingest[i].cmds = calloc(n_fanout, sizeof(spsc_queue_t *));
+    ingest[i].n_cmds = n_fanout;
+  }
+  for (int j = 0; j < n_fanout; j++) {
+    fanout[j].queues = calloc(n_ingest, sizeof(spsc_queue_t *));
+    fanout[j].n_queues = n_ingest;
+    fanout[j].cmds = calloc(n_ingest, sizeof(spsc_queue_t *));
+    fanout[j].n_cmds = n_ingest;
+    for (int i = 0; i < n_ingest; i++) {
+      spsc_queue_t *q = spsc_create(qsize);
+      ingest[i].queues[j] = q;
+      fanout[j].queues[i] = q;
+      // 反方向的下行命令队列，流量小，固定容量
+      q = spsc_create(PIPELINE_CMD_QUEUE);
+      ingest[i].cmds[j] = q;
+      fanout[j].cmds[i] = q;
+    }
+  }
+
+  for (int i = 0; i < n_fanout; i++)
+    pthread_create(&fanout[i].tid, NULL, worker_main, &fanout[i]);
+  for (int i = 0; i < n_ingest; i++)
+    pthread_create(&ingest[i].tid, NULL, worker_main, &ingest[i]);
+
+  printf("pipeline: %d ingest / %d fan-out threads\n", n_ingest, n_fanout);
+  return 1;
+}
+
+int pipeline_enabled(void) { return n_ingest > 0; }
+
+static void dispatch(worker_t *w, intptr_t item) {
+  while (spsc_push(w->inbox, (void *)item) < 0) {
+    spsc_commit(w->inbox);
+    wake_worker(w);
+    sched_yield();
+  }
+  spsc_commit(w->inbox);
+  wake_worker(w);
+}
+
+void pipeline_dispatch_mcu(int fd) {
+  dispatch(&ingest[next_ingest], (intptr_t)fd << 1);
+  next_ingest = (next_ingest + 1) % n_ingest;
+}
+
+void pipeline_dispatch_subscriber(int fd, int remote) {
+  dispatch(&fanout[next_fanout], (intptr_t)fd << 1 | (remote != 0));
+  next_fanout = (next_fanout + 1) % n_fanout;
+}
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util.h"
+#include <bus/event_bus.h>
+#include <core/batch.h>
+#include <core/config.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <protocol/mcu_protocol.h>
+#include <transport/hot_restart.h>
+#include <transport/pipeline.h>
+#include <transport/remote_listener.h>
+#include <transport/unix_listener.h>
+
+#define REMOTE_BACKLOG 64
+
+#define REMOTE_ADDR_DEFAULT "127.0.0.1"
+
+// 远程订阅是可选功能，地址或端口不可用时只报错，不影响本地服务
+static int create_remote_server(const char *ip, int port) {
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+    fprintf(stderr, "remote subscribers: bad address %s\n", ip);
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  int opt = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("remote subscriber bind failed");
+    close(fd);
+    return -1;
+  }
+  listen(fd, REMOTE_BACKLOG);
+
+  set_nonblocking(fd);
+  return fd;
+}
+
+// 远程订阅端只能订阅，SEND 等命令只接受本地连接
+static void handle_remote_command(connection_t *conn, char *line) {
+  if (strncmp(line, "SUB ", 4) == 0) {
+    event_subscribe_args(conn, line + 4);
+    return;
+  }
+  static const char err[] = "ERR only SUB is allowed\n";
+  connection_append_msg(conn, OUT_PRIO_CRITICAL, err, sizeof(err) - 1, 0,
+                        NULL);
+}
+
+void handle_remote_read(connection_t *conn) {
+  subscriber_read_commands(conn, handle_remote_command);
+}
+
+void remote_subscriber_setup(connection_t *conn) {
+  // 帧已在用户态攒批，不再等 Nagle
+  int one = 1;
+  setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  conn->on_read = handle_remote_read;
+  conn->on_write = handle_write;
+  batch_attach(conn);
+}
+
+void handle_remote_accept(connection_t *listener) {
+  while (1) {
+    int client_fd =
+        accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EAGAIN)
+        break;
+      return;
+    }
+
+    if (pipeline_enabled()) {
+      pipeline_dispatch_subscriber(client_fd, 1);
+      continue;
+    }
+
+    connection_t *conn = connection_create(listener->loop, client_fd);
+    remote_subscriber_setup(conn);
+    event_loop_add(conn->loop, conn->fd, conn->events, conn);
+  }
+}
+
+static connection_t *remote_listener = NULL;
+
+connection_t *transport_remote_listener(void) { return remote_listener; }
+
+void transport_remote_init(event_loop_t *loop) {
+  int fd = hot_restart_take_listener(HR_MSG_REMOTE_LISTENER);
+  int port = config_get_int("GATEWAY_SUB_PORT", 0);
+  if (fd < 0 && port <= 0)
+    return;
+  if (fd < 0)
+    fd = create_remote_server(
+        config_get_str("GATEWAY_REMOTE_ADDR", REMOTE_ADDR_DEFAULT), port);
+  if (fd < 0)
+    return;
+
+  event_loop_name_callback(handle_remote_accept, "remote_accept");
+  event_loop_name_callback(handle_remote_read, "remote_subscriber");
+  connection_t *listener = calloc(1, sizeof(connection_t));
+  listener->fd = fd;
+  listener->loop = loop;
+  listener->on_read = handle_remote_accept;
+
+  listener->events = EPOLLIN;
+  event_loop_add(listener->loop, listener->fd, listener->events, listener);
+  remote_listener = listener;
+
+  // 热重启继承的 listener 以实际绑定的地址为准
+  struct sockaddr_in addr = {0};
+  socklen_t len = sizeof(addr);
+  char ip[INET_ADDRSTRLEN] = "?";
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) == 0)
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  printf("remote subscribers on %s:%d\n", ip, ntohs(addr.sin_port));
+}
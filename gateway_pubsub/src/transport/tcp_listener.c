@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 // Defines error codes for detecting and handling error conditions
 #include <errno.h>
@@ -11,18 +12,48 @@
 #include <string.h>
 // Epoll library for scalable I/O event notification
 #include <sys/epoll.h>
+// getrlimit(RLIMIT_NOFILE) for the default connection cap
+#include <sys/resource.h>
+// TCP_NODELAY / TCP_QUICKACK for busy-poll mode
+#include <netinet/tcp.h>
 // Socket programming functions (e.g., socket, bind, listen, connect)
 #include <sys/socket.h>
 // Definitions for UNIX domain sockets
 #include <sys/un.h>
 // POSIX API for system calls (e.g., close, read, write)
 #include "util.h" // Include the header file for utility functions (e.g., set_nonblocking)
+#include <core/clock.h>
+#include <core/config.h>
 #include <core/event_loop.h> // Include the header file for the event loop implementation
 #include <protocol/mcu_protocol.h> // Include the header file for MCU protocol handling (e.g., handle_read, handle_write)
+#include <transport/hot_restart.h>
+#include <transport/pipeline.h>
+#include <transport/tcp_listener.h>
 #include <unistd.h>
 
 #define TCP_PORT 9000
 
+#define TCP_BACKLOG_DEFAULT 1024
+#define ACCEPT_BUDGET_DEFAULT 64 // 每次唤醒最多 accept 的连接数
+#define ACCEPT_RETRY_MS 100      // 达到上限后重新检查的间隔
+#define FD_RESERVE 32            // 为 listener、日志等保留的 fd
+
+/*
+ * Admission control for the MCU listener. When a limit is hit the listener
+ * stops polling for EPOLLIN and a timer re-enables it, so pending clients
+ * wait in the kernel backlog instead of competing with established
+ * connections for the event loop.
+ */
+static struct {
+  int budget;       // GATEWAY_ACCEPT_BUDGET
+  long max_conns;   // GATEWAY_MAX_CONNS，最大连接（MCU 与订阅端）数
+  long rate;        // GATEWAY_ACCEPT_RATE，每秒新建连接数，0 表示不限
+  long burst;       // GATEWAY_ACCEPT_BURST，令牌桶容量
+  double tokens;
+  uint64_t last_ns;
+  int overloaded;   // 已打印过暂停日志，成功 accept 后清除
+} admission;
+
 /**
  * Creates and sets up a non-blocking TCP server socket.
  * Binds the socket to the specified address and port, sets it to listen mode
@@ -56,13 +87,92 @@ int create_tcp_server() {
     close(fd);             // Close the socket file descriptor on failure
     exit(EXIT_FAILURE);    // Exit the program with failure status
   } // Bind the socket to the specified address and port
-  listen(fd,
-         128); // Start listening for incoming connections with a backlog of 128
+  // 断电重连时大量 MCU 同时建连，backlog 过小会导致 SYN 被丢弃后重传
+  listen(fd, config_get_int("GATEWAY_TCP_BACKLOG", TCP_BACKLOG_DEFAULT));
 
   set_nonblocking(fd);
   return fd;
 }
 
+static void admission_init(void) {
+  struct rlimit rl;
+  long fd_limit = 65536;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    fd_limit = (long)rl.rlim_cur;
+
+  admission.budget =
+      config_get_int("GATEWAY_ACCEPT_BUDGET", ACCEPT_BUDGET_DEFAULT);
+  if (admission.budget <= 0)
+    admission.budget = ACCEPT_BUDGET_DEFAULT;
+  admission.max_conns = config_get_int("GATEWAY_MAX_CONNS", fd_limit - FD_RESERVE);
+  admission.rate = config_get_int("GATEWAY_ACCEPT_RATE", 0);
+  admission.burst = config_get_int("GATEWAY_ACCEPT_BURST",
+                                   admission.rate > 0 ? admission.rate : 1);
+  if (admission.burst < 1)
+    admission.burst = 1;
+  admission.tokens = admission.burst;
+  admission.last_ns = clock_now_ns();
+}
+
+static void resume_accept(void *arg) {
+  connection_t *listener = arg;
+  if (listener->fd < 0)
+    return; // listener 已通过热重启交给新进程
+  connection_enable_read(listener);
+}
+
+static void pause_accept(connection_t *listener, uint64_t delay_ms,
+                         const char *reason) {
+  if (!admission.overloaded) {
+    printf("accept paused: %s (%d connections)\n", reason, connection_count());
+    admission.overloaded = 1;
+  }
+  connection_disable_read(listener);
+  event_loop_add_timer(listener->loop, delay_ms, resume_accept, listener);
+}
+
+/**
+ * Takes one token from the accept rate limiter.
+ *
+ * @param wait_ms - Set to the time until the next token when none is left.
+ * @return 1 if a connection may be accepted now, 0 otherwise.
+ */
+static int take_token(uint64_t *wait_ms) {
+  if (admission.rate <= 0)
+    return 1;
+  uint64_t now = clock_now_ns();
+  admission.tokens += (double)(now - admission.last_ns) * admission.rate / 1e9;
+  admission.last_ns = now;
+  if (admission.tokens > admission.burst)
+    admission.tokens = admission.burst;
+  if (admission.tokens >= 1) {
+    admission.tokens -= 1;
+    return 1;
+  }
+  *wait_ms = (uint64_t)((1 - admission.tokens) * 1000 / admission.rate) + 1;
+  return 0;
+}
+
+/**
+ * Tunes an MCU socket for the busy-poll mode of the event loop.
+ *
+ * SO_BUSY_POLL lets the kernel poll the NIC queue on reads; raising it
+ * above net.core.busy_read needs CAP_NET_ADMIN, so failures are only
+ * reported once.
+ */
+static void tune_low_latency(int fd, int busy_poll_us) {
+  static int warned = 0;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us,
+                 sizeof(busy_poll_us)) < 0 &&
+      !warned) {
+    perror("setsockopt SO_BUSY_POLL");
+    warned = 1;
+  }
+}
+
 /**
  * Accepts new incoming connections to the listener.
  *
@@ -73,16 +183,45 @@ int create_tcp_server() {
  * @param listener - Listener object.
  */
 void handle_accept(connection_t *listener) {
-  printf("accept triggered\n");
-  while (1) {
-    int client_fd = accept(listener->fd, NULL, NULL);
+  // 预算用完时剩余连接留在 backlog，水平触发的 epoll 下一轮会再次通知
+  for (int n = 0; n < admission.budget; n++) {
+    if (connection_count() >= admission.max_conns) {
+      pause_accept(listener, ACCEPT_RETRY_MS, "connection limit reached");
+      return;
+    }
+    uint64_t wait_ms = 0;
+    if (!take_token(&wait_ms)) {
+      pause_accept(listener, wait_ms, "accept rate limit");
+      return;
+    }
+
+    int client_fd =
+        accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_fd < 0) {
+      if (admission.rate > 0)
+        admission.tokens += 1; // 没有取到连接，退还令牌
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
       if (errno == EAGAIN || errno == EWOULDBLOCK)
         break;
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        pause_accept(listener, ACCEPT_RETRY_MS, strerror(errno));
+        return;
+      }
       perror("accept");
       break;
     }
-    set_nonblocking(client_fd);
+    admission.overloaded = 0;
+
+    uint64_t busy_poll_us = event_loop_busy_poll_us(listener->loop);
+    if (busy_poll_us > 0)
+      tune_low_latency(client_fd, (int)busy_poll_us);
+
+    if (pipeline_enabled()) {
+      pipeline_dispatch_mcu(client_fd); // 由 ingest 线程负责读取
+      continue;
+    }
 
     connection_t *tcp_conn = connection_create(listener->loop, client_fd);
     tcp_conn->on_read =
@@ -93,9 +232,20 @@ void handle_accept(connection_t *listener) {
   }
 }
 
+static connection_t *tcp_listener = NULL;
+
+connection_t *transport_tcp_listener(void) { return tcp_listener; }
+
 void transport_tcp_init(event_loop_t *loop) {
+  admission_init();
+  event_loop_name_callback(handle_accept, "tcp_accept");
+  event_loop_name_callback(handle_mcu_read, "mcu");
+  event_loop_name_callback(handle_write, "conn");
   connection_t *tcp_conn = calloc(1, sizeof(connection_t));
-  tcp_conn->fd = create_tcp_server();
+  // 热重启时直接复用旧进程的 listener，保留其 accept backlog
+  tcp_conn->fd = hot_restart_take_listener(HR_MSG_TCP_LISTENER);
+  if (tcp_conn->fd < 0)
+    tcp_conn->fd = create_tcp_server();
   tcp_conn->loop = loop;
   tcp_conn->on_read =
       handle_accept;         // Set the accept callback for the TCP listener
@@ -105,4 +255,5 @@ void transport_tcp_init(event_loop_t *loop) {
   tcp_conn->out_len = 0;
   tcp_conn->events = EPOLLIN; // Listen for incoming connections (read events)
   event_loop_add(loop, tcp_conn->fd, tcp_conn->events, tcp_conn);
+  tcp_listener = tcp_conn;
 }
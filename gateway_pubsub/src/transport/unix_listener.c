@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -8,9 +10,20 @@
 
 #include "util.h"
 #include <bus/event_bus.h>
+#include <bus/latency.h>
+#include <bus/rollup.h>
+#include <core/batch.h>
+#include <core/budget.h>
 #include <core/connection.h>
 #include <core/event_loop.h>
+#include <core/splice.h>
+#include <protocol/dedup.h>
+#include <protocol/downlink.h>
 #include <protocol/mcu_protocol.h>
+#include <protocol/rate_limit.h>
+#include <transport/hot_restart.h>
+#include <transport/pipeline.h>
+#include <transport/unix_listener.h>
 
 // Path to the UNIX socket used for interprocess communication
 #define UNIX_SOCKET_PATH "/tmp/gateway.sock"
@@ -35,35 +48,97 @@ int create_unix_server() {
   return fd;
 }
 
-void handle_unix_read(connection_t *conn) {
-  char buf[256];
+// 执行一行命令（已去掉行尾换行符）
+static void handle_command(connection_t *conn, char *buf) {
+  if (strncmp(buf, "SUB ", 4) == 0) {
+    // "SUB <topic> [GROUP <name>] [filter]"
+    event_subscribe_args(conn, buf + 4);
+  } else if (strncmp(buf, "SEND ", 5) == 0) {
+    // "SEND <device-id> <frame>"，命令下发给指定设备
+    downlink_command(conn, buf + 5);
+  } else if (strncmp(buf, "STATS", 5) == 0) {
+    // 管理命令：返回各主题的延迟分位数
+    char report[8192];
+    int len = latency_report(report, sizeof(report));
+    len += event_loop_report(report + len, sizeof(report) - len);
+    len += budget_report(report + len, sizeof(report) - len);
+    len += splice_report(report + len, sizeof(report) - len);
+    len += rate_limit_report(report + len, sizeof(report) - len);
+    len += dedup_report(report + len, sizeof(report) - len);
+    len += batch_report(report + len, sizeof(report) - len);
+    len += rollup_report(report + len, sizeof(report) - len);
+    // 走消息队列，远程订阅端收到的也是完整的帧
+    connection_append_msg(conn, OUT_PRIO_CRITICAL, report, len, 0, NULL);
+  }
+}
 
-  int n = read(conn->fd, buf, sizeof(buf) - 1);
+void subscriber_read_commands(connection_t *conn,
+                              void (*handle)(connection_t *, char *)) {
+  int fresh = conn->in_len == 0;
+  int n = read(conn->fd, conn->inbuf + conn->in_len,
+               CONN_INBUF_SIZE - conn->in_len);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
   if (n <= 0) {
     event_unsubscribe_all(conn);
+    downlink_forget(conn);
     connection_close(conn);
     return;
   }
-
-  buf[n] = 0;
-
-  if (strncmp(buf, "SUB ", 4) == 0) {
-    char *topic = buf + 4;
-    topic[strcspn(topic, "\r\n")] = 0;
-    event_subscribe(topic, conn);
+  conn->in_len += n;
+
+  char *line = conn->inbuf, *end = conn->inbuf + conn->in_len;
+  char *nl;
+  while ((nl = memchr(line, '\n', end - line))) {
+    *nl = 0;
+    if (nl > line && nl[-1] == '\r')
+      nl[-1] = 0;
+    conn->in_lines = 1;
+    if (conn->in_discard)
+      conn->in_discard = 0; // 超长行的剩余部分
+    else
+      handle(conn, line);
+    line = nl + 1;
   }
+  // 兼容不带换行符的旧客户端：一次 write 一条命令
+  if (fresh && !conn->in_lines && line < end &&
+      end < conn->inbuf + CONN_INBUF_SIZE) {
+    *end = 0;
+    if (end[-1] == '\r')
+      end[-1] = 0;
+    handle(conn, line);
+    line = end;
+  }
+  conn->in_len = end - line;
+  memmove(conn->inbuf, line, conn->in_len);
+
+  if (conn->in_len == CONN_INBUF_SIZE) {
+    if (!conn->in_discard)
+      connection_append_msg(conn, OUT_PRIO_CRITICAL, "ERR line too long\n",
+                            18, 0, NULL);
+    conn->in_len = 0;
+    conn->in_discard = 1;
+  }
+}
+
+void handle_unix_read(connection_t *conn) {
+  subscriber_read_commands(conn, handle_command);
 }
 
 void handle_unix_accept(connection_t *listener) {
   while (1) {
-    int client_fd = accept(listener->fd, NULL, NULL);
+    int client_fd =
+        accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_fd < 0) {
       if (errno == EAGAIN)
         break;
       return;
     }
 
-    set_nonblocking(client_fd);
+    if (pipeline_enabled()) {
+      pipeline_dispatch_subscriber(client_fd, 0); // 由 fan-out 线程负责写出
+      continue;
+    }
 
     connection_t *conn = connection_create(listener->loop, client_fd);
     conn->on_read = handle_unix_read;
@@ -73,13 +148,23 @@ void handle_unix_accept(connection_t *listener) {
   }
 }
 
+static connection_t *unix_listener = NULL;
+
+connection_t *transport_unix_listener(void) { return unix_listener; }
+
 void transport_unix_init(event_loop_t *loop) {
+  event_loop_name_callback(handle_unix_accept, "unix_accept");
+  event_loop_name_callback(handle_unix_read, "subscriber");
   connection_t *listener = calloc(1, sizeof(connection_t));
-  listener->fd = create_unix_server();
+  // 热重启时复用已绑定的 socket，避免 unlink 后重新 bind 导致订阅端连接失败
+  listener->fd = hot_restart_take_listener(HR_MSG_UNIX_LISTENER);
+  if (listener->fd < 0)
+    listener->fd = create_unix_server();
   listener->loop = loop;
   listener->on_read = handle_unix_accept;
 
   listener->events = EPOLLIN;
   event_loop_add(listener->loop, listener->fd, listener->events, listener);
+  unix_listener = listener;
   event_bus_init();
 }
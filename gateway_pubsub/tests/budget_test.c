@@ -0,0 +1,90 @@
+// Output budget accounting (core/budget.h): bytes in batch frames being
+// built and in subscriber splice pipes count against the budget until they
+// are queued, written or released.
+#include "test.h"
+#include <core/batch.h>
+#include <core/budget.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <core/splice.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static event_loop_t *loop;
+
+static connection_t *subscriber(int fd) {
+  connection_t *conn = connection_create(loop, fd);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  conn->high_watermark = 1 << 20;
+  return conn;
+}
+
+static void test_batch(void) {
+  connection_t *conn = subscriber(-1);
+  batch_attach(conn);
+  long base = budget_used();
+
+  char msg[100];
+  memset(msg, 'a', sizeof(msg));
+  for (int i = 0; i < 10; i++)
+    connection_append_msg(conn, OUT_PRIO_NORMAL, msg, sizeof(msg), 0, NULL);
+  CHECK(conn->out_len == 0);
+  CHECK(budget_used() - base == 10 * (1 + sizeof(msg))); // varint 前缀 1 字节
+
+  // 发出后只剩队列中的整帧
+  batch_flush(conn);
+  CHECK(conn->out_len > 0);
+  CHECK(budget_used() - base == conn->out_len + conn->pending_len);
+
+  connection_append_msg(conn, OUT_PRIO_NORMAL, msg, sizeof(msg), 0, NULL);
+  connection_close(conn);
+  CHECK(budget_used() == base);
+}
+
+static void test_splice(void) {
+  int mcu[2], sub[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, mcu) == 0);
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sub) == 0);
+  connection_t *conn = subscriber(sub[0]);
+  long base = budget_used();
+
+  char data[3000];
+  memset(data, 'x', sizeof(data));
+  CHECK(write(mcu[1], data, sizeof(data)) == sizeof(data));
+  CHECK(splice_ingest(mcu[0], sizeof(data)) == sizeof(data));
+  CHECK(splice_tee(conn, sizeof(data)) == sizeof(data));
+  splice_discard(sizeof(data));
+  CHECK(budget_used() - base == sizeof(data));
+
+  // 写进 socket 的部分退出预算
+  CHECK(splice_flush(conn) == 0 && conn->pipe_len == 0);
+  CHECK(budget_used() == base);
+
+  // 移回 outbuf 不重复计算，释放管道时扣除剩余部分
+  CHECK(write(mcu[1], data, 1000) == 1000);
+  CHECK(splice_ingest(mcu[0], 1000) == 1000);
+  CHECK(splice_tee(conn, 1000) == 1000);
+  splice_discard(1000);
+  splice_unsplice(conn);
+  CHECK(conn->out_len == 1000 && budget_used() - base == 1000);
+  CHECK(write(mcu[1], data, 500) == 500);
+  CHECK(splice_ingest(mcu[0], 500) == 500);
+  CHECK(splice_tee(conn, 500) == 500);
+  splice_discard(500);
+  CHECK(budget_used() - base == 1500);
+  connection_close(conn);
+  CHECK(budget_used() == base);
+  close(sub[1]);
+  close(mcu[0]);
+  close(mcu[1]);
+}
+
+int main(void) {
+  setenv("GATEWAY_SUB_COMPRESS", "0", 1);
+  loop = event_loop_create();
+  test_batch();
+  test_splice();
+  return test_report("budget_test");
+}
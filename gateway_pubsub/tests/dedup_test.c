@@ -0,0 +1,68 @@
+// Dedup window (protocol/dedup.h): repeats inside the window, bitmap
+// shifts across 64-bit words, resets on a jump back past the window and
+// sequence number wrap-around.
+#include "test.h"
+#include <protocol/dedup.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW 128 // 两个 64 位字，覆盖跨字移位
+
+static int drop(int id, uint32_t seq) {
+  char line[64];
+  int len = snprintf(line, sizeof(line), "id=%d seq=%u v=1", id, seq);
+  return dedup_drop(line, len);
+}
+
+int main(void) {
+  setenv("GATEWAY_DEDUP_WINDOW", "128", 1);
+
+  CHECK(drop(1, 1000) == 0);
+  CHECK(drop(1, 1000) == 1); // 重复
+  CHECK(drop(1, 1001) == 0);
+  CHECK(drop(1, 999) == 0); // 窗口内迟到
+  CHECK(drop(1, 999) == 1);
+
+  // 窗口边缘：high - 127 仍在窗口内
+  CHECK(drop(1, 1200) == 0);
+  CHECK(drop(1, 1200 - (WINDOW - 1)) == 0);
+  CHECK(drop(1, 1200 - (WINDOW - 1)) == 1);
+  // 移位时位图跨 64 位字进位
+  CHECK(drop(1, 1140) == 0);
+  CHECK(drop(1, 1210) == 0);
+  CHECK(drop(1, 1140) == 1);
+  CHECK(drop(1, 1200) == 1);
+
+  // 倒退恰好一个窗口：视为设备重启，从该序号重新开始
+  CHECK(drop(1, 1210 - WINDOW) == 0);
+  CHECK(drop(1, 1210 - WINDOW) == 1);
+  CHECK(drop(1, 1210) == 0); // 重置后旧的最大序号不再算重复
+
+  // 重启后从较大的序号重新计数，也不应丢弃
+  CHECK(drop(1, 500) == 0);
+  CHECK(drop(1, 501) == 0);
+  CHECK(drop(1, 500) == 1);
+
+  // 前进超过一个窗口清空位图
+  CHECK(drop(1, 501 + 1000) == 0);
+  CHECK(drop(1, 501 + 1000 - 1) == 0);
+
+  // 序号回绕仍按先后比较
+  CHECK(drop(2, UINT32_MAX - 1) == 0);
+  CHECK(drop(2, 1) == 0);
+  CHECK(drop(2, UINT32_MAX) == 0);
+  CHECK(drop(2, UINT32_MAX - 1) == 1);
+
+  // 设备之间互不影响；缺少字段的读数不参与去重
+  CHECK(drop(3, 1000) == 0);
+  CHECK(dedup_drop("id=1 v=1", 8) == 0);
+  CHECK(dedup_drop("id=1 v=1", 8) == 0);
+  CHECK(dedup_drop("seq=7 v=1", 9) == 0);
+  CHECK(dedup_drop("seq=7 v=1", 9) == 0);
+
+  char report[128];
+  CHECK(dedup_report(report, sizeof(report)) > 0);
+  CHECK(strstr(report, "devices=3") != NULL);
+  return test_report("dedup_test");
+}
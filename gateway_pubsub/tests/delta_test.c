@@ -0,0 +1,166 @@
+// Delta-encoded delivery (bus/delta.h): a subscriber-side decoder must
+// rebuild every reading from the K/D lines, and keyframes must be sent at
+// the interval, after shed messages and when the fields change.
+#include "test.h"
+#include <bus/delta.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYFRAME 4
+#define DEVICES 5
+#define LINE_MAX 256
+
+// 订阅端持有的每台设备的最后一帧
+static char last[DEVICES][LINE_MAX];
+
+static uint32_t rng = 362436069u;
+
+static uint32_t next_rand(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// 把 "key=value" 字段 f 写回 frame 中同名字段的位置
+static int replace_field(char *frame, const char *f, int flen) {
+  int klen = memchr(f, '=', flen) ? (int)((char *)memchr(f, '=', flen) - f) : 0;
+  char out[LINE_MAX];
+  int n = 0, found = 0;
+  for (char *p = frame; *p;) {
+    char *e = strchr(p, ' ');
+    int len = e ? e - p : (int)strlen(p);
+    if (n)
+      out[n++] = ' ';
+    if (len > klen && p[klen] == '=' && memcmp(p, f, klen) == 0) {
+      memcpy(out + n, f, flen);
+      n += flen;
+      found = 1;
+    } else {
+      memcpy(out + n, p, len);
+      n += len;
+    }
+    p += len + (e != NULL);
+  }
+  out[n] = 0;
+  strcpy(frame, out);
+  return found;
+}
+
+// 按协议解码一行，返回重建出的报文
+static const char *decode(const char *line, int len, int dev) {
+  static char frame[LINE_MAX];
+  CHECK(len >= 3 && line[1] == ' ' && line[len - 1] == '\n');
+  if (line[0] == 'K') {
+    memcpy(frame, line + 2, len - 3);
+    frame[len - 3] = 0;
+    if (dev >= 0)
+      strcpy(last[dev], frame);
+    return frame;
+  }
+  CHECK(line[0] == 'D');
+  CHECK(dev >= 0);
+  const char *p = line + 2, *end = line + len - 1;
+  int first = 1;
+  while (p < end) {
+    const char *e = memchr(p, ' ', end - p);
+    if (!e)
+      e = end;
+    if (first)
+      CHECK(strncmp(p, "id=", 3) == 0); // 增量帧以设备 ID 开头
+    else
+      CHECK(replace_field(last[dev], p, e - p));
+    first = 0;
+    p = e + 1;
+  }
+  strcpy(frame, last[dev]);
+  return frame;
+}
+
+static void test_roundtrip(void) {
+  delta_state_t *d = delta_create();
+  int temp[DEVICES] = {0}, hum[DEVICES] = {0};
+  int deltas = 0, keys = 0;
+  for (int i = 0; i < 2000; i++) {
+    int dev = next_rand() % DEVICES;
+    // 大多数读数只变一个字段
+    if (next_rand() % 2)
+      temp[dev] += (int)(next_rand() % 3) - 1;
+    if (next_rand() % 4 == 0)
+      hum[dev] = next_rand() % 100;
+    char msg[LINE_MAX];
+    int len = snprintf(msg, sizeof(msg), "id=%d temp=%d hum=%d volt=3.3", dev,
+                       temp[dev], hum[dev]);
+    int out_len;
+    const char *out = delta_encode(d, 0, msg, len, &out_len);
+    CHECK(out_len <= len + 3);
+    if (out[0] == 'K')
+      keys++;
+    else
+      deltas++;
+    if (strcmp(decode(out, out_len, dev), msg) != 0) {
+      fprintf(stderr, "reading %d: '%s' decoded as '%s'\n", i, msg,
+              decode(out, out_len, dev));
+      test_failures++;
+    }
+  }
+  CHECK(deltas > keys); // 大部分是增量帧
+  CHECK(keys >= 2000 / KEYFRAME - DEVICES); // 关键帧间隔生效
+  delta_free(d);
+}
+
+static int kind(delta_state_t *d, uint64_t shed, const char *msg) {
+  int out_len;
+  return delta_encode(d, shed, msg, strlen(msg), &out_len)[0];
+}
+
+static void test_keyframes(void) {
+  delta_state_t *d = delta_create();
+  CHECK(kind(d, 0, "id=1 temp=20 hum=40") == 'K'); // 首帧
+  CHECK(kind(d, 0, "id=1 temp=21 hum=40") == 'D');
+  CHECK(kind(d, 0, "id=1 temp=21 hum=41\r\n") == 'D'); // 去掉行尾
+  CHECK(kind(d, 1, "id=1 temp=22 hum=41") == 'K');     // 丢过消息
+  CHECK(kind(d, 1, "id=1 temp=23 hum=41") == 'D');
+  CHECK(kind(d, 1, "id=1 hum=41 temp=23") == 'K'); // 字段顺序变化
+  CHECK(kind(d, 1, "id=1 hum=41 temp=23 x=1") == 'K'); // 字段数量变化
+  CHECK(kind(d, 1, "temp=1") == 'K');                  // 没有 id
+  CHECK(kind(d, 1, "temp=1") == 'K');
+  CHECK(kind(d, 1, "id=2 t=1") == 'K');
+  CHECK(kind(d, 1, "id=2 t=2") == 'K'); // 增量不比原文短
+
+  // 第 KEYFRAME 条读数重新发关键帧
+  CHECK(kind(d, 1, "id=3 temp=1000 hum=40") == 'K');
+  for (int i = 1; i < KEYFRAME; i++) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "id=3 temp=%d hum=40", 1000 + i);
+    CHECK(kind(d, 1, msg) == 'D');
+  }
+  CHECK(kind(d, 1, "id=3 temp=2000 hum=40") == 'K');
+
+  // 设备 ID 按十进制解析：010 与 8 是不同设备
+  CHECK(kind(d, 1, "id=8 temp=1000 hum=40") == 'K');
+  CHECK(kind(d, 1, "id=010 temp=1001 hum=40") == 'K');
+  delta_free(d);
+}
+
+static void test_device_cap(void) {
+  delta_state_t *d = delta_create();
+  char msg[64];
+  for (int i = 0; i < DELTA_MAX_DEVICES; i++) {
+    snprintf(msg, sizeof(msg), "id=%d temp=1000 hum=40", i);
+    CHECK(kind(d, 0, msg) == 'K');
+  }
+  // 超出上限的设备不再跟踪，只发关键帧；已跟踪的设备不受影响
+  CHECK(kind(d, 0, "id=-1 temp=1000 hum=40") == 'K');
+  CHECK(kind(d, 0, "id=-1 temp=1001 hum=40") == 'K');
+  CHECK(kind(d, 0, "id=7 temp=1001 hum=40") == 'D');
+  delta_free(d);
+}
+
+int main(void) {
+  setenv("GATEWAY_DELTA_KEYFRAME", "4", 1);
+  test_roundtrip();
+  test_keyframes();
+  test_device_cap();
+  return test_report("delta_test");
+}
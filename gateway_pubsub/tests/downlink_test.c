@@ -0,0 +1,82 @@
+// Downlink commands (protocol/downlink.h): routing by learned device id and
+// the per-device backlog cap. A full MCU gets "busy" replies instead of
+// being closed as a slow subscriber, and accepts commands again once its
+// outbuf has drained.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <protocol/downlink.h>
+#include <stdlib.h>
+#include <string.h>
+
+static event_loop_t *loop;
+
+static connection_t *fake_conn(int fd) {
+  connection_t *conn = connection_create(loop, fd);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  return conn;
+}
+
+// 把后端收到的回复取成字符串并清空 outbuf
+static const char *replies(connection_t *backend) {
+  static char text[OUT_WIRE_CHUNK + 1];
+  memcpy(text, backend->outbuf, backend->out_len);
+  text[backend->out_len] = 0;
+  backend->out_len = 0;
+  return text;
+}
+
+static void send_cmd(connection_t *backend, const char *cmd) {
+  char args[256];
+  snprintf(args, sizeof(args), "%s", cmd);
+  downlink_command(backend, args);
+}
+
+int main(void) {
+  setenv("GATEWAY_MCU_DELIM", "10", 1);
+  setenv("GATEWAY_DOWNLINK_MAX_BYTES", "20000", 1);
+  loop = event_loop_create();
+  connection_t *mcu = fake_conn(10);
+  connection_t *backend = fake_conn(11);
+
+  send_cmd(backend, "7 reboot");
+  CHECK(strcmp(replies(backend), "ERR 7 no route\n") == 0);
+
+  CHECK(downlink_uplink(mcu, "id=7 temp=20", 12) == 0);
+  CHECK(mcu->device_known && mcu->device_id == 7);
+
+  // 99 字节的帧加上分隔符正好 100 字节，上限内能放 200 条，
+  // 远超订阅端的水位线也不会被当作慢订阅端断开
+  char cmd[128];
+  snprintf(cmd, sizeof(cmd), "7 %099d", 0);
+  for (int i = 0; i < 200; i++)
+    send_cmd(backend, cmd);
+  CHECK(mcu->out_len == 20000);
+  CHECK(mcu->out_len > mcu->high_watermark);
+  CHECK(mcu->state == CONN_STATE_OPEN);
+  CHECK(mcu->outbuf[99] == '\n');
+  CHECK(backend->out_len == 0);
+
+  // 超过上限：回复 busy，MCU 连接不受影响
+  send_cmd(backend, cmd);
+  CHECK(strcmp(replies(backend), "ERR 7 busy\n") == 0);
+  CHECK(mcu->out_len == 20000);
+  CHECK(mcu->state == CONN_STATE_OPEN);
+  CHECK(mcu->downlink_busy);
+  send_cmd(backend, "7 x");
+  CHECK(strcmp(replies(backend), "ERR 7 busy\n") == 0);
+
+  // 写空后恢复
+  connection_out_sent(mcu, mcu->out_len);
+  mcu->out_len = 0;
+  downlink_drained(mcu);
+  CHECK(!mcu->downlink_busy);
+  send_cmd(backend, "7 x");
+  CHECK(backend->out_len == 0);
+  CHECK(mcu->out_len == 2 && memcmp(mcu->outbuf, "x\n", 2) == 0);
+
+  downlink_forget(mcu);
+  send_cmd(backend, "7 x");
+  CHECK(strcmp(replies(backend), "ERR 7 no route\n") == 0);
+  return test_report("downlink_test");
+}
@@ -0,0 +1,283 @@
+// Content filters (bus/filter.h): expression compilation, matching
+// through the filter table one message at a time and in batches, and the
+// SSE2/AVX2 range and batch kernels checked against the scalar ones at
+// every padded length and misalignment.
+//
+// filter.c is compiled into the test so the static kernels can be called
+// directly.
+#include "../src/bus/filter.c"
+#include "test.h"
+#include <stdio.h>
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t next_rand(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static int matches(filter_t *f, const char *data) {
+  filter_t *filters[2] = {f, NULL}; // 订阅端 1 不带过滤器
+  filter_table_t *t = filter_table_build(filters, 2);
+  const uint64_t *mask = filter_table_eval(t, data, strlen(data));
+  int hit = mask[0] & 1;
+  CHECK(mask[0] & 2);
+  filter_table_free(t);
+  return hit;
+}
+
+static void test_compile_match(void) {
+  filter_t f;
+  CHECK(filter_compile("temp>30 hum<=80 id=3,5,7", &f) == 0);
+  CHECK(f.n_ids == 3);
+  CHECK(matches(&f, "id=3 temp=31 hum=80"));
+  CHECK(!matches(&f, "id=3 temp=30 hum=50")); // > 不含边界
+  CHECK(!matches(&f, "id=3 temp=31 hum=80.5"));
+  CHECK(!matches(&f, "id=4 temp=31 hum=50"));
+  CHECK(!matches(&f, "id=5 hum=50")); // 缺少字段
+  CHECK(matches(&f, "id=7,temp=40;hum=1"));
+
+  // 同一字段的条件取交集
+  CHECK(filter_compile("temp>=10 temp<20", &f) == 0);
+  CHECK(f.n_ranges == 1);
+  CHECK(matches(&f, "temp=10"));
+  CHECK(!matches(&f, "temp=20"));
+
+  // 设备 ID 按十进制解析
+  CHECK(filter_compile("id=010", &f) == 0);
+  CHECK(f.ids[0] == 10);
+  CHECK(matches(&f, "id=10 v=1"));
+  CHECK(!matches(&f, "id=8 v=1"));
+
+  CHECK(filter_compile("temp", &f) == -1);
+  CHECK(filter_compile("temp>", &f) == -1);
+  CHECK(filter_compile("temp>abc", &f) == -1);
+  CHECK(filter_compile("id=", &f) == -1);
+  CHECK(filter_compile("id=1,,2", &f) == -1);
+  CHECK(filter_compile("a>1 b>1 c>1 d>1 e>1", &f) == -1); // 超过 4 个字段
+  CHECK(filter_compile("id=1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17", &f) ==
+        -1);
+}
+
+/* ========== 向量核与标量核对拍 ========== */
+
+#define KERNEL_MAX 256
+
+static float pick_value(void) {
+  static const float edges[] = {-INFINITY, -1.0f, -0.0f, 0.0f,
+                                0.5f,      1.0f,  INFINITY};
+  uint32_t r = next_rand();
+  if (r % 3 == 0)
+    return edges[r / 3 % (sizeof(edges) / sizeof(edges[0]))];
+  return (float)((int)(r % 9) - 4) / 2; // -2 .. 2，步长 0.5，常与边界相等
+}
+
+static void check_kernel(const char *name, range_kernel_t kernel,
+                         const float *lo, const float *hi, float v, int n) {
+  uint64_t want[KERNEL_MAX / 64 + 1] = {0}, got[KERNEL_MAX / 64 + 1] = {0};
+  range_mask_scalar(lo, hi, v, n, want);
+  kernel(lo, hi, v, n, got);
+  if (memcmp(want, got, sizeof(want)) != 0) {
+    fprintf(stderr, "%s kernel differs: n=%d v=%g\n", name, n, v);
+    test_failures++;
+  }
+}
+
+static void test_kernels(void) {
+  static float lo[KERNEL_MAX + 8], hi[KERNEL_MAX + 8];
+  for (int i = 0; i < KERNEL_MAX + 8; i++) {
+    float a = pick_value(), b = pick_value();
+    // 也包含 lo > hi 的空区间，即补齐部分的写法
+    lo[i] = next_rand() % 8 ? (a < b ? a : b) : INFINITY;
+    hi[i] = next_rand() % 8 ? (a < b ? b : a) : -INFINITY;
+  }
+  const float probes[] = {-INFINITY, -2.0f, -1.0f, -0.0f, 0.0f, 0.25f,
+                          0.5f,      1.0f,  2.0f,  INFINITY, NAN};
+  int avx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (!avx2)
+    printf("filter_test: no AVX2 on this CPU, kernel not checked\n");
+
+  // 长度都是 8 的倍数（表按 8 补齐），偏移让加载跨越各种对齐
+  for (int n = 8; n <= KERNEL_MAX; n += 8) {
+    for (int off = 0; off < 8; off++) {
+      for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+#ifdef __SSE2__
+        check_kernel("sse2", range_mask_sse2, lo + off, hi + off, probes[p], n);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        if (avx2)
+          check_kernel("avx2", range_mask_avx2, lo + off, hi + off, probes[p],
+                       n);
+#endif
+      }
+    }
+  }
+}
+
+static void check_batch_kernel(const char *name, batch_kernel_t kernel,
+                               const float *v, int n, float lo, float hi) {
+  uint64_t want = batch_mask_scalar(v, n, lo, hi);
+  uint64_t got = kernel(v, n, lo, hi);
+  if (want != got) {
+    fprintf(stderr, "%s batch kernel differs: n=%d [%g, %g]\n", name, n, lo,
+            hi);
+    test_failures++;
+  }
+}
+
+static void test_batch_kernels(void) {
+  // 缺失字段为 NaN，任何区间都不匹配
+  static float v[FILTER_BATCH_MAX + 8];
+  for (int i = 0; i < FILTER_BATCH_MAX + 8; i++)
+    v[i] = next_rand() % 6 ? pick_value() : NAN;
+  int avx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+  for (int n = 8; n <= FILTER_BATCH_MAX; n += 8) {
+    for (int off = 0; off < 8; off++) {
+      for (int r = 0; r < 40; r++) {
+        float a = pick_value(), b = pick_value();
+        float lo = a < b ? a : b, hi = a < b ? b : a;
+        if (r == 0) {
+          lo = -INFINITY; // 不限制，只有 NaN 不匹配
+          hi = INFINITY;
+        }
+#ifdef __SSE2__
+        check_batch_kernel("sse2", batch_mask_sse2, v + off, n, lo, hi);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        if (avx2)
+          check_batch_kernel("avx2", batch_mask_avx2, v + off, n, lo, hi);
+#endif
+      }
+    }
+  }
+}
+
+/* ========== 过滤表与逐个判断对拍 ========== */
+
+static const char *const fields[] = {"a", "b", "c"};
+
+static int match_one(const filter_t *f, const float *vals, const int *has,
+                     int id) {
+  for (int r = 0; r < f->n_ranges; r++) {
+    int k = f->ranges[r].field[0] - 'a';
+    if (!has[k] || !(vals[k] >= f->ranges[r].lo && vals[k] <= f->ranges[r].hi))
+      return 0;
+  }
+  if (f->n_ids == 0)
+    return 1;
+  for (int i = 0; i < f->n_ids; i++) {
+    if (id >= 0 && f->ids[i] == id)
+      return 1;
+  }
+  return 0;
+}
+
+// 随机生成一条报文，字段值和 ID 写入 vals / has / id
+static int random_message(char *msg, int cap, float *vals, int *has,
+                          int *id) {
+  int len = 0;
+  *id = -1;
+  if (next_rand() % 4) {
+    *id = next_rand() % 5;
+    len += snprintf(msg + len, cap - len, "id=%d ", *id);
+  }
+  for (int k = 0; k < 3; k++) {
+    has[k] = 0;
+    if (next_rand() % 4 == 0)
+      continue; // 字段缺失
+    has[k] = 1;
+    vals[k] = (float)((int)(next_rand() % 15) - 7) / 2;
+    len += snprintf(msg + len, cap - len, "%s=%g ", fields[k], vals[k]);
+  }
+  return len;
+}
+
+static void check_mask(const uint64_t *mask, filter_t **filters, int n,
+                       const char *msg, const float *vals, const int *has,
+                       int id, const char *how) {
+  for (int i = 0; i < n; i++) {
+    int want = !filters[i] || match_one(filters[i], vals, has, id);
+    int got = (mask[i >> 6] >> (i & 63)) & 1;
+    if (want != got) {
+      fprintf(stderr, "%s n=%d sub=%d '%s' on '%s': want %d got %d\n", how,
+              n, i, filters[i] ? filters[i]->expr : "", msg, want, got);
+      test_failures++;
+    }
+  }
+}
+
+static void test_table(void) {
+  static const char *const ops[] = {">", ">=", "<", "<=", "="};
+  // 订阅端数量跨过 8 的补齐和 64 位掩码字的边界
+  const int counts[] = {1, 7, 8, 9, 63, 64, 65, 130};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int n = counts[c];
+    filter_t *store = calloc(n, sizeof(filter_t));
+    filter_t **filters = calloc(n, sizeof(filter_t *));
+    for (int i = 0; i < n; i++) {
+      if (next_rand() % 5 == 0)
+        continue; // 不带过滤器
+      char expr[FILTER_EXPR_LEN];
+      int len = 0;
+      int clauses = 1 + next_rand() % 3;
+      for (int k = 0; k < clauses; k++)
+        len += snprintf(expr + len, sizeof(expr) - len, "%s%s%d ",
+                        fields[next_rand() % 3], ops[next_rand() % 5],
+                        (int)(next_rand() % 7) - 3);
+      if (next_rand() % 3 == 0)
+        snprintf(expr + len, sizeof(expr) - len, "id=%d,%d",
+                 (int)(next_rand() % 4), (int)(next_rand() % 4));
+      CHECK(filter_compile(expr, &store[i]) == 0);
+      filters[i] = &store[i];
+    }
+    filter_table_t *t = filter_table_build(filters, n);
+
+    for (int m = 0; m < 200; m++) {
+      char msg[128];
+      int has[3], id;
+      float vals[3];
+      int len = random_message(msg, sizeof(msg), vals, has, &id);
+      check_mask(filter_table_eval(t, msg, len), filters, n, msg, vals, has,
+                 id, "table");
+    }
+
+    // 批量评估：批大小跨过订阅端数量（两种评估方式）和 8 的补齐
+    static char msgs[FILTER_BATCH_MAX][128];
+    static float vals[FILTER_BATCH_MAX][3];
+    static int has[FILTER_BATCH_MAX][3], ids[FILTER_BATCH_MAX];
+    const char *data[FILTER_BATCH_MAX];
+    int lens[FILTER_BATCH_MAX];
+    for (int b = 1; b <= FILTER_BATCH_MAX; b += 1 + b / 8) {
+      for (int m = 0; m < b; m++) {
+        lens[m] = random_message(msgs[m], sizeof(msgs[m]), vals[m], has[m],
+                                 &ids[m]);
+        data[m] = msgs[m];
+      }
+      const uint64_t *masks = filter_table_eval_batch(t, data, lens, b);
+      int words = filter_table_words(t);
+      for (int m = 0; m < b; m++)
+        check_mask(masks + m * words, filters, n, msgs[m], vals[m], has[m],
+                   ids[m], "batch");
+    }
+    filter_table_free(t);
+    free(filters);
+    free(store);
+  }
+}
+
+int main(void) {
+  test_compile_match();
+  test_kernels();
+  test_batch_kernels();
+  test_table();
+  return test_report("filter_test");
+}
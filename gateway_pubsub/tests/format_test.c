@@ -0,0 +1,112 @@
+// Output formats (bus/format.h): JSON and CSV encoding of readings, and
+// the bus encoding each message once per format in use rather than once
+// per subscriber.
+#include "test.h"
+#include <bus/event_bus.h>
+#include <bus/format.h>
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <string.h>
+
+// 链接时 --wrap=format_encode，统计编码次数
+static int encodes = 0;
+int __real_format_encode(int format, const char *data, int len, char *out);
+int __wrap_format_encode(int format, const char *data, int len, char *out) {
+  encodes++;
+  return __real_format_encode(format, data, len, out);
+}
+
+static void check_encode(int format, const char *in, const char *want) {
+  char out[256];
+  int len = strlen(in);
+  CHECK(format_max_len(format, len) <= (int)sizeof(out));
+  int n = format_encode(format, in, len, out);
+  CHECK(n <= format_max_len(format, len));
+  if (n != (int)strlen(want) || memcmp(out, want, n) != 0) {
+    fprintf(stderr, "%s of '%s': got '%.*s', want '%s'\n", format_name(format),
+            in, n, out, want);
+    test_failures++;
+  }
+}
+
+static void test_encode(void) {
+  check_encode(FORMAT_RAW, "id=3 temp=20.5", "id=3 temp=20.5");
+  check_encode(FORMAT_JSON, "id=3 temp=20.5 fw=v1.2",
+               "{\"id\":3,\"temp\":20.5,\"fw\":\"v1.2\"}\n");
+  check_encode(FORMAT_CSV, "id=3 temp=20.5 fw=v1.2", "3,20.5,v1.2\n");
+  // 分隔符可以混用，非 key=value 片段跳过
+  check_encode(FORMAT_CSV, "id=3,temp=1;junk\thum=2\r\n", "3,1,2\n");
+  // 不合 JSON 数字语法的值作为字符串
+  check_encode(FORMAT_JSON, "a=03 b=0x1f c=-1e5 d=1. e=-0.5",
+               "{\"a\":\"03\",\"b\":\"0x1f\",\"c\":-1e5,\"d\":\"1.\","
+               "\"e\":-0.5}\n");
+  check_encode(FORMAT_JSON, "k=a\"b\\c\x01", "{\"k\":\"a\\\"b\\\\c\\u0001\"}\n");
+  check_encode(FORMAT_CSV, "k=a\"b v=1", "\"a\"\"b\",1\n");
+  check_encode(FORMAT_JSON, "", "{}\n");
+
+  CHECK(format_parse("json", 4) == FORMAT_JSON);
+  CHECK(format_parse("csv ", 3) == FORMAT_CSV);
+  CHECK(format_parse("xml", 3) == -1);
+}
+
+static connection_t *subscriber(event_loop_t *loop, const char *args) {
+  connection_t *conn = connection_create(loop, -1);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  conn->high_watermark = 1 << 20;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s", args);
+  CHECK(event_subscribe_args(conn, buf) == 0);
+  return conn;
+}
+
+// 取出并清空一个订阅端收到的数据
+static int take(connection_t *conn, char *buf) {
+  int n = conn->out_len;
+  memcpy(buf, conn->outbuf, n);
+  buf[n] = 0;
+  connection_out_sent(conn, n);
+  conn->out_len = 0;
+  return n;
+}
+
+static void test_encode_once(void) {
+  event_loop_t *loop = event_loop_create();
+  event_bus_init();
+  connection_t *json[3], *csv, *raw, *filtered;
+  for (int i = 0; i < 3; i++)
+    json[i] = subscriber(loop, "sensor FORMAT json");
+  csv = subscriber(loop, "sensor FORMAT csv");
+  raw = subscriber(loop, "sensor");
+  filtered = subscriber(loop, "sensor FORMAT json temp>100");
+
+  char buf[256];
+  const char msg[] = "id=1 temp=20";
+  for (int round = 0; round < 3; round++) {
+    encodes = 0;
+    event_publish("sensor", msg, sizeof(msg) - 1);
+    CHECK(encodes == 2); // json、csv 各一次，raw 不编码
+    for (int i = 0; i < 3; i++) {
+      take(json[i], buf);
+      CHECK(strcmp(buf, "{\"id\":1,\"temp\":20}\n") == 0);
+    }
+    take(csv, buf);
+    CHECK(strcmp(buf, "1,20\n") == 0);
+    take(raw, buf);
+    CHECK(strcmp(buf, msg) == 0);
+    CHECK(take(filtered, buf) == 0);
+  }
+
+  // 编码结果不能串到下一条消息
+  const char next[] = "id=2 temp=200";
+  event_publish("sensor", next, sizeof(next) - 1);
+  take(json[0], buf);
+  CHECK(strcmp(buf, "{\"id\":2,\"temp\":200}\n") == 0);
+  take(filtered, buf);
+  CHECK(strcmp(buf, "{\"id\":2,\"temp\":200}\n") == 0);
+}
+
+int main(void) {
+  test_encode();
+  test_encode_once();
+  return test_report("format_test");
+}
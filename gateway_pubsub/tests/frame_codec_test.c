@@ -0,0 +1,109 @@
+// Delimiter framing (protocol/frame_codec.h): the SSE2 and AVX2 split
+// kernels against the scalar one at awkward lengths and alignments.
+//
+// frame_codec.c is compiled into the test so the static kernels can be
+// called directly.
+#include "../src/protocol/frame_codec.c"
+#include "test.h"
+#include <string.h>
+
+#define BUF_MAX 300
+#define FRAMES_MAX BUF_MAX
+
+typedef struct {
+  const char *base;
+  int n;
+  int off[FRAMES_MAX];
+  int len[FRAMES_MAX];
+} frames_t;
+
+static void record(const char *frame, int len, void *arg) {
+  frames_t *f = arg;
+  f->off[f->n] = frame - f->base;
+  f->len[f->n] = len;
+  f->n++;
+}
+
+static uint32_t rng = 88675123u;
+
+static uint32_t next_rand(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void check_kernel(const char *name, split_kernel_t kernel,
+                         const char *buf, int len, unsigned char delim) {
+  frames_t want = {buf, 0, {0}, {0}}, got = {buf, 0, {0}, {0}};
+  int want_used = split_scalar(buf, len, delim, record, &want);
+  int got_used = kernel(buf, len, delim, record, &got);
+  if (want_used != got_used || want.n != got.n ||
+      memcmp(want.off, got.off, sizeof(int) * want.n) != 0 ||
+      memcmp(want.len, got.len, sizeof(int) * want.n) != 0) {
+    fprintf(stderr, "%s kernel differs: len=%d delim=0x%02x\n", name, len,
+            delim);
+    test_failures++;
+  }
+}
+
+// 分隔符密度从无到全是分隔符；0xFE 检查有符号比较
+static void fill(char *buf, int len, unsigned char delim, int density) {
+  for (int i = 0; i < len; i++) {
+    uint32_t r = next_rand();
+    if (density && (int)(r % 100) < density)
+      buf[i] = (char)delim;
+    else
+      buf[i] = (char)(r >> 8) == (char)delim ? 'x' : (char)(r >> 8);
+  }
+}
+
+static void test_kernels(void) {
+  static char storage[BUF_MAX + 64];
+  const unsigned char delims[] = {'\n', 0x7E, 0x00, 0xFE};
+  const int densities[] = {0, 3, 30, 100};
+  int avx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (!avx2)
+    printf("frame_codec_test: no AVX2 on this CPU, kernel not checked\n");
+
+  for (size_t d = 0; d < sizeof(delims); d++) {
+    for (size_t k = 0; k < sizeof(densities) / sizeof(densities[0]); k++) {
+      // 长度覆盖 0、向量宽度前后以及尾部逐字节处理
+      for (int len = 0; len <= BUF_MAX; len += len < 70 ? 1 : 23) {
+        for (int off = 0; off < 33; off += off < 3 ? 1 : 15) {
+          char *buf = storage + off;
+          fill(buf, len, delims[d], densities[k]);
+#ifdef __SSE2__
+          check_kernel("sse2", split_sse2, buf, len, delims[d]);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+          if (avx2)
+            check_kernel("avx2", split_avx2, buf, len, delims[d]);
+#endif
+        }
+      }
+    }
+  }
+}
+
+static void test_split(void) {
+  const char data[] = "a\n\nbc\nd";
+  frames_t f = {data, 0, {0}, {0}};
+  CHECK(frame_split(data, sizeof(data) - 1, '\n', record, &f) == 6);
+  CHECK(f.n == 2); // 空帧不回调
+  CHECK(f.off[0] == 0 && f.len[0] == 1);
+  CHECK(f.off[1] == 3 && f.len[1] == 2);
+
+  f.n = 0;
+  CHECK(frame_split(data, 0, '\n', record, &f) == 0);
+  CHECK(f.n == 0);
+}
+
+int main(void) {
+  test_split();
+  test_kernels();
+  return test_report("frame_codec_test");
+}
@@ -0,0 +1,134 @@
+// Consumer groups (bus/group.h): each policy spreads messages over the
+// members, hash keeps devices sticky and only moves the devices of a member
+// that leaves, and members that are closing are never picked.
+//
+// The policy is read once per process, so ctest runs this test once per
+// policy: group_test [rr|least|hash].
+#include "test.h"
+#include <bus/group.h>
+#include <core/event_loop.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMBERS 4
+#define DEVICES 200
+
+static connection_t *members[MEMBERS];
+
+static int index_of(const connection_t *c) {
+  if (!c)
+    return -1;
+  for (int i = 0; i < MEMBERS; i++) {
+    if (members[i] == c)
+      return i;
+  }
+  return -1;
+}
+
+static int pick(group_t *g, int id, uint64_t ingest_ns) {
+  char msg[32];
+  int len = id < 0 ? snprintf(msg, sizeof(msg), "temp=1")
+                   : snprintf(msg, sizeof(msg), "id=%d temp=1", id);
+  return index_of(group_pick(g, msg, len, ingest_ns));
+}
+
+// 各成员分到的消息数都不为 0，且每条消息恰好给一个成员
+static void check_spread(group_t *g, int n_members, int id) {
+  int count[MEMBERS] = {0};
+  for (int i = 0; i < 100 * n_members; i++) {
+    int m = pick(g, id < 0 ? -1 : i, 1000 + i);
+    CHECK(m >= 0 && m < n_members);
+    if (m >= 0)
+      count[m]++;
+  }
+  for (int m = 0; m < n_members; m++)
+    CHECK(count[m] > 0);
+}
+
+static void test_closing(group_t *g) {
+  members[1]->state = CONN_STATE_CLOSING;
+  for (int i = 0; i < 50; i++)
+    CHECK(pick(g, i, i) != 1);
+  for (int m = 0; m < MEMBERS; m++)
+    members[m]->state = CONN_STATE_CLOSING;
+  CHECK(pick(g, 1, 1) == -1); // 没有可用成员
+  for (int m = 0; m < MEMBERS; m++)
+    members[m]->state = CONN_STATE_OPEN;
+}
+
+static void test_rr(group_t *g) {
+  int count[MEMBERS] = {0};
+  for (int i = 0; i < 40; i++)
+    count[pick(g, i % 3, i)]++;
+  for (int m = 0; m < MEMBERS; m++)
+    CHECK(count[m] == 10);
+}
+
+static void test_least(group_t *g) {
+  for (int m = 0; m < MEMBERS; m++)
+    members[m]->out_len = 1000;
+  members[2]->out_len = 10;
+  for (int i = 0; i < 10; i++)
+    CHECK(pick(g, i, i) == 2);
+  members[2]->pending_len = 5000; // 排队中的字节也算
+  CHECK(pick(g, 1, 1) != 2);
+  members[2]->pending_len = 0;
+  // 排队量相同时从轮询位置开始，不会总选同一个
+  for (int m = 0; m < MEMBERS; m++)
+    members[m]->out_len = 0;
+  check_spread(g, MEMBERS, 0);
+}
+
+static void test_hash(group_t *g) {
+  int before[DEVICES];
+  for (int id = 0; id < DEVICES; id++) {
+    before[id] = pick(g, id, id);
+    CHECK(pick(g, id, id + 12345) == before[id]); // 与到达时间无关
+  }
+  check_spread(g, MEMBERS, 0);
+  check_spread(g, MEMBERS, -1); // 没有 id 的读数轮询
+
+  // 成员离开时只有它的设备换到别的成员
+  connection_t *gone = members[3];
+  CHECK(group_leave(g, gone) == MEMBERS - 1);
+  for (int id = 0; id < DEVICES; id++) {
+    int now = pick(g, id, id);
+    CHECK(now >= 0 && now != 3);
+    if (before[id] != 3)
+      CHECK(now == before[id]);
+  }
+  group_join(g, gone);
+  for (int id = 0; id < DEVICES; id++)
+    CHECK(pick(g, id, id) == before[id]);
+}
+
+int main(int argc, char **argv) {
+  const char *policy = argc > 1 ? argv[1] : "rr";
+  setenv("GATEWAY_GROUP_POLICY", policy, 1);
+
+  event_loop_t *loop = event_loop_create();
+  group_t *g = group_create("sensor", "workers");
+  CHECK(pick(g, 1, 1) == -1); // 空组
+  for (int m = 0; m < MEMBERS; m++) {
+    members[m] = connection_create(loop, -1);
+    members[m]->fd = 100 + m; // hash 策略按 fd 区分成员，不会用来收发
+    group_join(g, members[m]);
+  }
+  group_join(g, members[0]); // 重复加入无效
+  CHECK(group_has(g, members[0]));
+  CHECK(strcmp(group_name(g), "workers") == 0);
+
+  if (strcmp(policy, "least") == 0)
+    test_least(g);
+  else if (strcmp(policy, "hash") == 0)
+    test_hash(g);
+  else
+    test_rr(g);
+  test_closing(g);
+
+  for (int m = 0; m < MEMBERS; m++)
+    group_leave(g, members[m]);
+  CHECK(!group_has(g, members[0]));
+  group_free(g);
+  return test_report("group_test");
+}
@@ -0,0 +1,115 @@
+// LZ4 block compressor (core/lz.h): round trips through an independent
+// block decoder, including the end-of-block rules LZ4 decoders rely on.
+#include "test.h"
+#include <core/lz.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 按 LZ4 块格式解码，并检查块末尾的约束
+static int lz4_decode(const uint8_t *src, int n, uint8_t *dst, int cap) {
+  const uint8_t *ip = src, *iend = src + n;
+  uint8_t *op = dst, *oend = dst + cap;
+  int match_end = 0, match_start = 0;
+  while (ip < iend) {
+    int token = *ip++;
+    int lit = token >> 4;
+    if (lit == 15) {
+      int b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > iend - ip || lit > oend - op)
+      return -1;
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend)
+      break; // 最后一个序列只有字面量
+
+    if (iend - ip < 2)
+      return -1;
+    int off = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (off == 0 || off > op - dst)
+      return -1;
+    int mlen = token & 15;
+    if (mlen == 15) {
+      int b;
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        mlen += b;
+      } while (b == 255);
+    }
+    mlen += 4;
+    if (mlen > oend - op)
+      return -1;
+    match_start = op - dst;
+    for (int i = 0; i < mlen; i++)
+      op[i] = op[i - off]; // 可能与自身重叠
+    op += mlen;
+    match_end = op - dst;
+  }
+  int out = op - dst;
+  if (match_end && (out - match_end < 5 || out - match_start < 12))
+    return -1;
+  return out;
+}
+
+static void roundtrip(const char *name, const char *src, int n) {
+  int cap = n + n / 255 + 16;
+  char *comp = malloc(cap);
+  char *back = malloc(n + 1);
+  int c = lz_compress(src, n, comp, cap);
+  int d = c < 0 ? -1
+                : lz4_decode((const uint8_t *)comp, c, (uint8_t *)back, n + 1);
+  if (c < 0 || d != n || memcmp(src, back, n) != 0) {
+    fprintf(stderr, "lz round trip '%s' (%d bytes): compressed %d, got %d\n",
+            name, n, c, d);
+    test_failures++;
+  }
+  free(comp);
+  free(back);
+}
+
+int main(void) {
+  static char buf[70000];
+  uint32_t rng = 12345;
+
+  roundtrip("empty", buf, 0);
+  memset(buf, 'a', sizeof(buf));
+  for (int n = 1; n <= 20; n++) // 跨过 LZ_MFLIMIT 附近的边界
+    roundtrip("short run", buf, n);
+  roundtrip("long run", buf, sizeof(buf)); // 匹配长度需要多个 255 字节
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    rng = rng * 1103515245 + 12345;
+    buf[i] = rng >> 16;
+  }
+  roundtrip("random", buf, sizeof(buf)); // 全部字面量，超过 64 KB 窗口
+
+  int n = 0;
+  for (int i = 0; n < 60000; i++)
+    n += snprintf(buf + n, sizeof(buf) - n, "id=%d temp=%d.%d hum=%d\n",
+                  i % 37, 20 + i % 9, i % 10, 40 + i % 21);
+  roundtrip("readings", buf, n);
+
+  // 压缩后放不下时放弃，而不是写出界
+  char small[64];
+  memset(buf, 'a', 1000);
+  CHECK(lz_compress(buf, 1000, small, 8) == -1);
+  CHECK(lz_compress(buf, 1000, small, sizeof(small)) > 0);
+  rng = 1;
+  for (int i = 0; i < 1000; i++) {
+    rng = rng * 1103515245 + 12345;
+    buf[i] = rng >> 16;
+  }
+  CHECK(lz_compress(buf, 1000, small, sizeof(small)) == -1);
+  return test_report("lz_test");
+}
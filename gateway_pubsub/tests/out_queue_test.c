@@ -0,0 +1,164 @@
+// Subscriber output queues (core/connection.h): strict priority order,
+// FIFO within a class, shedding of bulk messages above the high watermark,
+// the critical-class allowance and, with GATEWAY_OUT_WEIGHTS, the byte
+// shares of deficit round robin.
+//
+// The weights are read once per process, so ctest runs the DRR case as
+// out_queue_test weighted.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MSG_LEN 64
+#define FILLER OUT_WIRE_CHUNK
+
+static const char class_tag[] = "CNB";
+
+static event_loop_t *loop;
+
+static connection_t *subscriber(int watermark) {
+  connection_t *conn = connection_create(loop, -1);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  conn->high_watermark = watermark;
+  return conn;
+}
+
+static void append(connection_t *conn, int prio, int seq) {
+  char msg[MSG_LEN];
+  memset(msg, '.', sizeof(msg));
+  snprintf(msg, sizeof(msg), "%c%05d", class_tag[prio], seq);
+  connection_append_msg(conn, prio, msg, sizeof(msg), 0, NULL);
+}
+
+// outbuf 中先放满 OUT_WIRE_CHUNK 字节，之后的消息都按类别排队
+static void fill_wire(connection_t *conn) {
+  static char filler[FILLER];
+  memset(filler, 'f', sizeof(filler));
+  connection_append_msg(conn, OUT_PRIO_NORMAL, filler, sizeof(filler), 0,
+                        NULL);
+  CHECK(conn->out_len == FILLER);
+}
+
+static void discard_wire(connection_t *conn) {
+  connection_out_sent(conn, conn->out_len);
+  conn->out_len = 0;
+}
+
+/**
+ * Moves up to max queued messages to outbuf and writes their tags
+ * ("C00003" ...) to tags, one per MSG_LEN.
+ *
+ * @return Number of messages taken.
+ */
+static int take(connection_t *conn, int max, char *tags) {
+  int n = 0;
+  while (n < max && conn->pending_len > 0) {
+    connection_fill_out(conn, 1); // 一次一条
+    CHECK(conn->out_len == MSG_LEN);
+    memcpy(tags + n * 6, conn->outbuf, 6);
+    n++;
+    discard_wire(conn);
+  }
+  tags[n * 6] = 0;
+  return n;
+}
+
+static void test_strict(void) {
+  connection_t *conn = subscriber(1 << 20);
+  fill_wire(conn);
+  for (int i = 0; i < 3; i++) {
+    append(conn, OUT_PRIO_BULK, i);
+    append(conn, OUT_PRIO_NORMAL, i);
+    append(conn, OUT_PRIO_CRITICAL, i);
+  }
+  CHECK(conn->pending_len == 9 * MSG_LEN);
+  discard_wire(conn);
+
+  char tags[64 * 6 + 1];
+  CHECK(take(conn, 64, tags) == 9);
+  CHECK(strcmp(tags, "C00000C00001C00002N00000N00001N00002"
+                     "B00000B00001B00002") == 0);
+
+  // 没有积压时直接进入 outbuf
+  append(conn, OUT_PRIO_BULK, 9);
+  CHECK(conn->pending_len == 0 && conn->out_len == MSG_LEN);
+  connection_close(conn);
+}
+
+static void test_shed(void) {
+  // 水位线正好容纳 filler 和 10 条消息
+  connection_t *conn = subscriber(FILLER + 10 * MSG_LEN);
+  fill_wire(conn);
+  for (int i = 0; i < 10; i++)
+    append(conn, OUT_PRIO_BULK, i);
+  CHECK(conn->out_shed == 0);
+
+  // 普通消息挤掉最早的批量消息
+  for (int i = 0; i < 4; i++)
+    append(conn, OUT_PRIO_NORMAL, i);
+  CHECK(conn->out_shed == 4);
+  // 已满时新的批量消息直接丢弃
+  append(conn, OUT_PRIO_BULK, 10);
+  CHECK(conn->out_shed == 5);
+
+  // 告警可用到两倍水位线，连接保持打开
+  for (int i = 0; i < 10; i++)
+    append(conn, OUT_PRIO_CRITICAL, i);
+  CHECK(conn->state == CONN_STATE_OPEN);
+  CHECK(conn->out_shed == 11); // 剩下的批量消息先被丢弃
+
+  discard_wire(conn);
+  char tags[64 * 6 + 1];
+  CHECK(take(conn, 64, tags) == 14);
+  CHECK(strncmp(tags, "C00000", 6) == 0);
+  CHECK(strcmp(tags + 10 * 6, "N00000N00001N00002N00003") == 0);
+
+  // 只剩普通消息可丢时，超过水位线就断开慢订阅端
+  fill_wire(conn);
+  for (int i = 0; i < 10; i++)
+    append(conn, OUT_PRIO_NORMAL, i);
+  CHECK(conn->state == CONN_STATE_OPEN);
+  append(conn, OUT_PRIO_NORMAL, 10);
+  CHECK(conn->state == CONN_STATE_CLOSING);
+  connection_close(conn);
+}
+
+static void test_weighted(void) {
+  connection_t *conn = subscriber(1 << 20);
+  fill_wire(conn);
+  for (int i = 0; i < 200; i++) {
+    append(conn, OUT_PRIO_CRITICAL, i);
+    append(conn, OUT_PRIO_NORMAL, i);
+    append(conn, OUT_PRIO_BULK, i);
+  }
+  discard_wire(conn);
+
+  // 权重 8,2,1、额度 512 字节：每轮 64 + 16 + 8 条 64 字节的消息
+  static char tags[264 * 6 + 1];
+  CHECK(take(conn, 264, tags) == 264);
+  int count[OUT_PRIO_CLASSES] = {0};
+  for (int i = 0; i < 264; i++)
+    count[strchr(class_tag, tags[i * 6]) - class_tag]++;
+  CHECK(count[OUT_PRIO_CRITICAL] == 192);
+  CHECK(count[OUT_PRIO_NORMAL] == 48);
+  CHECK(count[OUT_PRIO_BULK] == 24);
+  // 类别内仍按先后顺序
+  CHECK(strstr(tags, "B00023") != NULL && strstr(tags, "B00024") == NULL);
+  connection_close(conn);
+}
+
+int main(int argc, char **argv) {
+  int weighted = argc > 1 && strcmp(argv[1], "weighted") == 0;
+  if (weighted)
+    setenv("GATEWAY_OUT_WEIGHTS", "8,2,1", 1);
+  loop = event_loop_create();
+  if (weighted) {
+    test_weighted();
+  } else {
+    test_strict();
+    test_shed();
+  }
+  return test_report("out_queue_test");
+}
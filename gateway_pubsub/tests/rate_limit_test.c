@@ -0,0 +1,51 @@
+// Per-MCU token bucket (protocol/rate_limit.h): pausing once the bucket
+// is empty, refill over time and the burst cap.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <protocol/rate_limit.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// 40960 字节/秒、100 ms 突发：桶容量正好是 CONN_INBUF_SIZE
+
+static void sleep_ms(long ms) {
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+int main(void) {
+  setenv("GATEWAY_MCU_RATE", "40960", 1);
+  setenv("GATEWAY_MCU_BURST_MS", "100", 1);
+
+  event_loop_t *loop = event_loop_create();
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    perror("socketpair");
+    return 1;
+  }
+  connection_t *mcu = connection_create(loop, sv[0]);
+  event_loop_add(loop, mcu->fd, mcu->events, mcu);
+
+  // 桶初始为满：一次完整的 read 后耗尽并暂停读取
+  CHECK(rate_limit_charge(mcu, CONN_INBUF_SIZE - 1) == 0);
+  CHECK(rate_limit_charge(mcu, 64) == 1);
+  CHECK(mcu->rate_paused);
+  CHECK(!(mcu->events & EPOLLIN));
+
+  // 50 ms 至少补回 2048 字节；再取一整桶必然透支
+  sleep_ms(50);
+  CHECK(rate_limit_charge(mcu, 1024) == 0);
+  CHECK(rate_limit_charge(mcu, CONN_INBUF_SIZE) == 1);
+
+  // 空闲再久，令牌也不超过桶容量
+  sleep_ms(300);
+  CHECK(rate_limit_charge(mcu, CONN_INBUF_SIZE - 256) == 0);
+  CHECK(rate_limit_charge(mcu, 512) == 1);
+
+  close(sv[1]);
+  connection_close(mcu);
+  return test_report("rate_limit_test");
+}
@@ -0,0 +1,89 @@
+// Windowed rollups (bus/rollup.h): aggregate lines published when a window
+// closes, lines at the maximum column count, and the per-thread device cap.
+//
+// Includes the source to close windows without waiting for their timers.
+#include "../src/bus/rollup.c"
+#include "test.h"
+#include <core/connection.h>
+
+static connection_t *subscriber(event_loop_t *loop, const char *topic) {
+  connection_t *conn = connection_create(loop, -1);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  conn->high_watermark = 1 << 24;
+  char args[64];
+  snprintf(args, sizeof(args), "%s", topic);
+  event_subscribe_args(conn, args);
+  return conn;
+}
+
+// 关闭窗口，返回订阅端收到的聚合行
+static char *close_window(connection_t *conn, int w) {
+  static char text[1 << 16];
+  flush_window(&windows[w]);
+  connection_fill_out(conn, sizeof(text) - 1);
+  int len = conn->out_len < (int)sizeof(text) ? conn->out_len : 0;
+  memcpy(text, conn->outbuf, len);
+  text[len] = 0;
+  conn->out_len = 0;
+  return text;
+}
+
+static void record(const char *reading) {
+  rollup_record(reading, strlen(reading));
+}
+
+static void test_aggregate(connection_t *conn) {
+  record("id=3 temp=20.5");
+  record("id=3 temp=21 hum=40");
+  record("temp=5");
+  CHECK(strcmp(close_window(conn, 0),
+               "id=3 temp.min=20.5 temp.max=21 temp.mean=20.75 temp.n=2 "
+               "hum.min=40 hum.max=40 hum.mean=40 hum.n=1\n"
+               "temp.min=5 temp.max=5 temp.mean=5 temp.n=1\n") == 0);
+  // 窗口关闭后重新计数
+  CHECK(strcmp(close_window(conn, 0), "") == 0);
+}
+
+// 字段数和字段名都取上限，数值取最长的 %g 输出
+static void test_long_line(connection_t *conn) {
+  char reading[512];
+  int len = snprintf(reading, sizeof(reading), "id=-2147483647");
+  for (int f = 0; f < ROLLUP_MAX_FIELDS; f++)
+    len += snprintf(reading + len, sizeof(reading) - len,
+                    " field_number_%02d=-1.234567e+38", f);
+  record(reading);
+  record(reading);
+  const char *line = close_window(conn, 0);
+  CHECK(strlen(line) > 900 && strlen(line) < LINE_TEXT_MAX);
+  CHECK(strncmp(line, "id=-2147483647 field_number_00.min=-1.23457e+38 ",
+                48) == 0);
+  CHECK(strstr(line, " field_number_07.mean=-1.23457e+38 ") != NULL);
+  CHECK(strstr(line, " field_number_07.n=2\n") != NULL);
+}
+
+static void test_device_cap(void) {
+  char reading[64];
+  for (int i = 0; i < ROLLUP_MAX_DEVICES + 5; i++) {
+    snprintf(reading, sizeof(reading), "id=%d v=1", 1000 + i);
+    record(reading);
+  }
+  record("id=1000 v=2"); // 已跟踪的设备不受影响
+  char line[128];
+  rollup_report(line, sizeof(line));
+  // 加上前面测试中的三台设备，最后 8 台不再跟踪
+  snprintf(reading, sizeof(reading), "rollup devices=%d untracked=8\n",
+           ROLLUP_MAX_DEVICES);
+  CHECK(strcmp(line, reading) == 0);
+  CHECK(device_get(1000) != NULL && device_get(1000)->win[0].count[0] == 2);
+}
+
+int main(void) {
+  setenv("GATEWAY_ROLLUP_WINDOWS", "1s", 1);
+  event_loop_t *loop = event_loop_create();
+  rollup_init(loop);
+  connection_t *conn = subscriber(loop, "sensor.1s");
+  test_aggregate(conn);
+  test_long_line(conn);
+  test_device_cap();
+  return test_report("rollup_test");
+}
@@ -0,0 +1,68 @@
+// Subscriber command reading (transport/unix_listener.h): line-terminated
+// commands, commands spanning reads, and unterminated single-write commands
+// from older clients.
+#include "test.h"
+#include <core/connection.h>
+#include <core/event_loop.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <transport/unix_listener.h>
+#include <unistd.h>
+
+static event_loop_t *loop;
+static char seen[1024]; // 收到的命令，每条后加 '|'
+
+static void record(connection_t *conn, char *cmd) {
+  (void)conn;
+  strcat(seen, cmd);
+  strcat(seen, "|");
+}
+
+// 发一次 write，读一次，返回本次处理的命令
+static const char *feed(connection_t *conn, int peer, const char *data) {
+  seen[0] = 0;
+  CHECK(write(peer, data, strlen(data)) == (ssize_t)strlen(data));
+  subscriber_read_commands(conn, record);
+  return seen;
+}
+
+static connection_t *subscriber(int *peer) {
+  int sv[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  *peer = sv[1];
+  connection_t *conn = connection_create(loop, sv[0]);
+  conn->events |= EPOLLOUT; // 不触发 epoll_ctl
+  return conn;
+}
+
+static void test_unterminated(void) {
+  int peer;
+  connection_t *conn = subscriber(&peer);
+  CHECK(strcmp(feed(conn, peer, "SUB temp"), "SUB temp|") == 0);
+  CHECK(conn->in_len == 0);
+  CHECK(strcmp(feed(conn, peer, "SUB hum\r"), "SUB hum|") == 0);
+  CHECK(strcmp(feed(conn, peer, "STATS"), "STATS|") == 0);
+  close(peer);
+  connection_destroy(conn);
+}
+
+static void test_lines(void) {
+  int peer;
+  connection_t *conn = subscriber(&peer);
+  CHECK(strcmp(feed(conn, peer, "SUB a\nSUB b\r\nSUB c"), "SUB a|SUB b|") ==
+        0);
+  CHECK(strcmp(feed(conn, peer, "d\n"), "SUB cd|") == 0);
+  // 发过换行符后，不完整的行留到下一次读取
+  CHECK(strcmp(feed(conn, peer, "SUB e"), "") == 0);
+  CHECK(strcmp(feed(conn, peer, "f\nSEND 1 x\n"), "SUB ef|SEND 1 x|") == 0);
+  CHECK(conn->in_len == 0);
+  close(peer);
+  connection_destroy(conn);
+}
+
+int main(void) {
+  loop = event_loop_create();
+  test_unterminated();
+  test_lines();
+  return test_report("subscriber_test");
+}